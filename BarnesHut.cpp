@@ -0,0 +1,312 @@
+//  Copyright 2024 Vy Tran
+
+#include "BarnesHut.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "ForceKernels.hpp"
+
+namespace NB {
+    BarnesHut::BarnesHut(double theta) : mTheta(theta), mSoftening(0), dimensions(2) {}
+
+    void BarnesHut::setTheta(double theta) {
+        mTheta = theta;
+    }
+
+    double BarnesHut::theta() const {
+        return mTheta;
+    }
+
+    void BarnesHut::setSoftening(double softening) {
+        mSoftening = softening;
+    }
+
+    double BarnesHut::softening() const {
+        return mSoftening;
+    }
+
+    std::size_t BarnesHut::nodeCount() const {
+        return dimensions == 3 ? octNodes.size() : quadNodes.size();
+    }
+
+    template <>
+    std::vector<BarnesHut::Node<2>>& BarnesHut::arena<2>() {
+        return quadNodes;
+    }
+
+    template <>
+    std::vector<BarnesHut::Node<3>>& BarnesHut::arena<3>() {
+        return octNodes;
+    }
+
+    template <>
+    const std::vector<BarnesHut::Node<2>>& BarnesHut::arena<2>() const {
+        return quadNodes;
+    }
+
+    template <>
+    const std::vector<BarnesHut::Node<3>>& BarnesHut::arena<3>() const {
+        return octNodes;
+    }
+
+    void BarnesHut::build(const BodyState& state) {
+        dimensions = state.dimensions;
+        if (dimensions == 3) {
+            build<3>(state);
+        } else {
+            build<2>(state);
+        }
+    }
+
+    template <int Dim>
+    void BarnesHut::build(const BodyState& state) {
+        std::vector<Node<Dim>>& nodes = arena<Dim>();
+        nodes.clear();
+        nextBody.assign(state.size(), -1);
+        const std::size_t n = state.size();
+        if (n == 0) {
+            return;
+        }
+
+        // Root cell is the bounding square (cube) of all bodies
+        Node<Dim> root{};
+        double halfSize = 0.0;
+        for (int axis = 0; axis < Dim; ++axis) {
+            const std::vector<double>& position = state.position(axis);
+            double low = position[0], high = position[0];
+            for (std::size_t i = 1; i < n; ++i) {
+                low = std::min(low, position[i]);
+                high = std::max(high, position[i]);
+            }
+            root.center[axis] = 0.5 * (low + high);
+            halfSize = std::max(halfSize, 0.5 * (high - low));
+        }
+        root.halfSize = halfSize > 0.0 ? halfSize * (1.0 + 1e-9) : 1.0;
+        root.firstChild = -1;
+        root.firstBody = -1;
+        nodes.push_back(root);
+
+        for (std::size_t i = 0; i < n; ++i) {
+            insert<Dim>(state, static_cast<std::int32_t>(i));
+        }
+        computeMoments<Dim>(state);
+    }
+
+    template <int Dim>
+    std::int32_t BarnesHut::childFor(std::int32_t node, const BodyState& state,
+                                     std::int32_t body) const {
+        const Node<Dim>& cell = arena<Dim>()[node];
+        std::int32_t child = cell.firstChild + (state.x[body] >= cell.center[0] ? 1 : 0)
+                                             + (state.y[body] >= cell.center[1] ? 2 : 0);
+        if constexpr (Dim == 3) {
+            child += state.z[body] >= cell.center[2] ? 4 : 0;
+        }
+        return child;
+    }
+
+    template <int Dim>
+    void BarnesHut::insert(const BodyState& state, std::int32_t body) {
+        std::vector<Node<Dim>>& nodes = arena<Dim>();
+        std::int32_t node = 0;
+        int depth = 0;
+        for (;;) {
+            ++nodes[node].count;
+            if (nodes[node].firstChild >= 0) {
+                node = childFor<Dim>(node, state, body);
+                ++depth;
+                continue;
+            }
+            if (nodes[node].count <= kLeafCapacity || depth >= kMaxDepth) {
+                nextBody[body] = nodes[node].firstBody;
+                nodes[node].firstBody = body;
+                return;
+            }
+            // Leaf overflowed: push its bodies one level down and retry from there
+            subdivide<Dim>(state, node);
+            node = childFor<Dim>(node, state, body);
+            ++depth;
+        }
+    }
+
+    template <int Dim>
+    void BarnesHut::subdivide(const BodyState& state, std::int32_t node) {
+        std::vector<Node<Dim>>& nodes = arena<Dim>();
+        const std::int32_t first = static_cast<std::int32_t>(nodes.size());
+        const double quarter = 0.5 * nodes[node].halfSize;
+        for (int q = 0; q < (1 << Dim); ++q) {
+            Node<Dim> child{};
+            for (int axis = 0; axis < Dim; ++axis) {
+                child.center[axis] = nodes[node].center[axis]
+                                   + ((q >> axis) & 1 ? quarter : -quarter);
+            }
+            child.halfSize = quarter;
+            child.firstChild = -1;
+            child.firstBody = -1;
+            nodes.push_back(child);
+        }
+        nodes[node].firstChild = first;
+
+        std::int32_t body = nodes[node].firstBody;
+        nodes[node].firstBody = -1;
+        while (body >= 0) {
+            std::int32_t next = nextBody[body];
+            Node<Dim>& child = nodes[childFor<Dim>(node, state, body)];
+            nextBody[body] = child.firstBody;
+            child.firstBody = body;
+            ++child.count;
+            body = next;
+        }
+    }
+
+    template <int Dim>
+    void BarnesHut::computeMoments(const BodyState& state) {
+        std::vector<Node<Dim>>& nodes = arena<Dim>();
+        const double* position[3] = {state.x.data(), state.y.data(), state.z.data()};
+        // Children are always stored after their parent, so a reverse sweep is bottom-up
+        for (std::size_t k = nodes.size(); k-- > 0;) {
+            Node<Dim>& cell = nodes[k];
+            double mass = 0.0, moment[Dim] = {};
+            if (cell.firstChild >= 0) {
+                for (int q = 0; q < (1 << Dim); ++q) {
+                    const Node<Dim>& child = nodes[cell.firstChild + q];
+                    mass += child.mass;
+                    for (int axis = 0; axis < Dim; ++axis) {
+                        moment[axis] += child.mass * child.com[axis];
+                    }
+                }
+            } else {
+                for (std::int32_t b = cell.firstBody; b >= 0; b = nextBody[b]) {
+                    mass += state.mass[b];
+                    for (int axis = 0; axis < Dim; ++axis) {
+                        moment[axis] += state.mass[b] * position[axis][b];
+                    }
+                }
+            }
+            cell.mass = mass;
+            // Cells whose masses cancel out (negative masses) fall back to the cell center
+            for (int axis = 0; axis < Dim; ++axis) {
+                cell.com[axis] = mass != 0.0 ? moment[axis] / mass : cell.center[axis];
+            }
+        }
+    }
+
+    void BarnesHut::computeAccelerations(const BodyState& state, std::size_t begin,
+                                         std::size_t end, double* ax, double* ay, double* az,
+                                         double* potential) const {
+        if (dimensions == 3) {
+            accelerations<3>(state, begin, end, ax, ay, az, potential);
+        } else {
+            accelerations<2>(state, begin, end, ax, ay, az, potential);
+        }
+    }
+
+    template <int Dim>
+    void BarnesHut::accelerations(const BodyState& state, std::size_t begin, std::size_t end,
+                                  double* ax, double* ay, double* az, double* potential) const {
+        const std::vector<Node<Dim>>& nodes = arena<Dim>();
+        const double* position[3] = {state.x.data(), state.y.data(), state.z.data()};
+        const double theta2 = mTheta * mTheta;
+        const double softening2 = mSoftening * mSoftening;
+        const double selfInvR = mSoftening > 0.0 ? 1.0 / mSoftening : 0.0;
+        std::int32_t stack[(1 << Dim) * (kMaxDepth + 1)];
+        for (std::size_t i = begin; i < end; ++i) {
+            double target[Dim];
+            for (int axis = 0; axis < Dim; ++axis) {
+                target[axis] = position[axis][i];
+            }
+            double sum[Dim] = {};
+            double sumPotential = 0.0;
+            int top = 0;
+            if (!nodes.empty()) {
+                stack[top++] = 0;
+            }
+            while (top > 0) {
+                const Node<Dim>& cell = nodes[stack[--top]];
+                if (cell.count == 0) {
+                    continue;
+                }
+                if (cell.firstChild < 0) {
+                    for (std::int32_t b = cell.firstBody; b >= 0; b = nextBody[b]) {
+                        double d[Dim];
+                        double r2 = 0.0;
+                        for (int axis = 0; axis < Dim; ++axis) {
+                            d[axis] = position[axis][b] - target[axis];
+                            r2 += d[axis] * d[axis];
+                        }
+                        r2 += softening2;
+                        double invR = r2 > 0.0 ? 1.0 / std::sqrt(r2) : 0.0;
+                        double s = state.mass[b] * invR * invR * invR;
+                        for (int axis = 0; axis < Dim; ++axis) {
+                            sum[axis] += s * d[axis];
+                        }
+                        sumPotential += state.mass[b] * invR;
+                    }
+                    continue;
+                }
+                double d[Dim];
+                double d2 = 0.0;
+                for (int axis = 0; axis < Dim; ++axis) {
+                    d[axis] = cell.com[axis] - target[axis];
+                    d2 += d[axis] * d[axis];
+                }
+                // Never approximate a cell holding the target: its own mass would pull
+                // on it, and for theta >~ 0.7 the center of mass can be far enough away
+                bool outside = false;
+                for (int axis = 0; axis < Dim; ++axis) {
+                    outside |= std::abs(target[axis] - cell.center[axis]) > cell.halfSize;
+                }
+                double size = 2.0 * cell.halfSize;
+                if (outside && size * size < theta2 * d2) {
+                    double invD = 1.0 / std::sqrt(d2 + softening2);
+                    double s = cell.mass * invD * invD * invD;
+                    for (int axis = 0; axis < Dim; ++axis) {
+                        sum[axis] += s * d[axis];
+                    }
+                    sumPotential += cell.mass * invD;
+                } else {
+                    for (int q = 0; q < (1 << Dim); ++q) {
+                        stack[top++] = cell.firstChild + q;
+                    }
+                }
+            }
+            ax[i] = G * sum[0];
+            ay[i] = G * sum[1];
+            if constexpr (Dim == 3) {
+                az[i] = G * sum[2];
+            }
+            if (potential) {
+                // With softening, body i saw itself at distance eps in its leaf
+                potential[i] = -G * (sumPotential - state.mass[i] * selfInvR);
+            }
+        }
+    }
+
+    double BarnesHut::maxRelativeError(const BodyState& state, std::size_t samples) const {
+        const std::size_t n = state.size();
+        samples = std::min(samples, n);
+        std::vector<double> tree[3], direct[3];
+        for (int axis = 0; axis < 3; ++axis) {
+            tree[axis].resize(n);
+            direct[axis].resize(n);
+        }
+        double maxError = 0.0;
+        for (std::size_t k = 0; k < samples; ++k) {
+            std::size_t i = k * n / samples;
+            computeAccelerations(state, i, i + 1, tree[0].data(), tree[1].data(),
+                                 tree[2].data());
+            NB::computeAccelerations(state, i, i + 1, direct[0].data(), direct[1].data(),
+                                     direct[2].data(), SimdLevel::Scalar, mSoftening);
+            double reference = std::hypot(direct[0][i], direct[1][i]);
+            double error = std::hypot(tree[0][i] - direct[0][i], tree[1][i] - direct[1][i]);
+            if (state.dimensions == 3) {
+                reference = std::hypot(direct[0][i], direct[1][i], direct[2][i]);
+                error = std::hypot(tree[0][i] - direct[0][i], tree[1][i] - direct[1][i],
+                                   tree[2][i] - direct[2][i]);
+            }
+            if (reference > 0.0) {
+                maxError = std::max(maxError, error / reference);
+            }
+        }
+        return maxError;
+    }
+}  //  namespace NB
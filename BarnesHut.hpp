@@ -0,0 +1,76 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef BARNESHUT_HPP
+#define BARNESHUT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "BodyState.hpp"
+
+namespace NB {
+
+// Barnes-Hut quadtree, or octree for 3D states. The tree is rebuilt from scratch
+// every step into a node arena whose capacity is kept between builds, so
+// steady-state stepping does not allocate. A cell is treated as a point mass when
+// size / distance < theta and the body is outside it. Building and walking are
+// templated on the dimension, so the quadtree's nodes and loops are exactly what
+// they would be without a z axis.
+class BarnesHut {
+ public:
+    explicit BarnesHut(double theta = 0.5);
+    void setTheta(double theta);
+    double theta() const;
+    // Plummer softening length, applied to body and cell interactions alike.
+    void setSoftening(double softening);
+    double softening() const;
+    // Rebuilds the tree from the current positions and masses.
+    void build(const BodyState& state);
+    // Accelerations of bodies [begin, end) from the last built tree, with az only
+    // written (and only needed) for a 3D state. Safe to call concurrently on
+    // disjoint ranges. `potential`, if given, gets the potential at each body from
+    // the same interactions.
+    void computeAccelerations(const BodyState& state, std::size_t begin, std::size_t end,
+                              double* ax, double* ay, double* az,
+                              double* potential = nullptr) const;
+    // Largest |a_tree - a_direct| / |a_direct| over `samples` evenly spaced bodies.
+    double maxRelativeError(const BodyState& state, std::size_t samples) const;
+    std::size_t nodeCount() const;
+
+ private:
+    template <int Dim>
+    struct Node {
+        double center[Dim];       // Geometric center of the square (cubic) cell
+        double halfSize;          // Half the side length of the cell
+        double mass;              // Total mass in the cell
+        double com[Dim];          // Center of mass of the cell
+        std::int32_t firstChild;  // First of 2^Dim consecutive children, -1 for leaves
+        std::int32_t firstBody;   // Head of a leaf's body list, -1 if empty
+        std::int32_t count;       // Number of bodies in the cell
+    };
+    static constexpr std::int32_t kLeafCapacity = 8;
+    static constexpr int kMaxDepth = 48;  // Deeper cells just grow their body list
+
+    template <int Dim> std::vector<Node<Dim>>& arena();
+    template <int Dim> const std::vector<Node<Dim>>& arena() const;
+    template <int Dim> void build(const BodyState& state);
+    template <int Dim> void insert(const BodyState& state, std::int32_t body);
+    template <int Dim> void subdivide(const BodyState& state, std::int32_t node);
+    template <int Dim> std::int32_t childFor(std::int32_t node, const BodyState& state,
+                                             std::int32_t body) const;
+    template <int Dim> void computeMoments(const BodyState& state);
+    template <int Dim> void accelerations(const BodyState& state, std::size_t begin,
+                                          std::size_t end, double* ax, double* ay, double* az,
+                                          double* potential) const;
+
+    double mTheta;
+    double mSoftening;
+    unsigned dimensions;                 // Of the state the tree was last built from
+    std::vector<Node<2>> quadNodes;      // Node arena of a 2D tree, root at index 0
+    std::vector<Node<3>> octNodes;       // Node arena of a 3D tree, root at index 0
+    std::vector<std::int32_t> nextBody;  // Singly linked body lists of the leaves
+};
+
+}  //  namespace NB
+
+#endif  //  BARNESHUT_HPP
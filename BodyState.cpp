@@ -0,0 +1,144 @@
+//  Copyright 2024 Vy Tran
+
+#include "BodyState.hpp"
+#include <cstring>
+#include <stdexcept>
+
+namespace NB {
+    std::size_t BodyState::size() const {
+        return mass.size();
+    }
+
+    void BodyState::resize(std::size_t n) {
+        x.resize(n);
+        y.resize(n);
+        vx.resize(n);
+        vy.resize(n);
+        if (dimensions == 3) {
+            z.resize(n);
+            vz.resize(n);
+        }
+        mass.resize(n);
+        names.resize(n);
+    }
+
+    void BodyState::reserve(std::size_t n) {
+        x.reserve(n);
+        y.reserve(n);
+        vx.reserve(n);
+        vy.reserve(n);
+        if (dimensions == 3) {
+            z.reserve(n);
+            vz.reserve(n);
+        }
+        mass.reserve(n);
+        names.reserve(n);
+    }
+
+    void BodyState::clear() {
+        x.clear();
+        y.clear();
+        z.clear();
+        vx.clear();
+        vy.clear();
+        vz.clear();
+        mass.clear();
+        names.clear();
+    }
+
+    void BodyState::setDimensions(unsigned count) {
+        if (count != 2 && count != 3) {
+            throw std::invalid_argument("Bodies have 2 or 3 dimensions, not "
+                                        + std::to_string(count));
+        }
+        dimensions = count;
+        if (count == 3) {
+            z.resize(size());
+            vz.resize(size());
+        } else {
+            z.clear();
+            vz.clear();
+        }
+    }
+
+    std::vector<double>& BodyState::position(unsigned axis) {
+        return axis == 0 ? x : axis == 1 ? y : z;
+    }
+
+    const std::vector<double>& BodyState::position(unsigned axis) const {
+        return axis == 0 ? x : axis == 1 ? y : z;
+    }
+
+    std::vector<double>& BodyState::velocity(unsigned axis) {
+        return axis == 0 ? vx : axis == 1 ? vy : vz;
+    }
+
+    const std::vector<double>& BodyState::velocity(unsigned axis) const {
+        return axis == 0 ? vx : axis == 1 ? vy : vz;
+    }
+
+    std::istream& BodyState::read(std::istream& in, std::size_t i) {
+        if (dimensions == 3) {
+            return in >> x[i] >> y[i] >> z[i] >> vx[i] >> vy[i] >> vz[i] >> mass[i] >> names[i];
+        }
+        return in >> x[i] >> y[i] >> vx[i] >> vy[i] >> mass[i] >> names[i];
+    }
+
+    std::ostream& BodyState::write(std::ostream& out, std::size_t i) const {
+        if (dimensions == 3) {
+            return out << x[i] << " " << y[i] << " " << z[i] << " " << vx[i] << " " << vy[i]
+            << " " << vz[i] << " " << mass[i] << " " << names[i];
+        }
+        return out << x[i] << " " << y[i] << " " << vx[i] << " " << vy[i] << " "
+        << mass[i] << " " << names[i];
+    }
+
+    void BodyState::applyForce(std::size_t i, double xForce, double yForce, double seconds) {
+        // Calculate acceleration x and y given the force. a = F/m
+        double ax = xForce / mass[i];
+        double ay = yForce / mass[i];
+        applyAcceleration(i, ax, ay, seconds);
+    }
+
+    void BodyState::applyForce(std::size_t i, double xForce, double yForce, double zForce,
+                               double seconds) {
+        applyAcceleration(i, xForce / mass[i], yForce / mass[i], zForce / mass[i], seconds);
+    }
+
+    void BodyState::applyAcceleration(std::size_t i, double ax, double ay, double seconds) {
+        // Update the velocity using the acceleration. v1 = v0 + a * t
+        vx[i] += ax * seconds;
+        vy[i] += ay * seconds;
+        // Update the position using the speed. x1 = x0 + v1 * t
+        x[i] += vx[i] * seconds;
+        y[i] += vy[i] * seconds;
+    }
+
+    void BodyState::applyAcceleration(std::size_t i, double ax, double ay, double az,
+                                      double seconds) {
+        applyAcceleration(i, ax, ay, seconds);
+        vz[i] += az * seconds;
+        z[i] += vz[i] * seconds;
+    }
+
+    std::uint64_t stateHash(const BodyState& state) {
+        std::uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](std::uint64_t word) {
+            for (int byte = 0; byte < 8; ++byte) {
+                hash ^= (word >> (8 * byte)) & 0xff;
+                hash *= 1099511628211ull;
+            }
+        };
+        mix(state.dimensions);
+        mix(state.size());
+        for (const std::vector<double>* column : {&state.x, &state.y, &state.z, &state.vx,
+                                                   &state.vy, &state.vz, &state.mass}) {
+            for (double value : *column) {
+                std::uint64_t bits;
+                std::memcpy(&bits, &value, sizeof bits);
+                mix(bits);
+            }
+        }
+        return hash;
+    }
+}  //  namespace NB
@@ -0,0 +1,55 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef BODYSTATE_HPP
+#define BODYSTATE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace NB {
+
+// Structure-of-arrays storage for the physical state of all bodies in a universe.
+// The physics loops only walk the contiguous double arrays (40 bytes per body in
+// 2D, 56 in 3D); texture names live in their own column and are only touched by I/O.
+// A 2D state keeps z and vz empty, so it carries no cost for the third axis.
+struct BodyState {
+    std::vector<double> x, y, z;     // Positions
+    std::vector<double> vx, vy, vz;  // Velocities
+    std::vector<double> mass;        // Masses
+    std::vector<std::string> names;  // Texture filenames
+    unsigned dimensions = 2;         // 2 or 3; z and vz hold size() entries only in 3D
+
+    std::size_t size() const;
+    void resize(std::size_t n);
+    void reserve(std::size_t n);
+    void clear();
+    // Switches between 2 and 3 dimensions. New z components start at zero and
+    // dropping them projects the bodies onto the xy plane.
+    void setDimensions(unsigned dimensions);
+    // Component arrays by axis: 0 is x, 1 is y and 2 is z.
+    std::vector<double>& position(unsigned axis);
+    const std::vector<double>& position(unsigned axis) const;
+    std::vector<double>& velocity(unsigned axis);
+    const std::vector<double>& velocity(unsigned axis) const;
+    // Text I/O of body i as "x y vx vy mass name", or "x y z vx vy vz mass name" in 3D.
+    std::istream& read(std::istream& in, std::size_t i);
+    std::ostream& write(std::ostream& out, std::size_t i) const;
+    // Semi-implicit Euler update of body i under the given net force.
+    void applyForce(std::size_t i, double xForce, double yForce, double seconds);
+    void applyForce(std::size_t i, double xForce, double yForce, double zForce, double seconds);
+    // Same update for a known acceleration.
+    void applyAcceleration(std::size_t i, double ax, double ay, double seconds);
+    void applyAcceleration(std::size_t i, double ax, double ay, double az, double seconds);
+};
+
+// FNV-1a hash of the bit patterns of every position, velocity and mass, and of the
+// dimensions. Two runs that differ anywhere by a single bit almost surely hash
+// differently, so printing it every step shows where they part. Names are left out.
+std::uint64_t stateHash(const BodyState& state);
+
+}  //  namespace NB
+
+#endif  //  BODYSTATE_HPP
@@ -4,29 +4,48 @@
 #define CELESTIALBODY_HPP
 
 #include <iostream>
+#include <memory>
+#include <string>
 #include <SFML/Graphics.hpp>
+#include "BodyState.hpp"
 
 namespace NB {
 
+using Vector2d = sf::Vector2<double>;
+
+// Lightweight handle to one row of a BodyState, used for rendering and I/O.
+// A default-constructed body owns a one-row state of its own; a body handed
+// out by Universe is a view into the universe's arrays, so copies alias.
 class CelestialBody : public sf::Drawable {
  public:
     CelestialBody();
     // Single-parameter constructors should be marked explicit.
     explicit CelestialBody(double universeRadius);
+    CelestialBody(BodyState* state, std::size_t index,
+                  std::shared_ptr<sf::Texture> texture, double universeRadius);
     friend std::istream& operator>>(std::istream& in, CelestialBody& body);
     friend std::ostream& operator<<(std::ostream& out, const CelestialBody& body);
     void draw(sf::RenderTarget& target, sf::RenderStates states) const override;
+    //  Rounded to float for SFML; physics and I/O use the exact accessors below. In a
+    //  3D universe these are the projected (x, y) components; z is in the BodyState.
     sf::Vector2f position() const;
     sf::Vector2f velocity() const;
     float mass() const;
+    Vector2d exactPosition() const;
+    Vector2d exactVelocity() const;
+    double exactMass() const;
     void applyForce(double xForce, double yForce, double seconds);
+    //  Maps universe coordinates to the target, with the universe radius fitting the
+    //  smaller side and y pointing up. 3D universes are viewed down the z axis, so
+    //  bodies are drawn at their (x, y): an orthographic projection.
+    static sf::Vector2f toScreen(double x, double y, const sf::Vector2u& targetSize,
+                                 double universeRadius);
  private:
-    sf::Texture texture;  // Texture to hold the image of the celestial body
-    double xPos, yPos;    // Position of the celestial body
-    double xVel, yVel;    // Velocity of the celestial body
-    double mMass;          // Mass of the celestial body
+    std::shared_ptr<BodyState> storage;  // Backing state of a standalone body, null for views
+    BodyState* state;       // State arrays holding this body
+    std::size_t index;      // Row of this body in `state`
+    std::shared_ptr<sf::Texture> texture;  // Image of the celestial body, from TextureCache
     double universeRadius;
-    std::string textureFilename;
 };
 
 }  //  namespace NB
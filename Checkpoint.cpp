@@ -0,0 +1,241 @@
+//  Copyright 2024 Vy Tran
+
+#include "Checkpoint.hpp"
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <vector>
+#include "MappedFile.hpp"
+#include "Profiler.hpp"
+
+namespace NB {
+    namespace {
+    const char kMagic[8] = {'N', 'B', 'O', 'D', 'Y', 'S', 'N', 'P'};
+    const std::uint32_t kByteOrderMark = 0x01020304;
+
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byteOrder;
+        std::uint64_t bodyCount;
+        std::uint64_t steps;
+        double elapsedTime;
+        double radius;
+        std::uint64_t nameCount;
+        std::uint64_t nameTableBytes;
+        std::uint64_t dimensions;  // Since version 2
+        std::uint64_t integrator;  // Since version 3: IntegratorKind
+        std::uint64_t integratorValues;
+    };
+    static_assert(sizeof(Header) % 8 == 0, "arrays after the header must stay 8-byte aligned");
+    const std::size_t kVersion1HeaderBytes = offsetof(Header, dimensions);
+    const std::size_t kVersion2HeaderBytes = offsetof(Header, integrator);
+
+    // Columns in file order; z and vz exist only in 3D.
+    template <typename State>
+    auto columns(State& state) {
+        std::vector<decltype(&state.x)> result = {&state.x, &state.y, &state.vx, &state.vy,
+                                                  &state.mass};
+        if (state.dimensions == 3) {
+            result.push_back(&state.z);
+            result.push_back(&state.vz);
+        }
+        return result;
+    }
+
+    std::size_t padTo8(std::size_t bytes) {
+        return (bytes + 7) / 8 * 8;
+    }
+    }  //  namespace
+
+    void saveCheckpoint(const std::string& path, const Simulation& simulation,
+                        const RunPosition& position) {
+        NB_PROFILE_SCOPE(Checkpoint);
+        const BodyState& state = simulation.bodies();
+        const std::size_t n = state.size();
+
+        std::map<std::string, std::uint32_t> indexOf;
+        std::vector<const std::string*> names;
+        std::vector<std::uint32_t> nameIndex(n);
+        std::uint64_t nameTableBytes = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            auto found = indexOf.emplace(state.names[i], names.size());
+            if (found.second) {
+                names.push_back(&found.first->first);
+                nameTableBytes += sizeof(std::uint32_t) + state.names[i].size();
+            }
+            nameIndex[i] = found.first->second;
+        }
+
+        Header header;
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.version = kCheckpointVersion;
+        header.byteOrder = kByteOrderMark;
+        header.bodyCount = n;
+        header.steps = position.steps;
+        header.elapsedTime = position.elapsedTime;
+        header.radius = simulation.radius();
+        header.nameCount = names.size();
+        header.nameTableBytes = nameTableBytes;
+        header.dimensions = state.dimensions;
+        const IntegratorState integrator = simulation.integratorState();
+        header.integrator = static_cast<std::uint64_t>(integrator.kind);
+        header.integratorValues = integrator.values.size();
+
+        const std::string temporary = path + ".tmp";
+        {
+            std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+            auto write = [&out](const void* data, std::size_t bytes) {
+                out.write(static_cast<const char*>(data), bytes);
+            };
+            write(&header, sizeof(header));
+            for (const std::vector<double>* column : columns(state)) {
+                write(column->data(), n * sizeof(double));
+            }
+            write(nameIndex.data(), n * sizeof(std::uint32_t));
+            const char padding[8] = {};
+            write(padding, padTo8(n * sizeof(std::uint32_t)) - n * sizeof(std::uint32_t));
+            for (const std::string* name : names) {
+                std::uint32_t length = name->size();
+                write(&length, sizeof(length));
+                write(name->data(), name->size());
+            }
+            write(padding, padTo8(nameTableBytes) - nameTableBytes);
+            write(integrator.values.data(), integrator.values.size() * sizeof(double));
+            if (!out.flush()) {
+                throw std::runtime_error("Failed to write checkpoint: " + temporary);
+            }
+        }
+        if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("Failed to replace checkpoint: " + path);
+        }
+    }
+
+    RunPosition loadCheckpoint(const std::string& path, Simulation& simulation) {
+        NB_PROFILE_SCOPE(Parse);
+        MappedFile file(path);
+        Header header;
+        if (file.size() < kVersion1HeaderBytes) {
+            throw std::runtime_error("Checkpoint is truncated: " + path);
+        }
+        std::memcpy(&header, file.data(), kVersion1HeaderBytes);
+        if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+            throw std::runtime_error("Not a checkpoint: " + path);
+        }
+        if (header.version < 1 || header.version > kCheckpointVersion
+            || header.byteOrder != kByteOrderMark) {
+            throw std::runtime_error("Unsupported checkpoint version or byte order: " + path);
+        }
+        std::size_t headerBytes = kVersion1HeaderBytes;
+        header.dimensions = 2;
+        header.integrator = 0;
+        header.integratorValues = 0;
+        if (header.version >= 2) {
+            headerBytes = header.version >= 3 ? sizeof(header) : kVersion2HeaderBytes;
+            if (file.size() < headerBytes) {
+                throw std::runtime_error("Checkpoint is truncated: " + path);
+            }
+            std::memcpy(&header, file.data(), headerBytes);
+        }
+        if (header.dimensions != 2 && header.dimensions != 3) {
+            throw std::runtime_error("Unsupported dimensions in checkpoint: " + path);
+        }
+
+        // Bound every count by the file size before multiplying, so a corrupt header
+        // cannot wrap the expected size around and pass the truncation check
+        const std::size_t bytesPerBody = (2 * header.dimensions + 1) * sizeof(double)
+                                       + sizeof(std::uint32_t);
+        const std::size_t available = file.size() - headerBytes;
+        if (header.bodyCount > available / bytesPerBody
+            || header.nameTableBytes > available
+            || header.nameCount > header.nameTableBytes / sizeof(std::uint32_t)
+            || header.integratorValues > available / sizeof(double)) {
+            throw std::runtime_error("Corrupt checkpoint header: " + path);
+        }
+        const std::size_t n = header.bodyCount;
+        const std::size_t arrays = (2 * header.dimensions + 1) * n * sizeof(double)
+                                 + padTo8(n * sizeof(std::uint32_t));
+        const std::size_t integratorOffset = headerBytes + arrays
+                                           + (header.version >= 3
+                                              ? padTo8(header.nameTableBytes)
+                                              : header.nameTableBytes);
+        if (file.size() < integratorOffset + header.integratorValues * sizeof(double)) {
+            throw std::runtime_error("Checkpoint is truncated: " + path);
+        }
+
+        BodyState state;
+        state.setDimensions(header.dimensions);
+        state.resize(n);
+        const char* cursor = file.data() + headerBytes;
+        for (std::vector<double>* column : columns(state)) {
+            std::memcpy(column->data(), cursor, n * sizeof(double));
+            cursor += n * sizeof(double);
+        }
+        std::vector<std::uint32_t> nameIndex(n);
+        std::memcpy(nameIndex.data(), cursor, n * sizeof(std::uint32_t));
+        cursor += padTo8(n * sizeof(std::uint32_t));
+
+        const char* end = cursor + header.nameTableBytes;
+        std::vector<std::string> names;
+        names.reserve(header.nameCount);
+        for (std::uint64_t k = 0; k < header.nameCount; ++k) {
+            std::uint32_t length;
+            if (end - cursor < static_cast<std::ptrdiff_t>(sizeof(length))) {
+                throw std::runtime_error("Corrupt name table in checkpoint: " + path);
+            }
+            std::memcpy(&length, cursor, sizeof(length));
+            cursor += sizeof(length);
+            if (end - cursor < static_cast<std::ptrdiff_t>(length)) {
+                throw std::runtime_error("Corrupt name table in checkpoint: " + path);
+            }
+            names.emplace_back(cursor, length);
+            cursor += length;
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            if (nameIndex[i] >= names.size()) {
+                throw std::runtime_error("Corrupt name index in checkpoint: " + path);
+            }
+            state.names[i] = names[nameIndex[i]];
+        }
+
+        IntegratorState integrator;
+        integrator.kind = static_cast<IntegratorKind>(header.integrator);
+        integrator.values.resize(header.integratorValues);
+        if (!integrator.values.empty()) {
+            std::memcpy(integrator.values.data(), file.data() + integratorOffset,
+                        integrator.values.size() * sizeof(double));
+        }
+
+        simulation.load(std::move(state), header.radius);
+        simulation.restoreIntegratorState(std::move(integrator));
+        RunPosition position;
+        position.steps = header.steps;
+        position.elapsedTime = header.elapsedTime;
+        return position;
+    }
+
+    Checkpointer::Checkpointer(const std::string& path, std::uint64_t interval)
+    : path(path),
+      interval(path.empty() ? 0 : interval)
+    {}
+
+    void Checkpointer::checkWritable() const {
+        if (interval == 0) {
+            return;
+        }
+        const std::string temporary = path + ".tmp";
+        if (!std::ofstream(temporary, std::ios::binary | std::ios::trunc)) {
+            throw std::runtime_error("Cannot write checkpoint: " + temporary);
+        }
+        std::remove(temporary.c_str());
+    }
+
+    void Checkpointer::afterStep(const Simulation& simulation, const RunPosition& position) {
+        if (interval > 0 && position.steps % interval == 0) {
+            saveCheckpoint(path, simulation, position);
+        }
+    }
+}  //  namespace NB
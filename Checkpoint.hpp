@@ -0,0 +1,59 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <cstdint>
+#include <string>
+#include "Simulation.hpp"
+
+namespace NB {
+
+// Binary snapshot of a simulation, loaded with mmap. Layout (host byte order):
+//   header   magic "NBODYSNP", version, byte-order mark, body count, steps taken,
+//            elapsed time, universe radius, name count, name table size, dimensions,
+//            integrator kind, integrator value count
+//   arrays   x, y, vx, vy, mass as packed doubles, then z and vz for a 3D state,
+//            then a uint32 name index per body
+//   names    deduplicated texture names, each a uint32 length and its bytes
+//   integrator  padded to 8 bytes, Simulation::integratorState() as packed doubles
+// Doubles are stored bit for bit, and so is the integrator's state (the adaptive
+// substep size, the block levels), so a run resumed with the same options continues
+// exactly where it stopped. Older versions still load: version 1 predates 3D and ends
+// the header before the dimensions, and versions 1 and 2 end it before the integrator
+// fields, so runs resumed from them start the integrator afresh, which is exact only
+// for the fixed-step integrators.
+constexpr std::uint32_t kCheckpointVersion = 3;
+
+// Where a checkpointed run was when it was saved.
+struct RunPosition {
+    std::uint64_t steps = 0;
+    double elapsedTime = 0;
+};
+
+// Writes to a temporary file and renames it over `path`, so a run killed while
+// saving leaves the previous checkpoint intact. Throws std::runtime_error.
+void saveCheckpoint(const std::string& path, const Simulation& simulation,
+                    const RunPosition& position);
+// Replaces the state of `simulation` with the checkpoint's. Throws std::runtime_error.
+RunPosition loadCheckpoint(const std::string& path, Simulation& simulation);
+
+// Saves a checkpoint every `interval` steps; an interval of 0 or an empty path
+// disables it.
+class Checkpointer {
+ public:
+    Checkpointer(const std::string& path, std::uint64_t interval);
+    // Throws std::runtime_error if checkpoints cannot be written to `path`, so a long
+    // run finds out before it starts rather than at its first checkpoint.
+    void checkWritable() const;
+    // Throws std::runtime_error like saveCheckpoint.
+    void afterStep(const Simulation& simulation, const RunPosition& position);
+
+ private:
+    std::string path;
+    std::uint64_t interval;
+};
+
+}  //  namespace NB
+
+#endif  //  CHECKPOINT_HPP
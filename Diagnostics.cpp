@@ -0,0 +1,76 @@
+//  Copyright 2024 Vy Tran
+
+#include "Diagnostics.hpp"
+
+namespace NB {
+    Diagnostics measureKinematics(const BodyState& state) {
+        Diagnostics diagnostics;
+        double weightedX = 0;
+        double weightedY = 0;
+        for (std::size_t i = 0; i < state.size(); ++i) {
+            const double m = state.mass[i];
+            diagnostics.kineticEnergy += 0.5 * m * (state.vx[i] * state.vx[i]
+                                                    + state.vy[i] * state.vy[i]);
+            diagnostics.momentumX += m * state.vx[i];
+            diagnostics.momentumY += m * state.vy[i];
+            diagnostics.angularMomentum += m * (state.x[i] * state.vy[i]
+                                                - state.y[i] * state.vx[i]);
+            weightedX += m * state.x[i];
+            weightedY += m * state.y[i];
+            diagnostics.totalMass += m;
+        }
+        if (diagnostics.totalMass != 0) {
+            diagnostics.centerOfMassX = weightedX / diagnostics.totalMass;
+            diagnostics.centerOfMassY = weightedY / diagnostics.totalMass;
+        }
+        diagnostics.dimensions = state.dimensions;
+        if (state.dimensions == 3) {
+            // The 2D sums above already hold the x and y parts; add what z contributes
+            double weightedZ = 0;
+            for (std::size_t i = 0; i < state.size(); ++i) {
+                const double m = state.mass[i];
+                diagnostics.kineticEnergy += 0.5 * m * state.vz[i] * state.vz[i];
+                diagnostics.momentumZ += m * state.vz[i];
+                diagnostics.angularMomentumX += m * (state.y[i] * state.vz[i]
+                                                     - state.z[i] * state.vy[i]);
+                diagnostics.angularMomentumY += m * (state.z[i] * state.vx[i]
+                                                     - state.x[i] * state.vz[i]);
+                weightedZ += m * state.z[i];
+            }
+            if (diagnostics.totalMass != 0) {
+                diagnostics.centerOfMassZ = weightedZ / diagnostics.totalMass;
+            }
+        }
+        return diagnostics;
+    }
+
+    double potentialEnergy(const BodyState& state, const double* potential) {
+        double energy = 0;
+        for (std::size_t i = 0; i < state.size(); ++i) {
+            energy += state.mass[i] * potential[i];
+        }
+        // Each pair was counted from both ends
+        return 0.5 * energy;
+    }
+
+    std::ostream& operator<<(std::ostream& out, const Diagnostics& diagnostics) {
+        if (diagnostics.dimensions == 3) {
+            return out << "E=" << diagnostics.totalEnergy()
+                       << " K=" << diagnostics.kineticEnergy
+                       << " U=" << diagnostics.potentialEnergy
+                       << " P=(" << diagnostics.momentumX << "," << diagnostics.momentumY
+                       << "," << diagnostics.momentumZ << ")"
+                       << " L=(" << diagnostics.angularMomentumX << ","
+                       << diagnostics.angularMomentumY << "," << diagnostics.angularMomentum << ")"
+                       << " COM=(" << diagnostics.centerOfMassX << ","
+                       << diagnostics.centerOfMassY << "," << diagnostics.centerOfMassZ << ")";
+        }
+        return out << "E=" << diagnostics.totalEnergy()
+                   << " K=" << diagnostics.kineticEnergy
+                   << " U=" << diagnostics.potentialEnergy
+                   << " P=(" << diagnostics.momentumX << "," << diagnostics.momentumY << ")"
+                   << " L=" << diagnostics.angularMomentum
+                   << " COM=(" << diagnostics.centerOfMassX << ","
+                   << diagnostics.centerOfMassY << ")";
+    }
+}  //  namespace NB
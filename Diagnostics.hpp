@@ -0,0 +1,38 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef DIAGNOSTICS_HPP
+#define DIAGNOSTICS_HPP
+
+#include <iostream>
+#include "BodyState.hpp"
+
+namespace NB {
+
+// Quantities an exact integration would conserve, plus the center of mass. The z
+// components stay 0 for a 2D state.
+struct Diagnostics {
+    double kineticEnergy = 0;
+    double potentialEnergy = 0;
+    double momentumX = 0, momentumY = 0, momentumZ = 0;
+    double angularMomentum = 0;  // About the origin; the z component in 3D
+    double angularMomentumX = 0, angularMomentumY = 0;
+    double centerOfMassX = 0, centerOfMassY = 0, centerOfMassZ = 0;
+    double totalMass = 0;
+    unsigned dimensions = 2;
+
+    double totalEnergy() const {
+        return kineticEnergy + potentialEnergy;
+    }
+};
+
+// Everything but the potential energy, in one O(N) pass.
+Diagnostics measureKinematics(const BodyState& state);
+// Potential energy from per-body potentials phi_i = -G sum_j m_j / r_ij, as the
+// force kernels produce them: U = 1/2 sum_i m_i phi_i.
+double potentialEnergy(const BodyState& state, const double* potential);
+// One line of key=value pairs; vectors have three components in 3D.
+std::ostream& operator<<(std::ostream& out, const Diagnostics& diagnostics);
+
+}  //  namespace NB
+
+#endif  //  DIAGNOSTICS_HPP
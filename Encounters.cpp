@@ -0,0 +1,149 @@
+//  Copyright 2024 Vy Tran
+
+#include "Encounters.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace NB {
+    namespace {
+    // Cells far apart may share a key after wrapping; that only costs extra distance checks
+    std::uint64_t cellKey(std::int64_t cx, std::int64_t cy, std::int64_t cz) {
+        return (static_cast<std::uint64_t>(cx) << 32) ^ static_cast<std::uint32_t>(cy)
+               ^ (static_cast<std::uint64_t>(cz) << 16);
+    }
+    }  //  namespace
+
+    std::uint32_t Encounters::root(std::uint32_t body) {
+        while (parent[body] != body) {
+            parent[body] = parent[parent[body]];
+            body = parent[body];
+        }
+        return body;
+    }
+
+    void Encounters::join(std::uint32_t a, std::uint32_t b) {
+        a = root(a);
+        b = root(b);
+        if (a != b) {
+            parent[std::max(a, b)] = std::min(a, b);
+        }
+    }
+
+    bool Encounters::find(const BodyState& state, double radius) {
+        const std::size_t n = state.size();
+        parent.resize(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            parent[i] = i;
+        }
+        if (radius <= 0 || n < 2) {
+            return false;
+        }
+
+        // A 2D state has every body in the z = 0 layer of cells
+        const bool is3D = state.dimensions == 3;
+        auto cellZ = [&](std::size_t i) -> std::int64_t {
+            return is3D ? std::floor(state.z[i] / radius) : 0;
+        };
+        cells.resize(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            cells[i] = {cellKey(std::floor(state.x[i] / radius), std::floor(state.y[i] / radius),
+                                cellZ(i)),
+                        static_cast<std::uint32_t>(i)};
+        }
+        std::sort(cells.begin(), cells.end());
+
+        const double radius2 = radius * radius;
+        const std::int64_t layers = is3D ? 1 : 0;
+        bool found = false;
+        for (std::size_t i = 0; i < n; ++i) {
+            const std::int64_t cx = std::floor(state.x[i] / radius);
+            const std::int64_t cy = std::floor(state.y[i] / radius);
+            const std::int64_t cz = cellZ(i);
+            for (std::int64_t ox = -1; ox <= 1; ++ox) {
+                for (std::int64_t oy = -1; oy <= 1; ++oy) {
+                    for (std::int64_t oz = -layers; oz <= layers; ++oz) {
+                        const std::uint64_t key = cellKey(cx + ox, cy + oy, cz + oz);
+                        auto first = std::lower_bound(cells.begin(), cells.end(),
+                                                      std::make_pair(key, std::uint32_t(0)));
+                        for (auto it = first; it != cells.end() && it->first == key; ++it) {
+                            const std::uint32_t j = it->second;
+                            if (j <= i) {
+                                continue;
+                            }
+                            const double dx = state.x[j] - state.x[i];
+                            const double dy = state.y[j] - state.y[i];
+                            const double dz = is3D ? state.z[j] - state.z[i] : 0.0;
+                            if (dx * dx + dy * dy + dz * dz < radius2) {
+                                join(i, j);
+                                found = true;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        return found;
+    }
+
+    std::size_t Encounters::merge(BodyState& state) {
+        const std::size_t n = state.size();
+        const bool is3D = state.dimensions == 3;
+        groups.resize(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            const std::uint32_t r = root(i);
+            const double m = state.mass[i];
+            Group& group = groups[r];
+            if (r == i) {
+                group = Group{0, 0, 0, 0, 0, 0, 0, m, 0};
+            } else if (m > group.heaviest) {
+                group.heaviest = m;
+                state.names[r] = state.names[i];
+            }
+            ++group.members;
+            group.mass += m;
+            group.x += m * state.x[i];
+            group.y += m * state.y[i];
+            group.vx += m * state.vx[i];
+            group.vy += m * state.vy[i];
+            if (is3D) {
+                group.z += m * state.z[i];
+                group.vz += m * state.vz[i];
+            }
+        }
+
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            if (parent[i] != i) {
+                continue;
+            }
+            const Group& group = groups[i];
+            // A zero total (antimatter) has no center of mass; the first member stays put
+            if (group.members > 1 && group.mass != 0) {
+                state.x[i] = group.x / group.mass;
+                state.y[i] = group.y / group.mass;
+                state.vx[i] = group.vx / group.mass;
+                state.vy[i] = group.vy / group.mass;
+                if (is3D) {
+                    state.z[i] = group.z / group.mass;
+                    state.vz[i] = group.vz / group.mass;
+                }
+            }
+            state.mass[i] = group.mass;
+            if (kept != i) {
+                state.x[kept] = state.x[i];
+                state.y[kept] = state.y[i];
+                state.vx[kept] = state.vx[i];
+                state.vy[kept] = state.vy[i];
+                if (is3D) {
+                    state.z[kept] = state.z[i];
+                    state.vz[kept] = state.vz[i];
+                }
+                state.mass[kept] = state.mass[i];
+                state.names[kept] = std::move(state.names[i]);
+            }
+            ++kept;
+        }
+        state.resize(kept);
+        return n - kept;
+    }
+}  //  namespace NB
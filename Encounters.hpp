@@ -0,0 +1,44 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef ENCOUNTERS_HPP
+#define ENCOUNTERS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "BodyState.hpp"
+
+namespace NB {
+
+// Finds bodies closer than a merge radius and merges them. Detection hashes
+// bodies into a grid of radius-sized cells (cubes in 3D) and only compares
+// neighboring cells, so it is O(N) for sparse systems. Scratch buffers are kept
+// between calls.
+class Encounters {
+ public:
+    // Groups bodies closer than `radius`, transitively. True if any pair was found.
+    bool find(const BodyState& state, double radius);
+    // Replaces each group found by the last find() with one body that keeps its
+    // total mass, momentum and center of mass and the name of its heaviest member.
+    // The arrays are compacted in order; a merged body takes the place of the
+    // group's first member. Returns the number of bodies removed.
+    std::size_t merge(BodyState& state);
+
+ private:
+    std::uint32_t root(std::uint32_t body);
+    void join(std::uint32_t a, std::uint32_t b);
+
+    std::vector<std::pair<std::uint64_t, std::uint32_t>> cells;  // (cell key, body), sorted
+    std::vector<std::uint32_t> parent;  // Union-find forest; roots are the lowest index
+    struct Group {
+        double mass, x, y, z, vx, vy, vz;  // Total mass and mass-weighted sums
+        double heaviest;            // Mass of the heaviest member so far
+        std::size_t members;
+    };
+    std::vector<Group> groups;  // Indexed by group root
+};
+
+}  //  namespace NB
+
+#endif  //  ENCOUNTERS_HPP
@@ -0,0 +1,272 @@
+//  Copyright 2024 Vy Tran
+
+#include "Ensemble.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include "Loader.hpp"
+#include "Simulation.hpp"
+#include "ThreadPool.hpp"
+
+namespace NB {
+    namespace {
+    // One deque of task indices per thread. Owners take from the front, where the
+    // biggest of their tasks are; thieves take from the back, where the smallest are.
+    class StealingQueues {
+     public:
+        explicit StealingQueues(std::size_t threads) : queues(threads) {}
+
+        void push(std::size_t thread, std::size_t task) {
+            queues[thread].tasks.push_back(task);
+        }
+
+        bool next(std::size_t thread, std::size_t& task) {
+            if (queues[thread].popFront(task)) {
+                return true;
+            }
+            for (std::size_t k = 1; k < queues.size(); ++k) {
+                if (queues[(thread + k) % queues.size()].popBack(task)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+     private:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<std::size_t> tasks;
+
+            bool popFront(std::size_t& task) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (tasks.empty()) {
+                    return false;
+                }
+                task = tasks.front();
+                tasks.pop_front();
+                return true;
+            }
+
+            bool popBack(std::size_t& task) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (tasks.empty()) {
+                    return false;
+                }
+                task = tasks.back();
+                tasks.pop_back();
+                return true;
+            }
+        };
+        std::vector<Queue> queues;
+    };
+
+    EnsembleResult runMember(const EnsembleMember& member, const Options& options) {
+        using Clock = std::chrono::steady_clock;
+        const auto start = Clock::now();
+        EnsembleResult result;
+        result.name = member.name;
+        try {
+            Simulation simulation;
+            simulation.load(member.bodies, member.radius);
+            configure(simulation, options);
+            simulation.setThreads(1);
+            result.before = simulation.diagnostics();
+            while (result.position.elapsedTime < options.totalTime) {
+                simulation.step(options.deltaT);
+                result.position.elapsedTime += options.deltaT;
+                ++result.position.steps;
+            }
+            result.after = simulation.diagnostics();
+            result.merged = simulation.mergedBodies();
+            result.bodies = simulation.bodies();
+            result.radius = simulation.radius();
+        } catch (const std::exception& e) {
+            result.error = e.what();
+        }
+        result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        return result;
+    }
+
+    std::string stem(const std::string& path) {
+        return std::filesystem::path(path).stem().string();
+    }
+    }  //  namespace
+
+    void perturb(BodyState& bodies, double radius, double positionSigma, double velocitySigma,
+                 std::uint64_t seed) {
+        const std::size_t n = bodies.size();
+        const bool is3D = bodies.dimensions == 3;
+        double speed2 = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            speed2 += bodies.vx[i] * bodies.vx[i] + bodies.vy[i] * bodies.vy[i];
+            if (is3D) {
+                speed2 += bodies.vz[i] * bodies.vz[i];
+            }
+        }
+        const double rmsSpeed = n > 0 ? std::sqrt(speed2 / n) : 0;
+        std::mt19937_64 random(seed);
+        std::normal_distribution<double> position(0.0, positionSigma * radius);
+        std::normal_distribution<double> velocity(0.0, velocitySigma * rmsSpeed);
+        for (std::size_t i = 0; i < n; ++i) {
+            if (positionSigma > 0) {
+                bodies.x[i] += position(random);
+                bodies.y[i] += position(random);
+                if (is3D) {
+                    bodies.z[i] += position(random);
+                }
+            }
+            if (velocitySigma > 0 && rmsSpeed > 0) {
+                bodies.vx[i] += velocity(random);
+                bodies.vy[i] += velocity(random);
+                if (is3D) {
+                    bodies.vz[i] += velocity(random);
+                }
+            }
+        }
+    }
+
+    std::vector<EnsembleMember> ensembleMembers(const Options& options) {
+        std::vector<std::string> files;
+        if (!options.ensemblePath.empty()) {
+            std::ifstream list(options.ensemblePath);
+            if (!list) {
+                throw std::runtime_error("Failed to open ensemble list: " + options.ensemblePath);
+            }
+            std::string line;
+            while (std::getline(list, line)) {
+                line = line.substr(0, line.find('#'));
+                std::istringstream fields(line);
+                std::string path;
+                if (fields >> path) {
+                    files.push_back(path);
+                }
+            }
+        } else if (!options.inputPath.empty()) {
+            files.push_back(options.inputPath);
+        }
+        if (files.empty()) {
+            throw std::runtime_error("An ensemble needs --ensemble LIST or --input FILE");
+        }
+
+        const unsigned copies = std::max(1u, options.copies);
+        std::vector<EnsembleMember> members;
+        members.reserve(files.size() * copies);
+        for (const std::string& file : files) {
+            Simulation loaded;
+            loadUniverse(file, loaded);
+            for (unsigned copy = 0; copy < copies; ++copy) {
+                EnsembleMember member;
+                member.name = copies > 1 ? stem(file) + "-" + std::to_string(copy) : stem(file);
+                member.bodies = loaded.bodies();
+                member.radius = loaded.radius();
+                if (copy > 0) {
+                    perturb(member.bodies, member.radius, options.perturbPosition,
+                            options.perturbVelocity, options.seed + members.size());
+                }
+                members.push_back(std::move(member));
+            }
+        }
+        return members;
+    }
+
+    std::vector<EnsembleResult> runEnsemble(const std::vector<EnsembleMember>& members,
+                                            const Options& options) {
+        std::vector<EnsembleResult> results(members.size());
+        ThreadPool pool(options.threads);
+        const std::size_t threads = std::min<std::size_t>(pool.size(), members.size());
+        if (threads == 0) {
+            return results;
+        }
+
+        // Longest first, dealt round-robin: every deque starts with a similar load
+        std::vector<std::size_t> order(members.size());
+        std::iota(order.begin(), order.end(), 0);
+        auto cost = [&](std::size_t k) {
+            const double n = members[k].bodies.size();
+            return n * n;
+        };
+        std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+            return cost(a) > cost(b);
+        });
+        StealingQueues queues(threads);
+        for (std::size_t k = 0; k < order.size(); ++k) {
+            queues.push(k % threads, order[k]);
+        }
+
+        pool.parallelFor(threads, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t thread = begin; thread < end; ++thread) {
+                std::size_t task;
+                while (queues.next(thread, task)) {
+                    results[task] = runMember(members[task], options);
+                }
+            }
+        });
+        return results;
+    }
+
+    std::string writeEnsemble(const std::vector<EnsembleResult>& results,
+                              const std::string& directory) {
+        std::filesystem::create_directories(directory);
+        //  With any 3D member the vectors get all three components; 2D members show 0 in z
+        const bool threeD = std::any_of(results.begin(), results.end(),
+                                        [](const EnsembleResult& result) {
+                                            return result.after.dimensions == 3
+                                                || result.before.dimensions == 3;
+                                        });
+        std::ostringstream summary;
+        summary << "run\tname\tbodies\tsteps\tseconds\tenergy0\tenergy\tdE/|E0|";
+        if (threeD) {
+            summary << "\tmomentumX\tmomentumY\tmomentumZ"
+                       "\tangularMomentumX\tangularMomentumY\tangularMomentumZ";
+        } else {
+            summary << "\tmomentumX\tmomentumY\tangularMomentum";
+        }
+        summary << "\tmerged\terror\n";
+        for (std::size_t k = 0; k < results.size(); ++k) {
+            const EnsembleResult& result = results[k];
+            std::ostringstream index;
+            index << std::setw(4) << std::setfill('0') << k;
+            if (result.error.empty()) {
+                const std::string path = directory + "/" + index.str() + "-" + result.name + ".txt";
+                std::ofstream file(path);
+                file << result.bodies.size() << std::endl << result.radius << std::endl;
+                for (std::size_t i = 0; i < result.bodies.size(); ++i) {
+                    result.bodies.write(file, i) << std::endl;
+                }
+                if (!file) {
+                    throw std::runtime_error("Failed to write " + path);
+                }
+            }
+            const double energy0 = result.before.totalEnergy();
+            const double energy = result.after.totalEnergy();
+            summary << index.str() << '\t' << result.name << '\t' << result.bodies.size()
+                    << '\t' << result.position.steps << '\t' << result.seconds << '\t'
+                    << energy0 << '\t' << energy << '\t'
+                    << (energy0 != 0 ? (energy - energy0) / std::abs(energy0) : 0) << '\t'
+                    << result.after.momentumX << '\t' << result.after.momentumY << '\t';
+            if (threeD) {
+                summary << result.after.momentumZ << '\t' << result.after.angularMomentumX
+                        << '\t' << result.after.angularMomentumY << '\t';
+            }
+            summary << result.after.angularMomentum << '\t' << result.merged << '\t'
+                    << result.error << '\n';
+        }
+        const std::string path = directory + "/summary.tsv";
+        std::ofstream file(path);
+        file << summary.str();
+        if (!file) {
+            throw std::runtime_error("Failed to write " + path);
+        }
+        return summary.str();
+    }
+}  //  namespace NB
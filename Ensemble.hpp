@@ -0,0 +1,66 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef ENSEMBLE_HPP
+#define ENSEMBLE_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "BodyState.hpp"
+#include "Checkpoint.hpp"
+#include "Diagnostics.hpp"
+#include "Options.hpp"
+
+namespace NB {
+
+// One independent universe of an ensemble.
+struct EnsembleMember {
+    std::string name;
+    BodyState bodies;
+    double radius = 0;
+};
+
+// Outcome of one member: its final state and the diagnostics at both ends.
+struct EnsembleResult {
+    std::string name;
+    BodyState bodies;
+    double radius = 0;
+    RunPosition position;
+    Diagnostics before, after;  // At the start and at totalTime
+    std::size_t merged = 0;
+    double seconds = 0;  // Wall time of this run alone
+    std::string error;   // Empty unless the run threw
+};
+
+// Gaussian noise with standard deviation positionSigma * radius on every position
+// component and velocitySigma * (RMS speed) on every velocity component. The same
+// seed always gives the same copy.
+void perturb(BodyState& bodies, double radius, double positionSigma, double velocitySigma,
+             std::uint64_t seed);
+
+// Members for --ensemble/--copies: every file listed in options.ensemblePath (one
+// path per line, '#' starts a comment), or else options.inputPath. With --copies K
+// each file gives K members, the first unperturbed and the rest perturbed with seeds
+// options.seed + member index. Throws std::runtime_error if a file can't be read.
+std::vector<EnsembleMember> ensembleMembers(const Options& options);
+
+// Runs every member to options.totalTime with the physics settings in `options`,
+// one member per task and each on a single thread. Tasks are dealt out largest
+// first (by N^2, as all members take the same steps) to per-thread deques, and
+// idle threads steal from the back of the others', so a few big systems don't
+// leave cores idle at the end.
+// options.threads sets the number of concurrent runs. Results are in member order
+// and bitwise identical to running each member alone.
+std::vector<EnsembleResult> runEnsemble(const std::vector<EnsembleMember>& members,
+                                        const Options& options);
+
+// Writes <directory>/<index>-<name>.txt with each final state and returns the
+// summary table (one tab-separated line per run, with a header) that is also
+// written to <directory>/summary.tsv. Throws std::runtime_error on write failure.
+std::string writeEnsemble(const std::vector<EnsembleResult>& results,
+                          const std::string& directory);
+
+}  //  namespace NB
+
+#endif  //  ENSEMBLE_HPP
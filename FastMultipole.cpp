@@ -0,0 +1,474 @@
+//  Copyright 2024 Vy Tran
+
+#include "FastMultipole.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include "ForceKernels.hpp"
+
+namespace NB {
+    namespace {
+    constexpr std::size_t kMaxTerms = (FastMultipole::kMaxOrder + 1)
+                                    * (FastMultipole::kMaxOrder + 2) / 2;
+
+    // Coefficients are stored by total order, so (a, b) with a + b = n sit at
+    // n (n + 1) / 2 + b and every order is a contiguous run.
+    inline std::size_t term(unsigned a, unsigned b) {
+        const unsigned n = a + b;
+        return n * (n + 1) / 2 + b;
+    }
+
+    // value^k / k! for k = 0..order
+    inline void scaledPowers(double value, unsigned order, double* out) {
+        out[0] = 1.0;
+        for (unsigned k = 1; k <= order; ++k) {
+            out[k] = out[k - 1] * value / k;
+        }
+    }
+
+    // Derivatives d^(a+b) / dx^a dy^b of 1 / sqrt(x^2 + y^2 + eps^2) at (x, y), for
+    // a + b <= order, into out[term(a, b)]. McMurchie-Davidson: with
+    // R(n)_00 = (-1)^n (2n - 1)!! / rho^(2n + 1),
+    //   R(n)_(a+1)b = a R(n+1)_(a-1)b + x R(n+1)_ab, and likewise for b with y,
+    // and the derivatives are R(0). `table` holds R(n) for every term as a row
+    // over n, so each step of the recurrence is one contiguous loop; it needs
+    // (order + 1) * terms entries.
+    void derivatives(double x, double y, double softening2, unsigned order, double* table,
+                     double* out) {
+        const std::size_t stride = order + 1;
+        const double inverse2 = 1.0 / (x * x + y * y + softening2);
+        double g = std::sqrt(inverse2);
+        for (unsigned n = 0; n <= order; ++n) {
+            table[n] = g;
+            g *= -(2.0 * n + 1.0) * inverse2;
+        }
+        out[0] = table[0];
+        for (unsigned total = 1; total <= order; ++total) {
+            const unsigned count = order - total + 1;
+            for (unsigned b = 0; b <= total; ++b) {
+                const unsigned a = total - b;
+                double* row = table + term(a, b) * stride;
+                //  Step down along x while a > 0, else along y
+                const bool alongX = a > 0;
+                const unsigned steps = alongX ? a : b;
+                const double offset = alongX ? x : y;
+                const double* previous = table + (alongX ? term(a - 1, b) : term(a, b - 1))
+                                                 * stride + 1;
+                if (steps > 1) {
+                    const double* before = table + (alongX ? term(a - 2, b) : term(a, b - 2))
+                                                   * stride + 1;
+                    const double factor = steps - 1.0;
+                    for (unsigned n = 0; n < count; ++n) {
+                        row[n] = offset * previous[n] + factor * before[n];
+                    }
+                } else {
+                    for (unsigned n = 0; n < count; ++n) {
+                        row[n] = offset * previous[n];
+                    }
+                }
+                out[term(a, b)] = row[0];
+            }
+        }
+    }
+    }  //  namespace
+
+    FastMultipole::FastMultipole(unsigned order, double theta)
+    : mOrder(1), mTheta(theta), mSoftening(0), scale(1), softening2(0) {
+        setOrder(order);
+    }
+
+    void FastMultipole::setOrder(unsigned order) {
+        if (order < 1 || order > kMaxOrder) {
+            throw std::invalid_argument("FMM order must be between 1 and "
+                                        + std::to_string(kMaxOrder));
+        }
+        mOrder = order;
+    }
+
+    unsigned FastMultipole::order() const {
+        return mOrder;
+    }
+
+    void FastMultipole::setTheta(double theta) {
+        mTheta = theta;
+    }
+
+    double FastMultipole::theta() const {
+        return mTheta;
+    }
+
+    void FastMultipole::setSoftening(double softening) {
+        mSoftening = softening;
+    }
+
+    double FastMultipole::softening() const {
+        return mSoftening;
+    }
+
+    std::size_t FastMultipole::cellCount() const {
+        return cells.size();
+    }
+
+    std::size_t FastMultipole::terms() const {
+        return (mOrder + 1) * (mOrder + 2) / 2;
+    }
+
+    template <typename Visit>
+    void FastMultipole::forEachCell(std::size_t begin, std::size_t end, ThreadPool* pool,
+                                    const Visit& visit) {
+        auto task = [&](std::size_t first, std::size_t last) {
+            for (std::size_t i = begin + first; i < begin + last; ++i) {
+                visit(i);
+            }
+        };
+        if (pool) {
+            pool->parallelFor(end - begin, task);
+        } else {
+            task(0, end - begin);
+        }
+    }
+
+    void FastMultipole::build(const BodyState& state) {
+        const std::size_t n = state.size();
+        double lowX = state.x[0], highX = state.x[0];
+        double lowY = state.y[0], highY = state.y[0];
+        for (std::size_t i = 1; i < n; ++i) {
+            lowX = std::min(lowX, state.x[i]);
+            highX = std::max(highX, state.x[i]);
+            lowY = std::min(lowY, state.y[i]);
+            highY = std::max(highY, state.y[i]);
+        }
+        const double originX = 0.5 * (lowX + highX);
+        const double originY = 0.5 * (lowY + highY);
+        const double halfSize = 0.5 * std::max(highX - lowX, highY - lowY);
+        scale = halfSize > 0.0 ? halfSize * (1.0 + 1e-9) : 1.0;
+        softening2 = mSoftening * mSoftening / (scale * scale);
+
+        x.resize(n);
+        y.resize(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            x[i] = (state.x[i] - originX) / scale;
+            y[i] = (state.y[i] - originY) / scale;
+        }
+        bodyAt.resize(n);
+        scratch.resize(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            bodyAt[i] = static_cast<std::uint32_t>(i);
+        }
+
+        //  Breadth first, so every level is a contiguous run of cells
+        cells.clear();
+        cells.push_back({0.0, 0.0, 1.0, 0.0, 0, static_cast<std::uint32_t>(n), -1, -1, 0});
+        levelStart.assign({0, 1});
+        for (std::size_t level = 0; levelStart[level + 1] > levelStart[level]; ++level) {
+            for (std::size_t c = levelStart[level]; c < levelStart[level + 1]; ++c) {
+                const Cell cell = cells[c];
+                if (cell.count <= kLeafSize || level >= kMaxDepth) {
+                    continue;
+                }
+                //  Counting sort of the cell's bodies by quadrant
+                std::uint32_t counts[4] = {};
+                for (std::uint32_t k = cell.first; k < cell.first + cell.count; ++k) {
+                    std::uint32_t body = bodyAt[k];
+                    ++counts[(x[body] >= cell.cx ? 1 : 0) + (y[body] >= cell.cy ? 2 : 0)];
+                }
+                std::uint32_t offsets[4] = {cell.first};
+                for (int q = 1; q < 4; ++q) {
+                    offsets[q] = offsets[q - 1] + counts[q - 1];
+                }
+                std::uint32_t next[4] = {offsets[0], offsets[1], offsets[2], offsets[3]};
+                for (std::uint32_t k = cell.first; k < cell.first + cell.count; ++k) {
+                    std::uint32_t body = bodyAt[k];
+                    scratch[next[(x[body] >= cell.cx ? 1 : 0) + (y[body] >= cell.cy ? 2 : 0)]++]
+                        = body;
+                }
+                std::copy(scratch.begin() + cell.first,
+                          scratch.begin() + cell.first + cell.count, bodyAt.begin() + cell.first);
+
+                const double quarter = 0.5 * cell.halfSize;
+                cells[c].firstChild = static_cast<std::int32_t>(cells.size());
+                for (int q = 0; q < 4; ++q) {
+                    if (counts[q] == 0) {
+                        continue;
+                    }
+                    cells.push_back({cell.cx + (q & 1 ? quarter : -quarter),
+                                     cell.cy + (q & 2 ? quarter : -quarter), quarter, 0.0,
+                                     offsets[q], counts[q], static_cast<std::int32_t>(c), -1, 0});
+                    ++cells[c].childCount;
+                }
+            }
+            levelStart.push_back(cells.size());
+        }
+        levelStart.pop_back();  //  The level that made no cells
+
+        //  Bodies in tree order, so every cell's bodies are contiguous
+        mass.resize(n);
+        std::vector<double>& sortedX = sumX;
+        std::vector<double>& sortedY = sumY;
+        sortedX.resize(n);
+        sortedY.resize(n);
+        for (std::size_t k = 0; k < n; ++k) {
+            sortedX[k] = x[bodyAt[k]];
+            sortedY[k] = y[bodyAt[k]];
+            mass[k] = state.mass[bodyAt[k]];
+        }
+        x.swap(sortedX);
+        y.swap(sortedY);
+    }
+
+    void FastMultipole::upward(std::size_t index) {
+        Cell& cell = cells[index];
+        const unsigned p = mOrder;
+        double* multipole = &multipoles[index * terms()];
+        double powersX[kMaxOrder + 1], powersY[kMaxOrder + 1];
+        if (cell.firstChild < 0) {
+            //  P2M: M_ab = sum m (x - cx)^a (y - cy)^b / (a! b!)
+            double radius2 = 0.0;
+            for (std::uint32_t k = cell.first; k < cell.first + cell.count; ++k) {
+                const double dx = x[k] - cell.cx;
+                const double dy = y[k] - cell.cy;
+                radius2 = std::max(radius2, dx * dx + dy * dy);
+                scaledPowers(dx, p, powersX);
+                scaledPowers(dy, p, powersY);
+                for (unsigned total = 0; total <= p; ++total) {
+                    double* row = multipole + term(total, 0);
+                    for (unsigned b = 0; b <= total; ++b) {
+                        row[b] += mass[k] * powersX[total - b] * powersY[b];
+                    }
+                }
+            }
+            cell.radius = std::sqrt(radius2);
+            return;
+        }
+        //  M2M: each child's moments shifted by d = child - parent,
+        //  M_k += sum_(l <= k) M_l d^(k - l) / (k - l)!
+        double radius = 0.0;
+        for (std::uint32_t c = 0; c < cell.childCount; ++c) {
+            const Cell& child = cells[cell.firstChild + c];
+            const double* moments = &multipoles[(cell.firstChild + c) * terms()];
+            const double dx = child.cx - cell.cx;
+            const double dy = child.cy - cell.cy;
+            radius = std::max(radius, std::hypot(dx, dy) + child.radius);
+            scaledPowers(dx, p, powersX);
+            scaledPowers(dy, p, powersY);
+            for (unsigned total = 0; total <= p; ++total) {
+                for (unsigned b = 0; b <= total; ++b) {
+                    const unsigned a = total - b;
+                    double sum = 0.0;
+                    for (unsigned i = 0; i <= a; ++i) {
+                        for (unsigned j = 0; j <= b; ++j) {
+                            sum += moments[term(i, j)] * powersX[a - i] * powersY[b - j];
+                        }
+                    }
+                    multipole[term(a, b)] += sum;
+                }
+            }
+        }
+        cell.radius = std::min(radius, cell.halfSize * std::sqrt(2.0));
+    }
+
+    void FastMultipole::multipoleToLocal(const Cell& source, const Cell& target) {
+        const unsigned p = mOrder;
+        const std::size_t count = terms();
+        double table[(kMaxOrder + 1) * kMaxTerms];
+        double derivative[kMaxTerms];
+        derivatives(target.cx - source.cx, target.cy - source.cy, softening2, p, table,
+                    derivative);
+        //  For x_j = c_A + s and x = c_B + t, with R = c_B - c_A:
+        //  f(R + t - s) = sum_(n, k) D_(n+k) f(R) t^n (-s)^k / (n! k!), so
+        //  L_n += sum_k (-1)^|k| M_k D_(n+k). For a fixed k = (k - e, e), the n of one
+        //  order form a contiguous run of L, and so do the D_(n+k) they need.
+        const double* moments = &multipoles[(&source - cells.data()) * count];
+        double* local = &locals[(&target - cells.data()) * count];
+        for (unsigned kTotal = 0; kTotal <= p; ++kTotal) {
+            const double sign = kTotal % 2 ? -1.0 : 1.0;
+            for (unsigned e = 0; e <= kTotal; ++e) {
+                const double moment = sign * moments[term(kTotal - e, e)];
+                for (unsigned total = 0; total + kTotal <= p; ++total) {
+                    double* row = local + term(total, 0);
+                    const double* d = derivative + term(total + kTotal, 0) + e;
+                    for (unsigned b = 0; b <= total; ++b) {
+                        row[b] += moment * d[b];
+                    }
+                }
+            }
+        }
+    }
+
+    void FastMultipole::nearField(const Cell& source, const Cell& target) {
+        const bool self = &source == &target;
+        for (std::uint32_t i = target.first; i < target.first + target.count; ++i) {
+            double ax = 0.0;
+            double ay = 0.0;
+            double phi = 0.0;
+            for (std::uint32_t j = source.first; j < source.first + source.count; ++j) {
+                if (self && i == j) {
+                    continue;
+                }
+                double dx = x[j] - x[i];
+                double dy = y[j] - y[i];
+                double r2 = dx * dx + dy * dy + softening2;
+                double invR = r2 > 0.0 ? 1.0 / std::sqrt(r2) : 0.0;
+                double s = mass[j] * invR * invR * invR;
+                ax += s * dx;
+                ay += s * dy;
+                phi += mass[j] * invR;
+            }
+            sumX[i] += ax;
+            sumY[i] += ay;
+            sumPotential[i] += phi;
+        }
+    }
+
+    void FastMultipole::interact(std::int32_t source, std::int32_t target,
+                                 std::vector<std::int32_t>& later) {
+        const Cell& a = cells[source];
+        const Cell& b = cells[target];
+        if (source != target) {
+            const double distance = std::hypot(b.cx - a.cx, b.cy - a.cy);
+            if (a.radius + b.radius < mTheta * distance) {
+                multipoleToLocal(a, b);
+                return;
+            }
+        }
+        const bool sourceLeaf = a.firstChild < 0;
+        const bool targetLeaf = b.firstChild < 0;
+        if (!targetLeaf && (sourceLeaf || b.halfSize >= a.halfSize)) {
+            later.push_back(source);  //  Split the target: its children take it from here
+        } else if (!sourceLeaf) {
+            for (std::uint32_t c = 0; c < a.childCount; ++c) {
+                interact(a.firstChild + static_cast<std::int32_t>(c), target, later);
+            }
+        } else {
+            nearField(a, b);
+        }
+    }
+
+    void FastMultipole::downward(std::size_t index) {
+        const Cell& cell = cells[index];
+        const unsigned p = mOrder;
+        const std::size_t count = terms();
+        double* local = &locals[index * count];
+        double powersX[kMaxOrder + 1], powersY[kMaxOrder + 1];
+        if (cell.parent >= 0) {
+            //  L2L: L_n = sum_(k >= n) L_k(parent) d^(k - n) / (k - n)!, d = cell - parent
+            const Cell& parent = cells[cell.parent];
+            const double* inherited = &locals[cell.parent * count];
+            scaledPowers(cell.cx - parent.cx, p, powersX);
+            scaledPowers(cell.cy - parent.cy, p, powersY);
+            for (unsigned total = 0; total <= p; ++total) {
+                for (unsigned b = 0; b <= total; ++b) {
+                    const unsigned a = total - b;
+                    double sum = 0.0;
+                    for (unsigned extra = 0; extra + total <= p; ++extra) {
+                        for (unsigned j = 0; j <= extra; ++j) {
+                            sum += inherited[term(a + extra - j, b + j)] * powersX[extra - j]
+                                 * powersY[j];
+                        }
+                    }
+                    local[term(a, b)] = sum;
+                }
+            }
+        }
+
+        static const std::vector<std::int32_t> root = {0};
+        const std::vector<std::int32_t>& sources = cell.parent >= 0 ? deferred[cell.parent] : root;
+        std::vector<std::int32_t>& later = deferred[index];
+        later.clear();
+        for (std::int32_t source : sources) {
+            interact(source, static_cast<std::int32_t>(index), later);
+        }
+        if (cell.firstChild >= 0) {
+            return;
+        }
+
+        //  L2P: potential sum L_n t^n / n!, acceleration its gradient
+        for (std::uint32_t k = cell.first; k < cell.first + cell.count; ++k) {
+            scaledPowers(x[k] - cell.cx, p, powersX);
+            scaledPowers(y[k] - cell.cy, p, powersY);
+            double ax = 0.0;
+            double ay = 0.0;
+            double phi = 0.0;
+            for (unsigned total = 0; total <= p; ++total) {
+                for (unsigned b = 0; b <= total; ++b) {
+                    const unsigned a = total - b;
+                    const double weight = powersX[a] * powersY[b];
+                    phi += local[term(a, b)] * weight;
+                    if (total < p) {
+                        ax += local[term(a + 1, b)] * weight;
+                        ay += local[term(a, b + 1)] * weight;
+                    }
+                }
+            }
+            sumX[k] += ax;
+            sumY[k] += ay;
+            sumPotential[k] += phi;
+        }
+    }
+
+    void FastMultipole::computeAccelerations(const BodyState& state, double* ax, double* ay,
+                                             double* potential, ThreadPool* pool) {
+        if (state.dimensions == 3) {
+            throw std::invalid_argument("The fmm backend supports 2D states only");
+        }
+        const std::size_t n = state.size();
+        if (n == 0) {
+            cells.clear();
+            return;
+        }
+        build(state);
+        const std::size_t count = terms();
+        multipoles.assign(cells.size() * count, 0.0);
+        locals.assign(cells.size() * count, 0.0);
+        if (deferred.size() < cells.size()) {
+            deferred.resize(cells.size());
+        }
+        sumX.assign(n, 0.0);
+        sumY.assign(n, 0.0);
+        sumPotential.assign(n, 0.0);
+
+        const std::size_t levels = levelStart.size() - 1;
+        for (std::size_t level = levels; level-- > 0;) {
+            forEachCell(levelStart[level], levelStart[level + 1], pool,
+                        [this](std::size_t cell) { upward(cell); });
+        }
+        for (std::size_t level = 0; level < levels; ++level) {
+            forEachCell(levelStart[level], levelStart[level + 1], pool,
+                        [this](std::size_t cell) { downward(cell); });
+        }
+
+        //  Back to body order and to SI units
+        const double accelerationScale = G / (scale * scale);
+        const double potentialScale = -G / scale;
+        forEachCell(0, n, pool, [&](std::size_t k) {
+            const std::uint32_t body = bodyAt[k];
+            ax[body] = accelerationScale * sumX[k];
+            ay[body] = accelerationScale * sumY[k];
+            if (potential) {
+                potential[body] = potentialScale * sumPotential[k];
+            }
+        });
+    }
+
+    double FastMultipole::maxRelativeError(const BodyState& state, std::size_t samples,
+                                           ThreadPool* pool) {
+        const std::size_t n = state.size();
+        samples = std::min(samples, n);
+        std::vector<double> fmmX(n), fmmY(n), directX(n), directY(n);
+        computeAccelerations(state, fmmX.data(), fmmY.data(), nullptr, pool);
+        double maxError = 0.0;
+        for (std::size_t k = 0; k < samples; ++k) {
+            std::size_t i = k * n / samples;
+            NB::computeAccelerations(state, i, i + 1, directX.data(), directY.data(),
+                                     SimdLevel::Scalar, mSoftening);
+            double reference = std::hypot(directX[i], directY[i]);
+            if (reference > 0.0) {
+                maxError = std::max(maxError, std::hypot(fmmX[i] - directX[i],
+                                                         fmmY[i] - directY[i]) / reference);
+            }
+        }
+        return maxError;
+    }
+}  //  namespace NB
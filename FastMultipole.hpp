@@ -0,0 +1,95 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef FASTMULTIPOLE_HPP
+#define FASTMULTIPOLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "BodyState.hpp"
+#include "ThreadPool.hpp"
+
+namespace NB {
+
+// Fast multipole method for 2D states: forces in O(N) with an error set by the
+// expansion order p. The bodies are sorted into an adaptive quadtree rebuilt every
+// pass. Each cell gets a multipole expansion of its bodies' potential (P2M, M2M,
+// leaves to root) and a local expansion of the potential of everything well
+// separated from it (M2L, L2L, root to leaves), and bodies in nearby leaves
+// interact directly (P2P). Expansions are Cartesian Taylor series of the softened
+// 1/r kernel up to order p, with derivatives from the McMurchie-Davidson
+// recurrence. Two cells are well separated when the sum of their radii is below
+// theta times the distance between their centers; the error falls roughly as
+// theta^(p+1).
+//
+// Each pass handles one tree level at a time, with that level's cells spread
+// over the thread pool. A cell writes only its own expansions and bodies, so the
+// result does not depend on the number of threads.
+class FastMultipole {
+ public:
+    static constexpr unsigned kMaxOrder = 20;
+
+    explicit FastMultipole(unsigned order = 8, double theta = 0.5);
+    // Throws std::invalid_argument outside 1..kMaxOrder.
+    void setOrder(unsigned order);
+    unsigned order() const;
+    void setTheta(double theta);
+    double theta() const;
+    void setSoftening(double softening);
+    double softening() const;
+    // Accelerations of every body into ax and ay, and potentials if `potential` is
+    // given. `pool`, if given, runs the cells of each level in parallel. Throws
+    // std::invalid_argument for a 3D state.
+    void computeAccelerations(const BodyState& state, double* ax, double* ay,
+                              double* potential = nullptr, ThreadPool* pool = nullptr);
+    // Largest |a_fmm - a_direct| / |a_direct| over `samples` evenly spaced bodies.
+    double maxRelativeError(const BodyState& state, std::size_t samples,
+                            ThreadPool* pool = nullptr);
+    std::size_t cellCount() const;
+
+ private:
+    // Lengths inside the tree are in units of the root's half size, so the powers
+    // and inverse powers up to order p stay well inside double range.
+    struct Cell {
+        double cx, cy;            // Center, which both expansions are taken about
+        double halfSize;          // Half the side length of the square
+        double radius;            // Distance from the center to the farthest body
+        std::uint32_t first;      // Bodies, as a range of the tree order
+        std::uint32_t count;
+        std::int32_t parent;      // -1 for the root
+        std::int32_t firstChild;  // Children are consecutive; -1 for a leaf
+        std::uint32_t childCount;
+    };
+    static constexpr unsigned kLeafSize = 32;  // A cell with more bodies is split
+    static constexpr unsigned kMaxDepth = 24;
+
+    void build(const BodyState& state);
+    void upward(std::size_t cell);
+    void downward(std::size_t cell);
+    void interact(std::int32_t source, std::int32_t target, std::vector<std::int32_t>& later);
+    void multipoleToLocal(const Cell& source, const Cell& target);
+    void nearField(const Cell& source, const Cell& target);
+    // Runs `visit` on cells [begin, end), on the pool if there is one.
+    template <typename Visit>
+    void forEachCell(std::size_t begin, std::size_t end, ThreadPool* pool, const Visit& visit);
+    std::size_t terms() const;
+
+    unsigned mOrder;
+    double mTheta;
+    double mSoftening;
+    double scale;                    // Root half size in meters
+    double softening2;               // Squared softening in tree units
+    std::vector<Cell> cells;         // Level by level, root first
+    std::vector<std::size_t> levelStart;  // First cell of each level, plus the end
+    std::vector<std::uint32_t> bodyAt;    // Body index at each position of the tree order
+    std::vector<std::uint32_t> scratch;   // Partition buffer of the build
+    std::vector<double> x, y, mass;       // Bodies in tree order and tree units
+    std::vector<double> sumX, sumY, sumPotential;  // Per body in tree order
+    std::vector<double> multipoles;  // terms() coefficients per cell
+    std::vector<double> locals;      // terms() coefficients per cell
+    std::vector<std::vector<std::int32_t>> deferred;  // Sources left to a cell's children
+};
+
+}  //  namespace NB
+
+#endif  //  FASTMULTIPOLE_HPP
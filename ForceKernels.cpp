@@ -0,0 +1,710 @@
+//  Copyright 2024 Vy Tran
+
+#include "ForceKernels.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NB_HAVE_X86_SIMD 1
+#endif
+
+namespace NB {
+    ForceBackend forceBackendFromString(const std::string& name) {
+        if (name == "pairwise") return ForceBackend::Pairwise;
+        if (name == "simd") return ForceBackend::Simd;
+        if (name == "barnes-hut") return ForceBackend::BarnesHut;
+        if (name == "symmetric") return ForceBackend::Symmetric;
+        if (name == "fmm") return ForceBackend::Fmm;
+        if (name == "pm") return ForceBackend::ParticleMesh;
+        throw std::invalid_argument("Unknown force backend: " + name);
+    }
+
+    std::string toString(ForceBackend backend) {
+        switch (backend) {
+            case ForceBackend::Pairwise: return "pairwise";
+            case ForceBackend::Simd: return "simd";
+            case ForceBackend::BarnesHut: return "barnes-hut";
+            case ForceBackend::Symmetric: return "symmetric";
+            case ForceBackend::Fmm: return "fmm";
+            case ForceBackend::ParticleMesh: return "pm";
+        }
+        return "unknown";
+    }
+
+    Precision precisionFromString(const std::string& name) {
+        if (name == "double") return Precision::Double;
+        if (name == "mixed") return Precision::Mixed;
+        throw std::invalid_argument("Unknown precision: " + name);
+    }
+
+    std::string toString(Precision precision) {
+        switch (precision) {
+            case Precision::Double: return "double";
+            case Precision::Mixed: return "mixed";
+        }
+        return "unknown";
+    }
+
+    std::string toString(SimdLevel level) {
+        switch (level) {
+            case SimdLevel::Scalar: return "scalar";
+            case SimdLevel::Avx2: return "avx2";
+            case SimdLevel::Avx512: return "avx512";
+        }
+        return "unknown";
+    }
+
+    SimdLevel detectSimdLevel() {
+#ifdef NB_HAVE_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return SimdLevel::Avx512;
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SimdLevel::Avx2;
+#endif
+        return SimdLevel::Scalar;
+    }
+
+    namespace {
+    // Reference kernel, also used for the bodies left over after the vector blocks.
+    // The dimension and the potential are template parameters, so the 2D kernel and
+    // the plain kernel carry no extra work.
+    template <int Dim, bool WithPotential>
+    void accelerationsScalar(const BodyState& state, std::size_t begin, std::size_t end,
+                             double* ax, double* ay, double* az, double softening2,
+                             double* potential) {
+        const double* x = state.x.data();
+        const double* y = state.y.data();
+        const double* z = state.z.data();
+        const double* m = state.mass.data();
+        const std::size_t n = state.size();
+        const double selfInvR = softening2 > 0.0 ? 1.0 / std::sqrt(softening2) : 0.0;
+        for (std::size_t i = begin; i < end; ++i) {
+            double sumX = 0.0;
+            double sumY = 0.0;
+            double sumZ = 0.0;
+            double sumPotential = 0.0;
+            for (std::size_t j = 0; j < n; ++j) {
+                double dx = x[j] - x[i];
+                double dy = y[j] - y[i];
+                double dz = 0.0;
+                double r2 = dx * dx + dy * dy;
+                if constexpr (Dim == 3) {
+                    dz = z[j] - z[i];
+                    r2 += dz * dz;
+                }
+                r2 += softening2;
+                // Coincident bodies (including i itself) exert no force: either r2 is 0
+                // and masked, or the separation is
+                double invR = r2 > 0.0 ? 1.0 / std::sqrt(r2) : 0.0;
+                double s = G * m[j] * invR * invR * invR;
+                sumX += s * dx;
+                sumY += s * dy;
+                if constexpr (Dim == 3) {
+                    sumZ += s * dz;
+                }
+                if (WithPotential) {
+                    sumPotential += m[j] * invR;
+                }
+            }
+            ax[i] = sumX;
+            ay[i] = sumY;
+            if constexpr (Dim == 3) {
+                az[i] = sumZ;
+            }
+            if (WithPotential) {
+                // With softening, body i saw itself at distance eps
+                potential[i] = -G * (sumPotential - m[i] * selfInvR);
+            }
+        }
+    }
+
+#ifdef NB_HAVE_X86_SIMD
+    // Four target bodies per register, one source body broadcast per inner iteration.
+    // 1/sqrt(r2) starts from the single-precision estimate and is refined by two
+    // Newton steps (12 -> 24 -> 48 bits), which is below the summation error.
+    template <int Dim, bool WithPotential>
+    __attribute__((target("avx2,fma")))
+    void accelerationsAvx2(const BodyState& state, std::size_t begin, std::size_t end,
+                           double* ax, double* ay, double* az, double softening2,
+                           double* potential) {
+        const double* x = state.x.data();
+        const double* y = state.y.data();
+        const double* z = state.z.data();
+        const double* m = state.mass.data();
+        const std::size_t n = state.size();
+        const __m256d half = _mm256_set1_pd(0.5);
+        const __m256d threeHalves = _mm256_set1_pd(1.5);
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d g = _mm256_set1_pd(G);
+        const __m256d eps2 = _mm256_set1_pd(softening2);
+        const __m256d selfInvR = _mm256_set1_pd(softening2 > 0.0 ? 1.0 / std::sqrt(softening2)
+                                                                : 0.0);
+        std::size_t i = begin;
+        for (; i + 4 <= end; i += 4) {
+            __m256d xi = _mm256_loadu_pd(x + i);
+            __m256d yi = _mm256_loadu_pd(y + i);
+            __m256d zi = zero;
+            if constexpr (Dim == 3) {
+                zi = _mm256_loadu_pd(z + i);
+            }
+            __m256d sumX = zero;
+            __m256d sumY = zero;
+            __m256d sumZ = zero;
+            __m256d sumPotential = zero;
+            for (std::size_t j = 0; j < n; ++j) {
+                __m256d dx = _mm256_sub_pd(_mm256_set1_pd(x[j]), xi);
+                __m256d dy = _mm256_sub_pd(_mm256_set1_pd(y[j]), yi);
+                __m256d r2 = _mm256_fmadd_pd(dy, dy, _mm256_fmadd_pd(dx, dx, eps2));
+                __m256d dz = zero;
+                if constexpr (Dim == 3) {
+                    dz = _mm256_sub_pd(_mm256_set1_pd(z[j]), zi);
+                    r2 = _mm256_fmadd_pd(dz, dz, r2);
+                }
+                __m256d invR = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r2)));
+                __m256d halfR2 = _mm256_mul_pd(half, r2);
+                invR = _mm256_mul_pd(invR, _mm256_fnmadd_pd(halfR2, _mm256_mul_pd(invR, invR),
+                                                            threeHalves));
+                invR = _mm256_mul_pd(invR, _mm256_fnmadd_pd(halfR2, _mm256_mul_pd(invR, invR),
+                                                            threeHalves));
+                invR = _mm256_and_pd(invR, _mm256_cmp_pd(r2, zero, _CMP_GT_OQ));
+                __m256d invR3 = _mm256_mul_pd(invR, _mm256_mul_pd(invR, invR));
+                __m256d mj = _mm256_set1_pd(m[j]);
+                __m256d s = _mm256_mul_pd(mj, invR3);
+                sumX = _mm256_fmadd_pd(s, dx, sumX);
+                sumY = _mm256_fmadd_pd(s, dy, sumY);
+                if constexpr (Dim == 3) {
+                    sumZ = _mm256_fmadd_pd(s, dz, sumZ);
+                }
+                if (WithPotential) {
+                    sumPotential = _mm256_fmadd_pd(mj, invR, sumPotential);
+                }
+            }
+            _mm256_storeu_pd(ax + i, _mm256_mul_pd(g, sumX));
+            _mm256_storeu_pd(ay + i, _mm256_mul_pd(g, sumY));
+            if constexpr (Dim == 3) {
+                _mm256_storeu_pd(az + i, _mm256_mul_pd(g, sumZ));
+            }
+            if (WithPotential) {
+                sumPotential = _mm256_fnmadd_pd(_mm256_loadu_pd(m + i), selfInvR, sumPotential);
+                _mm256_storeu_pd(potential + i, _mm256_mul_pd(_mm256_set1_pd(-G), sumPotential));
+            }
+        }
+        accelerationsScalar<Dim, WithPotential>(state, i, end, ax, ay, az, softening2, potential);
+    }
+
+    // Eight target bodies per register; rsqrt14 has double range, so no float round trip.
+    template <int Dim, bool WithPotential>
+    __attribute__((target("avx512f")))
+    void accelerationsAvx512(const BodyState& state, std::size_t begin, std::size_t end,
+                             double* ax, double* ay, double* az, double softening2,
+                             double* potential) {
+        const double* x = state.x.data();
+        const double* y = state.y.data();
+        const double* z = state.z.data();
+        const double* m = state.mass.data();
+        const std::size_t n = state.size();
+        const __m512d half = _mm512_set1_pd(0.5);
+        const __m512d threeHalves = _mm512_set1_pd(1.5);
+        const __m512d zero = _mm512_setzero_pd();
+        const __m512d g = _mm512_set1_pd(G);
+        const __m512d eps2 = _mm512_set1_pd(softening2);
+        const __m512d selfInvR = _mm512_set1_pd(softening2 > 0.0 ? 1.0 / std::sqrt(softening2)
+                                                                : 0.0);
+        std::size_t i = begin;
+        for (; i + 8 <= end; i += 8) {
+            __m512d xi = _mm512_loadu_pd(x + i);
+            __m512d yi = _mm512_loadu_pd(y + i);
+            __m512d zi = zero;
+            if constexpr (Dim == 3) {
+                zi = _mm512_loadu_pd(z + i);
+            }
+            __m512d sumX = zero;
+            __m512d sumY = zero;
+            __m512d sumZ = zero;
+            __m512d sumPotential = zero;
+            for (std::size_t j = 0; j < n; ++j) {
+                __m512d dx = _mm512_sub_pd(_mm512_set1_pd(x[j]), xi);
+                __m512d dy = _mm512_sub_pd(_mm512_set1_pd(y[j]), yi);
+                __m512d r2 = _mm512_fmadd_pd(dy, dy, _mm512_fmadd_pd(dx, dx, eps2));
+                __m512d dz = zero;
+                if constexpr (Dim == 3) {
+                    dz = _mm512_sub_pd(_mm512_set1_pd(z[j]), zi);
+                    r2 = _mm512_fmadd_pd(dz, dz, r2);
+                }
+                __mmask8 nonzero = _mm512_cmp_pd_mask(r2, zero, _CMP_GT_OQ);
+                __m512d invR = _mm512_maskz_rsqrt14_pd(nonzero, r2);
+                __m512d halfR2 = _mm512_mul_pd(half, r2);
+                invR = _mm512_mul_pd(invR, _mm512_fnmadd_pd(halfR2, _mm512_mul_pd(invR, invR),
+                                                            threeHalves));
+                invR = _mm512_mul_pd(invR, _mm512_fnmadd_pd(halfR2, _mm512_mul_pd(invR, invR),
+                                                            threeHalves));
+                __m512d invR3 = _mm512_mul_pd(invR, _mm512_mul_pd(invR, invR));
+                __m512d mj = _mm512_set1_pd(m[j]);
+                __m512d s = _mm512_mul_pd(mj, invR3);
+                sumX = _mm512_fmadd_pd(s, dx, sumX);
+                sumY = _mm512_fmadd_pd(s, dy, sumY);
+                if constexpr (Dim == 3) {
+                    sumZ = _mm512_fmadd_pd(s, dz, sumZ);
+                }
+                if (WithPotential) {
+                    sumPotential = _mm512_fmadd_pd(mj, invR, sumPotential);
+                }
+            }
+            _mm512_storeu_pd(ax + i, _mm512_mul_pd(g, sumX));
+            _mm512_storeu_pd(ay + i, _mm512_mul_pd(g, sumY));
+            if constexpr (Dim == 3) {
+                _mm512_storeu_pd(az + i, _mm512_mul_pd(g, sumZ));
+            }
+            if (WithPotential) {
+                sumPotential = _mm512_fnmadd_pd(_mm512_loadu_pd(m + i), selfInvR, sumPotential);
+                _mm512_storeu_pd(potential + i, _mm512_mul_pd(_mm512_set1_pd(-G), sumPotential));
+            }
+        }
+        accelerationsScalar<Dim, WithPotential>(state, i, end, ax, ay, az, softening2, potential);
+    }
+#endif
+
+    // Sources per float partial sum in the mixed kernels. Each partial is widened and
+    // added to a double total, so rounding error scales with the block, not with N.
+    constexpr std::size_t kMixedBlock = 32;
+
+    // Float counterpart of accelerationsScalar. m/r^3 is built as ((m/r)/r)/r: 1/r^3
+    // alone is denormal in float beyond ~1e13 m, and denormals are many times slower.
+    // Body i's own term is left out of the potential instead of subtracted, since a
+    // float self term of a heavy body would swamp everything else in the sum.
+    template <int Dim, bool WithPotential>
+    void mixedScalar(const FloatBodies& bodies, std::size_t begin, std::size_t end,
+                     double* ax, double* ay, double* az, float softening2, double* potential) {
+        const float* x = bodies.x.data();
+        const float* y = bodies.y.data();
+        const float* z = bodies.z.data();
+        const float* m = bodies.mass.data();
+        const std::size_t n = bodies.x.size();
+        for (std::size_t i = begin; i < end; ++i) {
+            double sumX = 0.0;
+            double sumY = 0.0;
+            double sumZ = 0.0;
+            double sumPotential = 0.0;
+            for (std::size_t block = 0; block < n; block += kMixedBlock) {
+                const std::size_t blockEnd = std::min(n, block + kMixedBlock);
+                float partX = 0.0f;
+                float partY = 0.0f;
+                float partZ = 0.0f;
+                float partPotential = 0.0f;
+                for (std::size_t j = block; j < blockEnd; ++j) {
+                    float dx = x[j] - x[i];
+                    float dy = y[j] - y[i];
+                    float dz = 0.0f;
+                    float r2 = dx * dx + dy * dy;
+                    if constexpr (Dim == 3) {
+                        dz = z[j] - z[i];
+                        r2 += dz * dz;
+                    }
+                    r2 += softening2;
+                    float invR = r2 > 0.0f ? 1.0f / std::sqrt(r2) : 0.0f;
+                    float s = m[j] * invR * invR * invR;
+                    partX += s * dx;
+                    partY += s * dy;
+                    if constexpr (Dim == 3) {
+                        partZ += s * dz;
+                    }
+                    if (WithPotential && j != i) {
+                        partPotential += m[j] * invR;
+                    }
+                }
+                sumX += partX;
+                sumY += partY;
+                sumZ += partZ;
+                sumPotential += partPotential;
+            }
+            ax[i] = G * sumX;
+            ay[i] = G * sumY;
+            if constexpr (Dim == 3) {
+                az[i] = G * sumZ;
+            }
+            if (WithPotential) {
+                potential[i] = -G * sumPotential;
+            }
+        }
+    }
+
+#ifdef NB_HAVE_X86_SIMD
+    // Adds the lower and upper halves of `value`, widened to double, to low and high.
+    __attribute__((target("avx2,fma")))
+    inline void widenAdd(__m256 value, __m256d& low, __m256d& high) {
+        low = _mm256_add_pd(low, _mm256_cvtps_pd(_mm256_castps256_ps128(value)));
+        high = _mm256_add_pd(high, _mm256_cvtps_pd(_mm256_extractf128_ps(value, 1)));
+    }
+
+    // The zero-masking forms compile to the same instructions and, unlike the plain
+    // ones, do not trip GCC's maybe-uninitialized warning on their undefined operand.
+    __attribute__((target("avx512f")))
+    inline void widenAdd(__m512 value, __m512d& low, __m512d& high) {
+        const __m512d bits = _mm512_castps_pd(value);
+        const __m256 lower = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xF, bits, 0));
+        const __m256 upper = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xF, bits, 1));
+        low = _mm512_add_pd(low, _mm512_maskz_cvtps_pd(0xFF, lower));
+        high = _mm512_add_pd(high, _mm512_maskz_cvtps_pd(0xFF, upper));
+    }
+
+    // Eight float targets per register; one Newton step takes rsqrt to float precision.
+    // The potential drops body i's own term by comparing j with each lane's index.
+    template <int Dim, bool WithPotential>
+    __attribute__((target("avx2,fma")))
+    void mixedAvx2(const FloatBodies& bodies, std::size_t begin, std::size_t end,
+                   double* ax, double* ay, double* az, float softening2, double* potential) {
+        const float* x = bodies.x.data();
+        const float* y = bodies.y.data();
+        const float* z = bodies.z.data();
+        const float* m = bodies.mass.data();
+        const std::size_t n = bodies.x.size();
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 threeHalves = _mm256_set1_ps(1.5f);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 eps2 = _mm256_set1_ps(softening2);
+        const __m256d g = _mm256_set1_pd(G);
+        std::size_t i = begin;
+        for (; i + 8 <= end; i += 8) {
+            __m256 xi = _mm256_loadu_ps(x + i);
+            __m256 yi = _mm256_loadu_ps(y + i);
+            __m256 zi = zero;
+            if constexpr (Dim == 3) {
+                zi = _mm256_loadu_ps(z + i);
+            }
+            __m256i lanes = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(i)),
+                                             _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+            __m256d sumX[2] = {_mm256_setzero_pd(), _mm256_setzero_pd()};
+            __m256d sumY[2] = {_mm256_setzero_pd(), _mm256_setzero_pd()};
+            __m256d sumZ[2] = {_mm256_setzero_pd(), _mm256_setzero_pd()};
+            __m256d sumPotential[2] = {_mm256_setzero_pd(), _mm256_setzero_pd()};
+            for (std::size_t block = 0; block < n; block += kMixedBlock) {
+                const std::size_t blockEnd = std::min(n, block + kMixedBlock);
+                __m256 partX = zero;
+                __m256 partY = zero;
+                __m256 partZ = zero;
+                __m256 partPotential = zero;
+                for (std::size_t j = block; j < blockEnd; ++j) {
+                    __m256 dx = _mm256_sub_ps(_mm256_set1_ps(x[j]), xi);
+                    __m256 dy = _mm256_sub_ps(_mm256_set1_ps(y[j]), yi);
+                    __m256 r2 = _mm256_fmadd_ps(dy, dy, _mm256_fmadd_ps(dx, dx, eps2));
+                    __m256 dz = zero;
+                    if constexpr (Dim == 3) {
+                        dz = _mm256_sub_ps(_mm256_set1_ps(z[j]), zi);
+                        r2 = _mm256_fmadd_ps(dz, dz, r2);
+                    }
+                    __m256 invR = _mm256_rsqrt_ps(r2);
+                    invR = _mm256_mul_ps(invR, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2),
+                                                                _mm256_mul_ps(invR, invR),
+                                                                threeHalves));
+                    invR = _mm256_and_ps(invR, _mm256_cmp_ps(r2, zero, _CMP_GT_OQ));
+                    __m256 mj = _mm256_set1_ps(m[j]);
+                    __m256 s = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(mj, invR), invR), invR);
+                    partX = _mm256_fmadd_ps(s, dx, partX);
+                    partY = _mm256_fmadd_ps(s, dy, partY);
+                    if constexpr (Dim == 3) {
+                        partZ = _mm256_fmadd_ps(s, dz, partZ);
+                    }
+                    if (WithPotential) {
+                        __m256i self = _mm256_cmpeq_epi32(lanes,
+                                                          _mm256_set1_epi32(static_cast<int>(j)));
+                        __m256 other = _mm256_andnot_ps(_mm256_castsi256_ps(self), invR);
+                        partPotential = _mm256_fmadd_ps(mj, other, partPotential);
+                    }
+                }
+                widenAdd(partX, sumX[0], sumX[1]);
+                widenAdd(partY, sumY[0], sumY[1]);
+                if constexpr (Dim == 3) {
+                    widenAdd(partZ, sumZ[0], sumZ[1]);
+                }
+                if (WithPotential) {
+                    widenAdd(partPotential, sumPotential[0], sumPotential[1]);
+                }
+            }
+            for (int k = 0; k < 2; ++k) {
+                _mm256_storeu_pd(ax + i + 4 * k, _mm256_mul_pd(g, sumX[k]));
+                _mm256_storeu_pd(ay + i + 4 * k, _mm256_mul_pd(g, sumY[k]));
+                if constexpr (Dim == 3) {
+                    _mm256_storeu_pd(az + i + 4 * k, _mm256_mul_pd(g, sumZ[k]));
+                }
+                if (WithPotential) {
+                    _mm256_storeu_pd(potential + i + 4 * k,
+                                     _mm256_mul_pd(_mm256_set1_pd(-G), sumPotential[k]));
+                }
+            }
+        }
+        mixedScalar<Dim, WithPotential>(bodies, i, end, ax, ay, az, softening2, potential);
+    }
+
+    // Sixteen float targets per register.
+    template <int Dim, bool WithPotential>
+    __attribute__((target("avx512f")))
+    void mixedAvx512(const FloatBodies& bodies, std::size_t begin, std::size_t end,
+                     double* ax, double* ay, double* az, float softening2, double* potential) {
+        const float* x = bodies.x.data();
+        const float* y = bodies.y.data();
+        const float* z = bodies.z.data();
+        const float* m = bodies.mass.data();
+        const std::size_t n = bodies.x.size();
+        const __m512 half = _mm512_set1_ps(0.5f);
+        const __m512 threeHalves = _mm512_set1_ps(1.5f);
+        const __m512 zero = _mm512_setzero_ps();
+        const __m512 eps2 = _mm512_set1_ps(softening2);
+        const __m512d g = _mm512_set1_pd(G);
+        std::size_t i = begin;
+        for (; i + 16 <= end; i += 16) {
+            __m512 xi = _mm512_loadu_ps(x + i);
+            __m512 yi = _mm512_loadu_ps(y + i);
+            __m512 zi = zero;
+            if constexpr (Dim == 3) {
+                zi = _mm512_loadu_ps(z + i);
+            }
+            __m512i lanes = _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(i)),
+                                             _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+                                                               10, 11, 12, 13, 14, 15));
+            __m512d sumX[2] = {_mm512_setzero_pd(), _mm512_setzero_pd()};
+            __m512d sumY[2] = {_mm512_setzero_pd(), _mm512_setzero_pd()};
+            __m512d sumZ[2] = {_mm512_setzero_pd(), _mm512_setzero_pd()};
+            __m512d sumPotential[2] = {_mm512_setzero_pd(), _mm512_setzero_pd()};
+            for (std::size_t block = 0; block < n; block += kMixedBlock) {
+                const std::size_t blockEnd = std::min(n, block + kMixedBlock);
+                __m512 partX = zero;
+                __m512 partY = zero;
+                __m512 partZ = zero;
+                __m512 partPotential = zero;
+                for (std::size_t j = block; j < blockEnd; ++j) {
+                    __m512 dx = _mm512_sub_ps(_mm512_set1_ps(x[j]), xi);
+                    __m512 dy = _mm512_sub_ps(_mm512_set1_ps(y[j]), yi);
+                    __m512 r2 = _mm512_fmadd_ps(dy, dy, _mm512_fmadd_ps(dx, dx, eps2));
+                    __m512 dz = zero;
+                    if constexpr (Dim == 3) {
+                        dz = _mm512_sub_ps(_mm512_set1_ps(z[j]), zi);
+                        r2 = _mm512_fmadd_ps(dz, dz, r2);
+                    }
+                    __mmask16 nonzero = _mm512_cmp_ps_mask(r2, zero, _CMP_GT_OQ);
+                    __m512 invR = _mm512_maskz_rsqrt14_ps(nonzero, r2);
+                    invR = _mm512_mul_ps(invR, _mm512_fnmadd_ps(_mm512_mul_ps(half, r2),
+                                                                _mm512_mul_ps(invR, invR),
+                                                                threeHalves));
+                    __m512 mj = _mm512_set1_ps(m[j]);
+                    __m512 s = _mm512_mul_ps(_mm512_mul_ps(_mm512_mul_ps(mj, invR), invR), invR);
+                    partX = _mm512_fmadd_ps(s, dx, partX);
+                    partY = _mm512_fmadd_ps(s, dy, partY);
+                    if constexpr (Dim == 3) {
+                        partZ = _mm512_fmadd_ps(s, dz, partZ);
+                    }
+                    if (WithPotential) {
+                        __mmask16 other = _mm512_cmpneq_epi32_mask(
+                            lanes, _mm512_set1_epi32(static_cast<int>(j)));
+                        partPotential = _mm512_mask3_fmadd_ps(mj, invR, partPotential, other);
+                    }
+                }
+                widenAdd(partX, sumX[0], sumX[1]);
+                widenAdd(partY, sumY[0], sumY[1]);
+                if constexpr (Dim == 3) {
+                    widenAdd(partZ, sumZ[0], sumZ[1]);
+                }
+                if (WithPotential) {
+                    widenAdd(partPotential, sumPotential[0], sumPotential[1]);
+                }
+            }
+            for (int k = 0; k < 2; ++k) {
+                _mm512_storeu_pd(ax + i + 8 * k, _mm512_mul_pd(g, sumX[k]));
+                _mm512_storeu_pd(ay + i + 8 * k, _mm512_mul_pd(g, sumY[k]));
+                if constexpr (Dim == 3) {
+                    _mm512_storeu_pd(az + i + 8 * k, _mm512_mul_pd(g, sumZ[k]));
+                }
+                if (WithPotential) {
+                    _mm512_storeu_pd(potential + i + 8 * k,
+                                     _mm512_mul_pd(_mm512_set1_pd(-G), sumPotential[k]));
+                }
+            }
+        }
+        mixedScalar<Dim, WithPotential>(bodies, i, end, ax, ay, az, softening2, potential);
+    }
+#endif
+
+    template <int Dim, bool WithPotential>
+    void dispatchMixed(const FloatBodies& bodies, std::size_t begin, std::size_t end,
+                       double* ax, double* ay, double* az, SimdLevel level, float softening2,
+                       double* potential) {
+#ifdef NB_HAVE_X86_SIMD
+        switch (level) {
+            case SimdLevel::Avx512:
+                mixedAvx512<Dim, WithPotential>(bodies, begin, end, ax, ay, az, softening2,
+                                                potential);
+                return;
+            case SimdLevel::Avx2:
+                mixedAvx2<Dim, WithPotential>(bodies, begin, end, ax, ay, az, softening2,
+                                              potential);
+                return;
+            case SimdLevel::Scalar:
+                break;
+        }
+#endif
+        mixedScalar<Dim, WithPotential>(bodies, begin, end, ax, ay, az, softening2, potential);
+    }
+
+    template <int Dim, bool WithPotential>
+    void dispatch(const BodyState& state, std::size_t begin, std::size_t end,
+                  double* ax, double* ay, double* az, SimdLevel level, double softening2,
+                  double* potential) {
+#ifdef NB_HAVE_X86_SIMD
+        switch (level) {
+            case SimdLevel::Avx512:
+                accelerationsAvx512<Dim, WithPotential>(state, begin, end, ax, ay, az,
+                                                        softening2, potential);
+                return;
+            case SimdLevel::Avx2:
+                accelerationsAvx2<Dim, WithPotential>(state, begin, end, ax, ay, az,
+                                                      softening2, potential);
+                return;
+            case SimdLevel::Scalar:
+                break;
+        }
+#endif
+        accelerationsScalar<Dim, WithPotential>(state, begin, end, ax, ay, az, softening2,
+                                                potential);
+    }
+    }  //  namespace
+
+    void computeAccelerations(const BodyState& state, std::size_t begin, std::size_t end,
+                              double* ax, double* ay, double* az, SimdLevel level,
+                              double softening, double* potential) {
+        const double softening2 = softening * softening;
+        if (state.dimensions == 3) {
+            if (!az) {
+                throw std::invalid_argument("3D bodies need a buffer for z accelerations");
+            }
+            if (potential) {
+                dispatch<3, true>(state, begin, end, ax, ay, az, level, softening2, potential);
+            } else {
+                dispatch<3, false>(state, begin, end, ax, ay, az, level, softening2, nullptr);
+            }
+        } else if (potential) {
+            dispatch<2, true>(state, begin, end, ax, ay, nullptr, level, softening2, potential);
+        } else {
+            dispatch<2, false>(state, begin, end, ax, ay, nullptr, level, softening2, nullptr);
+        }
+    }
+
+    void computeAccelerations(const BodyState& state, std::size_t begin, std::size_t end,
+                              double* ax, double* ay, SimdLevel level, double softening,
+                              double* potential) {
+        computeAccelerations(state, begin, end, ax, ay, nullptr, level, softening, potential);
+    }
+
+    void FloatBodies::assign(const BodyState& state) {
+        const std::size_t n = state.size();
+        double meanX = 0.0;
+        double meanY = 0.0;
+        for (std::size_t i = 0; i < n; ++i) {
+            meanX += state.x[i];
+            meanY += state.y[i];
+        }
+        if (n > 0) {
+            meanX /= n;
+            meanY /= n;
+        }
+        x.resize(n);
+        y.resize(n);
+        mass.resize(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            x[i] = static_cast<float>(state.x[i] - meanX);
+            y[i] = static_cast<float>(state.y[i] - meanY);
+            mass[i] = static_cast<float>(state.mass[i]);
+        }
+        dimensions = state.dimensions;
+        z.clear();
+        if (dimensions == 3) {
+            double meanZ = 0.0;
+            for (std::size_t i = 0; i < n; ++i) {
+                meanZ += state.z[i];
+            }
+            if (n > 0) {
+                meanZ /= n;
+            }
+            z.resize(n);
+            for (std::size_t i = 0; i < n; ++i) {
+                z[i] = static_cast<float>(state.z[i] - meanZ);
+            }
+        }
+    }
+
+    void computeAccelerations(const FloatBodies& bodies, std::size_t begin, std::size_t end,
+                              double* ax, double* ay, double* az, SimdLevel level,
+                              double softening, double* potential) {
+        const float softening2 = static_cast<float>(softening * softening);
+        if (bodies.dimensions == 3) {
+            if (!az) {
+                throw std::invalid_argument("3D bodies need a buffer for z accelerations");
+            }
+            if (potential) {
+                dispatchMixed<3, true>(bodies, begin, end, ax, ay, az, level, softening2,
+                                       potential);
+            } else {
+                dispatchMixed<3, false>(bodies, begin, end, ax, ay, az, level, softening2,
+                                        nullptr);
+            }
+        } else if (potential) {
+            dispatchMixed<2, true>(bodies, begin, end, ax, ay, nullptr, level, softening2,
+                                   potential);
+        } else {
+            dispatchMixed<2, false>(bodies, begin, end, ax, ay, nullptr, level, softening2,
+                                    nullptr);
+        }
+    }
+
+    void computeAccelerations(const FloatBodies& bodies, std::size_t begin, std::size_t end,
+                              double* ax, double* ay, SimdLevel level, double softening,
+                              double* potential) {
+        computeAccelerations(bodies, begin, end, ax, ay, nullptr, level, softening, potential);
+    }
+
+    namespace {
+    template <int Dim>
+    void jerks(const BodyState& state, std::size_t begin, std::size_t end, double* jx,
+               double* jy, double* jz, double softening2) {
+        const std::size_t n = state.size();
+        double* out[3] = {jx, jy, jz};
+        for (std::size_t i = begin; i < end; ++i) {
+            double sum[Dim] = {};
+            for (std::size_t j = 0; j < n; ++j) {
+                double d[Dim], dv[Dim];
+                double r2 = softening2;
+                double rv = 0.0;
+                for (int axis = 0; axis < Dim; ++axis) {
+                    d[axis] = state.position(axis)[j] - state.position(axis)[i];
+                    dv[axis] = state.velocity(axis)[j] - state.velocity(axis)[i];
+                    r2 += d[axis] * d[axis];
+                    rv += d[axis] * dv[axis];
+                }
+                // Body i itself has dv = 0, so it adds nothing even when softened
+                if (r2 == 0.0) {
+                    continue;
+                }
+                const double invR2 = 1.0 / r2;
+                const double invR3 = invR2 / std::sqrt(r2);
+                const double along = 3.0 * rv * invR2;
+                for (int axis = 0; axis < Dim; ++axis) {
+                    sum[axis] += G * state.mass[j] * invR3 * (dv[axis] - along * d[axis]);
+                }
+            }
+            for (int axis = 0; axis < Dim; ++axis) {
+                out[axis][i] = sum[axis];
+            }
+        }
+    }
+    }  //  namespace
+
+    void computeJerks(const BodyState& state, std::size_t begin, std::size_t end,
+                      double* jx, double* jy, double* jz, double softening) {
+        if (state.dimensions == 3) {
+            if (!jz) {
+                throw std::invalid_argument("3D bodies need a buffer for z jerks");
+            }
+            jerks<3>(state, begin, end, jx, jy, jz, softening * softening);
+        } else {
+            jerks<2>(state, begin, end, jx, jy, nullptr, softening * softening);
+        }
+    }
+}  //  namespace NB
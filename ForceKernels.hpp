@@ -0,0 +1,97 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef FORCEKERNELS_HPP
+#define FORCEKERNELS_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "BodyState.hpp"
+
+namespace NB {
+
+constexpr double G = 6.67e-11;  // Gravitational constant
+
+// Force evaluation strategies a Universe can step with.
+enum class ForceBackend {
+    Pairwise,  // Original per-pair loop through calculateGravitationalForce
+    Simd,      // Vectorized direct summation into an acceleration buffer
+    BarnesHut, // Quadtree (octree in 3D) approximation, O(N log N)
+    Symmetric, // Vectorized direct summation evaluating each pair once for both bodies
+    Fmm,       // Fast multipole method for 2D states, O(N); 3D states use BarnesHut
+    ParticleMesh  // FFT potential on a grid, optionally with direct short-range pairs (P3M)
+};
+
+// Instruction set used by the vectorized direct-summation kernel.
+enum class SimdLevel {
+    Scalar,
+    Avx2,
+    Avx512
+};
+
+// Arithmetic of the direct-summation kernel. Positions and velocities are always
+// stored and integrated in double; this only picks how pair terms are evaluated.
+enum class Precision {
+    Double,  // Every operation in double
+    Mixed    // Separations, 1/r and pair terms in float, sums in double; twice the lanes
+};
+
+ForceBackend forceBackendFromString(const std::string& name);
+std::string toString(ForceBackend backend);
+std::string toString(SimdLevel level);
+Precision precisionFromString(const std::string& name);
+std::string toString(Precision precision);
+
+// Best instruction set supported by the running CPU.
+SimdLevel detectSimdLevel();
+
+// Bodies per vector block of the widest kernel (mixed precision on AVX-512). The
+// kernels below handle whole blocks from `begin` and finish with a scalar tail, so a
+// body's result depends on where its range starts; callers that split a pass should
+// cut it at multiples of this.
+constexpr std::size_t kWidestBlock = 16;
+
+// Accelerations of bodies [begin, end) due to every body in `state`, by direct
+// summation. Results are written to ax[i], ay[i], and az[i] for a 3D state, for
+// each i in the range; az may be null for a 2D state. Each kernel is compiled once
+// per dimension, so the 2D instantiation does no work for z.
+// `softening` is the Plummer length eps: every r^2 becomes r^2 + eps^2, which
+// caps the force of close pairs without a branch in the inner loop. If
+// `potential` is given, potential[i] also receives -G sum_j m_j / r_ij, at the
+// cost of one multiply-add per pair.
+void computeAccelerations(const BodyState& state, std::size_t begin, std::size_t end,
+                          double* ax, double* ay, double* az, SimdLevel level,
+                          double softening = 0, double* potential = nullptr);
+// Same for a 2D state.
+void computeAccelerations(const BodyState& state, std::size_t begin, std::size_t end,
+                          double* ax, double* ay, SimdLevel level, double softening = 0,
+                          double* potential = nullptr);
+
+// Float copy of the positions and masses for the mixed-precision kernel. Positions
+// are taken relative to their mean, so the float digits go to where bodies differ
+// rather than to a common offset. Refill it whenever the bodies move.
+struct FloatBodies {
+    std::vector<float> x, y, z, mass;  // z is empty unless dimensions == 3
+    unsigned dimensions = 2;
+    void assign(const BodyState& state);
+};
+
+// Same as above with float pair terms: relative force error is around 1e-7 rather
+// than 1e-15, which long runs will notice, in exchange for twice the throughput.
+void computeAccelerations(const FloatBodies& bodies, std::size_t begin, std::size_t end,
+                          double* ax, double* ay, double* az, SimdLevel level,
+                          double softening = 0, double* potential = nullptr);
+void computeAccelerations(const FloatBodies& bodies, std::size_t begin, std::size_t end,
+                          double* ax, double* ay, SimdLevel level, double softening = 0,
+                          double* potential = nullptr);
+
+// Time derivatives of the accelerations of bodies [begin, end) by direct summation,
+// sum_j G m_j (v_ij / s^3 - 3 (r_ij . v_ij) r_ij / s^5) with s^2 = r_ij^2 + eps^2, into
+// jx[i], jy[i] and jz[i] (3D only; jz may be null in 2D). Scalar: it only picks the
+// block integrator's first step sizes.
+void computeJerks(const BodyState& state, std::size_t begin, std::size_t end,
+                  double* jx, double* jy, double* jz, double softening = 0);
+
+}  //  namespace NB
+
+#endif  //  FORCEKERNELS_HPP
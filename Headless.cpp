@@ -0,0 +1,200 @@
+//  Copyright 2024 Vy Tran
+
+#include "Headless.hpp"
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include "Checkpoint.hpp"
+#include "Ensemble.hpp"
+#include "Loader.hpp"
+#include "Profiler.hpp"
+
+namespace NB {
+    int runHeadless(const Options& options, std::istream& in, std::ostream& out) {
+        startProfiling(options);
+        if (!options.ensemblePath.empty() || options.copies > 0) {
+            try {
+                out << writeEnsemble(runEnsemble(ensembleMembers(options), options),
+                                     options.outputDir);
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
+            reportProfile(options, std::cerr);
+            return 0;
+        }
+        Simulation simulation;
+        RunPosition position;
+        try {
+            if (!options.resumePath.empty()) {
+                position = loadCheckpoint(options.resumePath, simulation);
+            } else if (!options.inputPath.empty()) {
+                loadUniverse(options.inputPath, simulation, options.threads);
+            } else if (!(in >> simulation)) {
+                throw std::runtime_error("Failed to read universe");
+            }
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        configure(simulation, options);
+
+        Checkpointer checkpointer(options.checkpointPath, options.checkpointEvery);
+        std::ofstream trajectoryFile;
+        std::unique_ptr<TrajectoryRecorder> recorder;
+        try {
+            checkpointer.checkWritable();
+            recorder = startTrajectory(options, trajectoryFile, out);
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        if (recorder) {
+            recorder->record(simulation.bodies(), position);
+        }
+        DiagnosticsMonitor monitor(options.diagnosticsEvery, std::cerr);
+        monitor.afterStep(simulation, position);
+        reportHash(simulation, position, options, std::cerr);
+
+        while (position.elapsedTime < options.totalTime) {
+            try {
+                simulation.step(options.deltaT);
+                position.elapsedTime += options.deltaT;
+                ++position.steps;
+                checkpointer.afterStep(simulation, position);
+            } catch (const std::runtime_error& e) {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
+            if (recorder) {
+                recorder->record(simulation.bodies(), position);
+            }
+            monitor.afterStep(simulation, position);
+            reportHash(simulation, position, options, std::cerr);
+        }
+        monitor.finish(simulation);
+        recorder.reset();
+
+        reportForceError(simulation, options, std::cerr);
+        if (options.trajectoryPath != "-") {
+            out << simulation << std::endl;
+        }
+        reportProfile(options, std::cerr);
+        return 0;
+    }
+
+    DiagnosticsMonitor::DiagnosticsMonitor(std::uint64_t interval, std::ostream& log)
+    : interval(interval),
+      log(log),
+      haveInitial(false),
+      initialEnergy(0)
+    {}
+
+    void DiagnosticsMonitor::afterStep(Simulation& simulation, const RunPosition& position) {
+        if (interval == 0) {
+            return;
+        }
+        Diagnostics diagnostics;
+        if (simulation.takeDiagnostics(diagnostics)) {
+            report(diagnostics);
+        }
+        if (position.steps % interval == 0) {
+            //  Integrators that drift before their first force pass (yoshida4) never
+            //  complete a request on their own; sweep it rather than let the new one
+            //  replace it
+            if (simulation.takeDiagnostics(diagnostics, true)) {
+                report(diagnostics);
+            }
+            simulation.requestDiagnostics();
+            requestedAt = position;
+            if (simulation.takeDiagnostics(diagnostics)) {
+                report(diagnostics);
+            }
+        }
+    }
+
+    void DiagnosticsMonitor::finish(Simulation& simulation) {
+        Diagnostics diagnostics;
+        if (interval > 0 && simulation.takeDiagnostics(diagnostics, true)) {
+            report(diagnostics);
+        }
+    }
+
+    void DiagnosticsMonitor::report(const Diagnostics& diagnostics) {
+        if (!haveInitial) {
+            initialEnergy = diagnostics.totalEnergy();
+            haveInitial = true;
+        }
+        const double drift = initialEnergy != 0
+                           ? (diagnostics.totalEnergy() - initialEnergy) / std::abs(initialEnergy)
+                           : 0;
+        log << "step " << requestedAt.steps << " t=" << requestedAt.elapsedTime << " "
+            << diagnostics << " dE/|E0|=" << drift << std::endl;
+    }
+
+    void startProfiling(const Options& options) {
+        if (options.profile) {
+            Profiler::enable(!options.profileTrace.empty());
+        }
+    }
+
+    void reportProfile(const Options& options, std::ostream& log) {
+        if (!options.profile) {
+            return;
+        }
+        Profiler::summary(log);
+        if (!options.profileTrace.empty()) {
+            std::ofstream trace(options.profileTrace);
+            Profiler::writeTrace(trace);
+            if (!trace) {
+                log << "Failed to write profile trace: " << options.profileTrace << std::endl;
+            }
+        }
+    }
+
+    std::unique_ptr<TrajectoryRecorder> startTrajectory(const Options& options,
+                                                        std::ofstream& file,
+                                                        std::ostream& standardOutput) {
+        if (options.trajectoryPath.empty()) {
+            return nullptr;
+        }
+        std::ostream* out = &standardOutput;
+        if (options.trajectoryPath != "-") {
+            file.open(options.trajectoryPath, std::ios::binary | std::ios::trunc);
+            if (!file) {
+                throw std::runtime_error("Failed to open trajectory file: "
+                                         + options.trajectoryPath);
+            }
+            out = &file;
+        }
+        return std::make_unique<TrajectoryRecorder>(*out, options.trajectoryEvery,
+                                                    options.trajectoryEncoding);
+    }
+
+    void reportHash(const Simulation& simulation, const RunPosition& position,
+                    const Options& options, std::ostream& log) {
+        if (options.hashEvery == 0 || position.steps % options.hashEvery != 0) {
+            return;
+        }
+        std::ostringstream hash;
+        hash << std::hex << std::setw(16) << std::setfill('0') << stateHash(simulation.bodies());
+        log << "step " << position.steps << " hash " << hash.str() << std::endl;
+    }
+
+    void reportForceError(Simulation& simulation, const Options& options, std::ostream& log) {
+        if (options.accuracySamples == 0) {
+            return;
+        }
+        if (options.backend == ForceBackend::Fmm && simulation.bodies().dimensions == 2) {
+            log << "FMM (order " << options.fmmOrder << ", theta " << options.theta << ")";
+        } else if (options.backend == ForceBackend::ParticleMesh) {
+            log << (options.p3m ? "P3M" : "PM") << " (grid " << options.meshGrid << ")";
+        } else {
+            log << "Barnes-Hut (theta " << options.theta << ")";
+        }
+        log << " max relative force error over "
+            << options.accuracySamples << " bodies: "
+            << simulation.forceError(options.accuracySamples) << std::endl;
+    }
+}  //  namespace NB
@@ -0,0 +1,70 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef HEADLESS_HPP
+#define HEADLESS_HPP
+
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <memory>
+#include "Checkpoint.hpp"
+#include "Diagnostics.hpp"
+#include "Options.hpp"
+#include "Simulation.hpp"
+#include "Trajectory.hpp"
+
+namespace NB {
+
+// Reads a universe from `in` (or the --resume checkpoint), runs until T with no
+// window or audio and writes the final state to `out` in the same format as the
+// windowed run, unless the trajectory goes to `out`. With --ensemble or --copies it
+// runs the ensemble instead and writes its summary to `out`. Returns the process exit
+// code.
+int runHeadless(const Options& options, std::istream& in, std::ostream& out);
+
+// Starts the --trajectory recorder, or returns null if none was asked for. "-"
+// records to `standardOutput`; otherwise `file` is opened and must outlive the
+// recorder. Throws std::runtime_error if the file cannot be opened.
+std::unique_ptr<TrajectoryRecorder> startTrajectory(const Options& options, std::ofstream& file,
+                                                    std::ostream& standardOutput);
+
+// Prints energy, momentum and center of mass every K steps, as asked for with
+// --diagnostics K, along with the energy drift since the first report. Each
+// state is measured right after its step; its potential energy is taken from
+// the next force pass at the same positions, so a report may arrive a step late
+// but costs no extra O(N^2) sweep. Integrators that make no such pass before the
+// next report is due (yoshida4) get a direct sweep instead.
+class DiagnosticsMonitor {
+ public:
+    DiagnosticsMonitor(std::uint64_t interval, std::ostream& log);
+    void afterStep(Simulation& simulation, const RunPosition& position);
+    // Reports a request still waiting for its force pass.
+    void finish(Simulation& simulation);
+
+ private:
+    void report(const Diagnostics& diagnostics);
+
+    std::uint64_t interval;
+    std::ostream& log;
+    RunPosition requestedAt;
+    bool haveInitial;
+    double initialEnergy;
+};
+
+// Starts the --profile timers, if asked for.
+void startProfiling(const Options& options);
+// Prints the --profile summary to `log` and writes the --profile-trace file, if any.
+void reportProfile(const Options& options, std::ostream& log);
+
+// Prints "step N hash H" for --hash K when N is a multiple of K, with H the
+// stateHash of the bodies in hex. Diffing these lines between two runs finds the
+// first step at which they diverge.
+void reportHash(const Simulation& simulation, const RunPosition& position,
+                const Options& options, std::ostream& log);
+
+// Prints the Barnes-Hut accuracy report requested with --accuracy, if any.
+void reportForceError(Simulation& simulation, const Options& options, std::ostream& log);
+
+}  //  namespace NB
+
+#endif  //  HEADLESS_HPP
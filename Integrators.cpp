@@ -0,0 +1,556 @@
+//  Copyright 2024 Vy Tran
+
+#include "Integrators.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include "ForceKernels.hpp"
+
+namespace NB {
+    IntegratorKind integratorFromString(const std::string& name) {
+        if (name == "euler") return IntegratorKind::Euler;
+        if (name == "leapfrog") return IntegratorKind::Leapfrog;
+        if (name == "yoshida4") return IntegratorKind::Yoshida4;
+        if (name == "rk4") return IntegratorKind::RK4;
+        if (name == "adaptive") return IntegratorKind::Adaptive;
+        if (name == "block") return IntegratorKind::Block;
+        throw std::invalid_argument("Unknown integrator: " + name);
+    }
+
+    std::string toString(IntegratorKind kind) {
+        switch (kind) {
+            case IntegratorKind::Euler: return "euler";
+            case IntegratorKind::Leapfrog: return "leapfrog";
+            case IntegratorKind::Yoshida4: return "yoshida4";
+            case IntegratorKind::RK4: return "rk4";
+            case IntegratorKind::Adaptive: return "adaptive";
+            case IntegratorKind::Block: return "block";
+        }
+        return "unknown";
+    }
+
+    void Integrator::evaluate(const AccelerationFunction& accelerations, Accelerations& a) {
+        accelerations(a[0], a[1], a[2]);
+        ++mEvaluations;
+    }
+
+    void Integrator::evaluate(const SubsetAccelerationFunction& subset,
+                              const std::vector<std::uint32_t>& bodies, Accelerations& a) {
+        subset(bodies, a[0], a[1], a[2]);
+        if (!a[0].empty()) {
+            mEvaluations += static_cast<double>(bodies.size()) / a[0].size();
+        }
+    }
+
+    namespace {
+    // Length of a vector with the state's number of components. The 2D form keeps
+    // the two-argument hypot, so 2D results do not change in the last bit.
+    double norm(double x, double y, double z, unsigned dimensions) {
+        return dimensions == 3 ? std::hypot(x, y, z) : std::hypot(x, y);
+    }
+
+    void drift(BodyState& state, double seconds) {
+        for (unsigned axis = 0; axis < state.dimensions; ++axis) {
+            std::vector<double>& position = state.position(axis);
+            const std::vector<double>& velocity = state.velocity(axis);
+            for (std::size_t i = 0; i < state.size(); ++i) {
+                position[i] += velocity[i] * seconds;
+            }
+        }
+    }
+
+    void kick(BodyState& state, const std::vector<double> (&a)[3], double seconds) {
+        for (unsigned axis = 0; axis < state.dimensions; ++axis) {
+            std::vector<double>& velocity = state.velocity(axis);
+            for (std::size_t i = 0; i < state.size(); ++i) {
+                velocity[i] += a[axis][i] * seconds;
+            }
+        }
+    }
+
+    // Semi-implicit: every velocity is updated before it moves its body.
+    class EulerIntegrator : public Integrator {
+     public:
+        void step(BodyState& state, double seconds,
+                  const AccelerationFunction& accelerations) override {
+            evaluate(accelerations, a);
+            kick(state, a, seconds);
+            drift(state, seconds);
+        }
+
+     private:
+        Accelerations a;
+    };
+
+    // The closing kick's accelerations are those of the next opening kick, so
+    // they are kept and each step costs a single force evaluation.
+    class LeapfrogIntegrator : public Integrator {
+     public:
+        void step(BodyState& state, double seconds,
+                  const AccelerationFunction& accelerations) override {
+            if (!valid || a[0].size() != state.size()) {
+                evaluate(accelerations, a);
+            }
+            kick(state, a, 0.5 * seconds);
+            drift(state, seconds);
+            evaluate(accelerations, a);
+            kick(state, a, 0.5 * seconds);
+            valid = true;
+        }
+
+        void reset() override {
+            valid = false;
+        }
+
+     private:
+        Accelerations a;
+        bool valid = false;
+    };
+
+    // Drift-kick composition of three leapfrog steps with Yoshida's weights.
+    class Yoshida4Integrator : public Integrator {
+     public:
+        void step(BodyState& state, double seconds,
+                  const AccelerationFunction& accelerations) override {
+            const double cbrt2 = std::cbrt(2.0);
+            const double w1 = 1.0 / (2.0 - cbrt2);
+            const double w0 = -cbrt2 * w1;
+            const double c[4] = {w1 / 2, (w0 + w1) / 2, (w0 + w1) / 2, w1 / 2};
+            const double d[3] = {w1, w0, w1};
+            for (int k = 0; k < 3; ++k) {
+                drift(state, c[k] * seconds);
+                evaluate(accelerations, a);
+                kick(state, a, d[k] * seconds);
+            }
+            drift(state, c[3] * seconds);
+        }
+
+     private:
+        Accelerations a;
+    };
+
+    class RK4Integrator : public Integrator {
+     public:
+        void step(BodyState& state, double seconds,
+                  const AccelerationFunction& accelerations) override {
+            const std::size_t n = state.size();
+            const unsigned axes = state.dimensions;
+            for (unsigned axis = 0; axis < axes; ++axis) {
+                x0[axis] = state.position(axis);
+                v0[axis] = state.velocity(axis);
+                sumV[axis].assign(n, 0.0);
+                sumA[axis].assign(n, 0.0);
+            }
+
+            // Stage k evaluates at x0 + scale * v_{k-1}, v_k = v0 + scale * a_{k-1}
+            const double scale[4] = {0.0, 0.5, 0.5, 1.0};
+            const double weight[4] = {1.0, 2.0, 2.0, 1.0};
+            for (int k = 0; k < 4; ++k) {
+                if (k > 0) {
+                    for (unsigned axis = 0; axis < axes; ++axis) {
+                        std::vector<double>& x = state.position(axis);
+                        std::vector<double>& v = state.velocity(axis);
+                        for (std::size_t i = 0; i < n; ++i) {
+                            x[i] = x0[axis][i] + scale[k] * seconds * v[i];
+                            v[i] = v0[axis][i] + scale[k] * seconds * a[axis][i];
+                        }
+                    }
+                }
+                evaluate(accelerations, a);
+                for (unsigned axis = 0; axis < axes; ++axis) {
+                    const std::vector<double>& v = state.velocity(axis);
+                    for (std::size_t i = 0; i < n; ++i) {
+                        sumV[axis][i] += weight[k] * v[i];
+                        sumA[axis][i] += weight[k] * a[axis][i];
+                    }
+                }
+            }
+
+            for (unsigned axis = 0; axis < axes; ++axis) {
+                std::vector<double>& x = state.position(axis);
+                std::vector<double>& v = state.velocity(axis);
+                for (std::size_t i = 0; i < n; ++i) {
+                    x[i] = x0[axis][i] + seconds / 6.0 * sumV[axis][i];
+                    v[i] = v0[axis][i] + seconds / 6.0 * sumA[axis][i];
+                }
+            }
+        }
+
+     private:
+        std::vector<double> x0[3], v0[3];
+        Accelerations a;
+        std::vector<double> sumV[3], sumA[3];
+    };
+
+    // Dormand-Prince 5(4). Each call advances exactly `seconds`, split into as
+    // many substeps as the error estimate asks for; the last accepted substep
+    // size carries over to the next call. Throws std::runtime_error, leaving the
+    // state as it was before the failed substep, if the error estimate stays
+    // non-finite down to the smallest substep.
+    class AdaptiveIntegrator : public Integrator {
+     public:
+        explicit AdaptiveIntegrator(double tolerance) : tolerance(tolerance), h(0) {}
+
+        void step(BodyState& state, double seconds,
+                  const AccelerationFunction& accelerations) override {
+            double remaining = seconds;
+            if (h <= 0.0 || h > std::abs(seconds)) {
+                h = seconds;
+            }
+            // Guard against a stalled controller shrinking h to nothing
+            const double minimum = std::abs(seconds) * 1e-12;
+            while (std::abs(remaining) > minimum) {
+                double trial = std::abs(h) < std::abs(remaining) ? h : remaining;
+                double error = attempt(state, trial, accelerations);
+                if (!std::isfinite(error)) {
+                    // Overflowing forces (bodies all but coincident without softening)
+                    // poison the estimate; shrink like any rejection until that fails too
+                    if (std::abs(trial) <= minimum) {
+                        throw std::runtime_error("Adaptive step has a non-finite error estimate;"
+                                                 " bodies may be coincident (try --softening)");
+                    }
+                    h = trial * 0.2;
+                    continue;
+                }
+                if (error <= 1.0 || std::abs(trial) <= minimum) {
+                    accept(state);
+                    remaining -= trial;
+                }
+                // Standard controller: safety 0.9, growth clamped to [0.2, 5]
+                double factor = error > 0.0 ? 0.9 * std::pow(error, -0.2) : 5.0;
+                factor = std::min(5.0, std::max(0.2, factor));
+                h = trial * factor;
+            }
+        }
+
+        void reset() override {
+            h = 0;
+        }
+
+        std::vector<double> save() const override {
+            return {h};
+        }
+
+        bool restore(const std::vector<double>& saved, std::size_t) override {
+            if (saved.size() != 1) {
+                return false;
+            }
+            h = saved[0];
+            return true;
+        }
+
+     private:
+        static constexpr int kStages = 7;
+
+        // Computes the fifth-order solution of one substep into x5, v5 and returns the
+        // scaled error norm, or infinity if the solution is not finite; state is left as
+        // it was.
+        double attempt(BodyState& state, double dt, const AccelerationFunction& accelerations) {
+            static const double a[kStages][kStages] = {
+                {0, 0, 0, 0, 0, 0, 0},
+                {1.0 / 5, 0, 0, 0, 0, 0, 0},
+                {3.0 / 40, 9.0 / 40, 0, 0, 0, 0, 0},
+                {44.0 / 45, -56.0 / 15, 32.0 / 9, 0, 0, 0, 0},
+                {19372.0 / 6561, -25360.0 / 2187, 64448.0 / 6561, -212.0 / 729, 0, 0, 0},
+                {9017.0 / 3168, -355.0 / 33, 46732.0 / 5247, 49.0 / 176, -5103.0 / 18656, 0, 0},
+                {35.0 / 384, 0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784, 11.0 / 84, 0}};
+            static const double b5[kStages] = {35.0 / 384, 0, 500.0 / 1113, 125.0 / 192,
+                                               -2187.0 / 6784, 11.0 / 84, 0};
+            static const double b4[kStages] = {5179.0 / 57600, 0, 7571.0 / 16695, 393.0 / 640,
+                                               -92097.0 / 339200, 187.0 / 2100, 1.0 / 40};
+            const std::size_t n = state.size();
+            const unsigned axes = state.dimensions;
+            for (unsigned axis = 0; axis < axes; ++axis) {
+                x0[axis] = state.position(axis);
+                v0[axis] = state.velocity(axis);
+                for (int s = 0; s < kStages; ++s) {
+                    kx[s][axis].resize(n);
+                    kv[s][axis].resize(n);
+                }
+            }
+
+            for (int s = 0; s < kStages; ++s) {
+                for (unsigned axis = 0; axis < axes; ++axis) {
+                    std::vector<double>& position = state.position(axis);
+                    for (std::size_t i = 0; i < n; ++i) {
+                        double x = x0[axis][i], v = v0[axis][i];
+                        for (int r = 0; r < s; ++r) {
+                            x += dt * a[s][r] * kx[r][axis][i];
+                            v += dt * a[s][r] * kv[r][axis][i];
+                        }
+                        position[i] = x;
+                        kx[s][axis][i] = v;
+                    }
+                }
+                evaluate(accelerations, kv[s]);
+            }
+
+            // Error is measured against the system's size and speed, so bodies at
+            // rest or at the origin do not demand absurd accuracy
+            auto component = [axes](const std::vector<double> (&c)[3], int axis,
+                                    std::size_t i) {
+                return static_cast<unsigned>(axis) < axes ? c[axis][i] : 0.0;
+            };
+            double positionScale = 0.0, velocityScale = 0.0;
+            for (std::size_t i = 0; i < n; ++i) {
+                positionScale = std::max(positionScale, norm(x0[0][i], x0[1][i],
+                                                             component(x0, 2, i), axes));
+                velocityScale = std::max(velocityScale, norm(v0[0][i], v0[1][i],
+                                                             component(v0, 2, i), axes));
+            }
+            positionScale = tolerance * std::max(positionScale, 1e-300);
+            velocityScale = tolerance * std::max(velocityScale, 1e-300);
+
+            double error = 0.0;
+            bool finite = true;
+            double dx5[3] = {}, dv5[3] = {}, dx4[3] = {}, dv4[3] = {};
+            for (unsigned axis = 0; axis < axes; ++axis) {
+                x5[axis].resize(n);
+                v5[axis].resize(n);
+            }
+            for (std::size_t i = 0; i < n; ++i) {
+                for (unsigned axis = 0; axis < axes; ++axis) {
+                    dx5[axis] = dv5[axis] = dx4[axis] = dv4[axis] = 0;
+                    for (int s = 0; s < kStages; ++s) {
+                        dx5[axis] += b5[s] * kx[s][axis][i];
+                        dv5[axis] += b5[s] * kv[s][axis][i];
+                        dx4[axis] += b4[s] * kx[s][axis][i];
+                        dv4[axis] += b4[s] * kv[s][axis][i];
+                    }
+                    x5[axis][i] = x0[axis][i] + dt * dx5[axis];
+                    v5[axis][i] = v0[axis][i] + dt * dv5[axis];
+                    finite = finite && std::isfinite(x5[axis][i]) && std::isfinite(v5[axis][i]);
+                }
+                error = std::max(error, std::abs(dt) * norm(dx5[0] - dx4[0], dx5[1] - dx4[1],
+                                                            dx5[2] - dx4[2], axes)
+                                        / positionScale);
+                error = std::max(error, std::abs(dt) * norm(dv5[0] - dv4[0], dv5[1] - dv4[1],
+                                                            dv5[2] - dv4[2], axes)
+                                        / velocityScale);
+            }
+
+            for (unsigned axis = 0; axis < axes; ++axis) {
+                state.position(axis) = x0[axis];
+            }
+            // std::max skips NaN terms, so a poisoned solution is flagged here instead
+            return finite ? error : std::numeric_limits<double>::infinity();
+        }
+
+        void accept(BodyState& state) {
+            for (unsigned axis = 0; axis < state.dimensions; ++axis) {
+                state.position(axis).swap(x5[axis]);
+                state.velocity(axis).swap(v5[axis]);
+            }
+        }
+
+        double tolerance;
+        double h;  // Substep size to try next
+        std::vector<double> x0[3], v0[3];
+        std::vector<double> x5[3], v5[3];
+        Accelerations kx[kStages], kv[kStages];  // Stage velocities and accelerations
+    };
+
+    // Hierarchical kick-drift-kick leapfrog. A step of `seconds` is split into
+    // 2^maxLevel ticks and body i steps 2^(maxLevel - level_i) ticks at a time,
+    // so all step boundaries line up. At each boundary every body drifts, and
+    // only the bodies whose step ends there get new forces, a closing kick, a
+    // new level and an opening kick. All bodies are in sync again at the end.
+    class BlockIntegrator : public Integrator {
+     public:
+        BlockIntegrator(unsigned maxLevel, double accuracy)
+        : maxLevel(std::min(maxLevel, 30u)),
+          accuracy(accuracy)
+        {}
+
+        // Without a subset evaluation every pass is a full one, and the jerks are
+        // unsoftened and serial.
+        void step(BodyState& state, double seconds,
+                  const AccelerationFunction& accelerations) override {
+            stepIndividually(state, seconds, accelerations,
+                             [&accelerations, this](const std::vector<std::uint32_t>&,
+                                                    std::vector<double>& ax,
+                                                    std::vector<double>& ay,
+                                                    std::vector<double>& az) {
+                                 accelerations(scratch[0], scratch[1], scratch[2]);
+                                 for (std::uint32_t i : active) {
+                                     ax[i] = scratch[0][i];
+                                     ay[i] = scratch[1][i];
+                                     if (!az.empty()) {
+                                         az[i] = scratch[2][i];
+                                     }
+                                 }
+                             },
+                             [&state](std::vector<double>& jx, std::vector<double>& jy,
+                                      std::vector<double>& jz) {
+                                 const std::size_t n = state.size();
+                                 jx.resize(n);
+                                 jy.resize(n);
+                                 jz.resize(state.dimensions == 3 ? n : 0);
+                                 computeJerks(state, 0, n, jx.data(), jy.data(), jz.data());
+                             });
+        }
+
+        void stepIndividually(BodyState& state, double seconds,
+                              const AccelerationFunction& accelerations,
+                              const SubsetAccelerationFunction& subset,
+                              const JerkFunction& jerks) override {
+            const std::size_t n = state.size();
+            const unsigned axes = state.dimensions;
+            const std::uint64_t ticks = std::uint64_t(1) << maxLevel;
+            const double tick = seconds / ticks;
+            if (!valid || a[0].size() != n) {
+                evaluate(accelerations, a);
+                if (level.size() == n && restored) {
+                    startSteps(n, axes);
+                } else {
+                    initialLevels(state, seconds, jerks);
+                }
+                restored = false;
+                valid = true;
+            }
+
+            for (std::size_t i = 0; i < n; ++i) {
+                const std::uint64_t length = ticks >> level[i];
+                kick(state, i, 0.5 * length * tick);
+                nextTick[i] = length;
+            }
+            std::uint64_t now = 0;
+            while (now < ticks) {
+                const std::uint64_t next = *std::min_element(nextTick.begin(), nextTick.end());
+                drift(state, (next - now) * tick);
+                now = next;
+
+                active.clear();
+                for (std::size_t i = 0; i < n; ++i) {
+                    if (nextTick[i] == now) {
+                        active.push_back(i);
+                        for (unsigned axis = 0; axis < axes; ++axis) {
+                            previous[axis][i] = a[axis][i];
+                        }
+                    }
+                }
+                evaluate(subset, active, a);
+                for (std::uint32_t i : active) {
+                    const double length = (ticks >> level[i]) * tick;
+                    kick(state, i, 0.5 * length);
+                    const double jerk = norm(a[0][i] - previous[0][i], a[1][i] - previous[1][i],
+                                             axes == 3 ? a[2][i] - previous[2][i] : 0.0, axes)
+                                      / length;
+                    level[i] = nextLevel(i, magnitude(i, axes), jerk, seconds, now, ticks);
+                    if (now < ticks) {
+                        const std::uint64_t next = ticks >> level[i];
+                        kick(state, i, 0.5 * next * tick);
+                        nextTick[i] = now + next;
+                    }
+                }
+            }
+        }
+
+        void reset() override {
+            valid = false;
+            restored = false;
+        }
+
+        // The accelerations are left out: the first step after a restore recomputes
+        // them with a full pass at the same positions as the closing pass that left them.
+        std::vector<double> save() const override {
+            std::vector<double> saved = {static_cast<double>(maxLevel)};
+            saved.insert(saved.end(), level.begin(), level.end());
+            return saved;
+        }
+
+        bool restore(const std::vector<double>& saved, std::size_t bodies) override {
+            if (saved.size() != bodies + 1 || saved[0] != maxLevel) {
+                return false;
+            }
+            level.assign(saved.begin() + 1, saved.end());
+            valid = false;
+            restored = true;
+            return true;
+        }
+
+     private:
+        void kick(BodyState& state, std::size_t i, double seconds) {
+            for (unsigned axis = 0; axis < state.dimensions; ++axis) {
+                state.velocity(axis)[i] += a[axis][i] * seconds;
+            }
+        }
+
+        // |a| of body i.
+        double magnitude(std::size_t i, unsigned axes) const {
+            return norm(a[0][i], a[1][i], axes == 3 ? a[2][i] : 0.0, axes);
+        }
+
+        // Finest level whose step does not exceed accuracy * |a| / |jerk|.
+        unsigned levelFor(double acceleration, double jerk, double seconds) const {
+            if (!(jerk > 0) || !(acceleration > 0)) {
+                return 0;
+            }
+            const double wanted = accuracy * acceleration / jerk;
+            const double level = std::ceil(std::log2(seconds / wanted));
+            return static_cast<unsigned>(std::max(0.0, std::min<double>(level, maxLevel)));
+        }
+
+        // Refining is always allowed. Coarsening goes one level at a time and only
+        // where the coarser step would start on one of its own boundaries.
+        unsigned nextLevel(std::size_t i, double acceleration, double jerk, double seconds,
+                           std::uint64_t now, std::uint64_t ticks) const {
+            unsigned wanted = levelFor(acceleration, jerk, seconds);
+            if (wanted >= level[i]) {
+                return wanted;
+            }
+            wanted = level[i] - 1;
+            return now % (ticks >> wanted) == 0 ? wanted : level[i];
+        }
+
+        void startSteps(std::size_t n, unsigned axes) {
+            nextTick.assign(n, 0);
+            for (unsigned axis = 0; axis < axes; ++axis) {
+                previous[axis].assign(n, 0.0);
+            }
+        }
+
+        // No earlier accelerations to difference, so the first levels use the
+        // analytic jerk of the softened kernel.
+        void initialLevels(const BodyState& state, double seconds, const JerkFunction& jerks) {
+            const std::size_t n = state.size();
+            const unsigned axes = state.dimensions;
+            startSteps(n, axes);
+            jerks(scratch[0], scratch[1], scratch[2]);
+            level.resize(n);
+            for (std::size_t i = 0; i < n; ++i) {
+                level[i] = levelFor(magnitude(i, axes),
+                                    norm(scratch[0][i], scratch[1][i],
+                                         axes == 3 ? scratch[2][i] : 0.0, axes),
+                                    seconds);
+            }
+        }
+
+        unsigned maxLevel;
+        double accuracy;
+        bool valid = false;
+        bool restored = false;  // Levels came from restore() and stand for the next step
+        Accelerations a;
+        Accelerations previous;  // Accelerations before the latest evaluation
+        Accelerations scratch;   // Full evaluations when no subset is given, and jerks
+        std::vector<unsigned> level;
+        std::vector<std::uint64_t> nextTick;  // Tick at which each body's current step ends
+        std::vector<std::uint32_t> active;
+    };
+    }  //  namespace
+
+    std::unique_ptr<Integrator> makeIntegrator(IntegratorKind kind, double tolerance,
+                                               unsigned blockLevels, double blockAccuracy) {
+        switch (kind) {
+            case IntegratorKind::Block:
+                return std::make_unique<BlockIntegrator>(blockLevels, blockAccuracy);
+            case IntegratorKind::Leapfrog: return std::make_unique<LeapfrogIntegrator>();
+            case IntegratorKind::Yoshida4: return std::make_unique<Yoshida4Integrator>();
+            case IntegratorKind::RK4: return std::make_unique<RK4Integrator>();
+            case IntegratorKind::Adaptive: return std::make_unique<AdaptiveIntegrator>(tolerance);
+            case IntegratorKind::Euler: break;
+        }
+        return std::make_unique<EulerIntegrator>();
+    }
+}  //  namespace NB
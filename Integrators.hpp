@@ -0,0 +1,105 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef INTEGRATORS_HPP
+#define INTEGRATORS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "BodyState.hpp"
+
+namespace NB {
+
+enum class IntegratorKind {
+    Euler,     // Semi-implicit Euler, first order, one force evaluation per step
+    Leapfrog,  // Kick-drift-kick leapfrog, second order, symplectic, one evaluation
+    Yoshida4,  // Yoshida's fourth-order symplectic composition, three evaluations
+    RK4,       // Classical Runge-Kutta, fourth order, four evaluations
+    Adaptive,  // Dormand-Prince 5(4) with error control and internal substeps
+    Block      // Leapfrog with a power-of-two step per body, forces only for due bodies
+};
+
+IntegratorKind integratorFromString(const std::string& name);
+std::string toString(IntegratorKind kind);
+
+// Fills ax, ay and, for a 3D state, az (resized to the body count) with the
+// accelerations at the positions currently stored in the state being integrated.
+using AccelerationFunction = std::function<void(std::vector<double>& ax,
+                                                std::vector<double>& ay,
+                                                std::vector<double>& az)>;
+// Fills ax[i], ay[i] (and az[i]) for each i in `bodies` only; the arrays already hold
+// the body count.
+using SubsetAccelerationFunction = std::function<void(const std::vector<std::uint32_t>& bodies,
+                                                      std::vector<double>& ax,
+                                                      std::vector<double>& ay,
+                                                      std::vector<double>& az)>;
+// Fills jx, jy and, for a 3D state, jz (resized to the body count) with the time
+// derivatives of the accelerations at the current positions and velocities.
+using JerkFunction = std::function<void(std::vector<double>& jx, std::vector<double>& jy,
+                                        std::vector<double>& jz)>;
+
+// What an integrator carries from one step to the next beyond the bodies, so a
+// checkpoint can restore it.
+struct IntegratorState {
+    IntegratorKind kind = IntegratorKind::Euler;
+    std::vector<double> values;  // Empty for integrators that carry nothing over
+};
+
+// Advances a BodyState in time given a way to evaluate accelerations. Updates run
+// over the state's position and velocity arrays one axis at a time, so the same
+// integrators serve 2D and 3D states.
+class Integrator {
+ public:
+    virtual ~Integrator() = default;
+    virtual void step(BodyState& state, double seconds,
+                      const AccelerationFunction& accelerations) = 0;
+    // Integrators that advance bodies on their own step sizes evaluate only the
+    // bodies that are due through `subset`, and pick their first step sizes from
+    // `jerks`; the rest just call step().
+    virtual void stepIndividually(BodyState& state, double seconds,
+                                  const AccelerationFunction& accelerations,
+                                  const SubsetAccelerationFunction& subset,
+                                  const JerkFunction& jerks) {
+        step(state, seconds, accelerations);
+    }
+    // Drops anything cached from earlier steps; call when the state is replaced.
+    virtual void reset() {}
+    // State that changes how the next step goes, such as the adaptive substep size,
+    // as doubles; empty if none. Caches that step() recomputes identically are left
+    // out. restore() takes it back for `bodies` bodies and returns false, changing
+    // nothing, if it does not fit.
+    virtual std::vector<double> save() const { return {}; }
+    virtual bool restore(const std::vector<double>& saved, std::size_t /* bodies */) {
+        return saved.empty();
+    }
+    // Force evaluations made so far, for comparing integrators at equal accuracy.
+    // Evaluations of a subset count as that fraction of a full one.
+    std::size_t evaluations() const { return static_cast<std::size_t>(mEvaluations + 0.5); }
+
+ protected:
+    // Acceleration components by axis; z stays empty for 2D states.
+    using Accelerations = std::vector<double>[3];
+    void evaluate(const AccelerationFunction& accelerations, Accelerations& a);
+    void evaluate(const SubsetAccelerationFunction& subset,
+                  const std::vector<std::uint32_t>& bodies, Accelerations& a);
+
+ private:
+    double mEvaluations = 0;
+};
+
+// `tolerance` is the relative error per step targeted by the adaptive integrator.
+// The block integrator splits a step into up to 2^blockLevels substeps and gives
+// each body the level whose step is closest to, but no longer than,
+// blockAccuracy * |a| / |da/dt|. It evaluates all bodies at once at the end of
+// every step, so a simulation can track the potential there; its levels are what
+// it saves for checkpoints.
+std::unique_ptr<Integrator> makeIntegrator(IntegratorKind kind, double tolerance = 1e-9,
+                                           unsigned blockLevels = 10,
+                                           double blockAccuracy = 0.02);
+
+}  //  namespace NB
+
+#endif  //  INTEGRATORS_HPP
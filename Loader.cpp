@@ -0,0 +1,211 @@
+//  Copyright 2024 Vy Tran
+
+#include "Loader.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "MappedFile.hpp"
+#include "Profiler.hpp"
+#include "ThreadPool.hpp"
+
+namespace NB {
+    namespace {
+    // Smaller inputs are parsed on the calling thread; starting a pool costs more
+    const std::size_t kParallelBytes = 1 << 20;
+    // Chunks per thread, so one slow chunk doesn't hold up the rest
+    const std::size_t kChunksPerThread = 4;
+
+    bool isBlank(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    const char* skipBlanks(const char* p, const char* end) {
+        while (p < end && isBlank(*p)) {
+            ++p;
+        }
+        return p;
+    }
+
+    const char* skipSpace(const char* p, const char* end) {
+        while (p < end && (isBlank(*p) || *p == '\n')) {
+            ++p;
+        }
+        return p;
+    }
+
+    const char* lineEnd(const char* p, const char* end) {
+        const void* newline = std::memchr(p, '\n', end - p);
+        return newline ? static_cast<const char*>(newline) : end;
+    }
+
+    // Parses one number at p, moving p past it. from_chars rejects the '+' that
+    // operator>> accepts, so that is skipped first.
+    template <typename T>
+    bool parseNumber(const char*& p, const char* end, T& value) {
+        if (p < end && *p == '+') {
+            ++p;
+        }
+        auto result = std::from_chars(p, end, value);
+        if (result.ec != std::errc() || (result.ptr < end && !isBlank(*result.ptr)
+                                         && *result.ptr != '\n')) {
+            return false;
+        }
+        p = result.ptr;
+        return true;
+    }
+
+    // Parses "x y vx vy mass name", or "x y z vx vy vz mass name" for a 3D state,
+    // from [p, end) into row i.
+    bool parseBody(const char* p, const char* end, BodyState& state, std::size_t i) {
+        double* planar[5] = {&state.x[i], &state.y[i], &state.vx[i], &state.vy[i],
+                             &state.mass[i]};
+        double* spatial[7] = {&state.x[i], &state.y[i], nullptr, &state.vx[i], &state.vy[i],
+                              nullptr, &state.mass[i]};
+        const bool is3D = state.dimensions == 3;
+        if (is3D) {
+            spatial[2] = &state.z[i];
+            spatial[5] = &state.vz[i];
+        }
+        double* const* columns = is3D ? spatial : planar;
+        for (int c = 0; c < (is3D ? 7 : 5); ++c) {
+            p = skipBlanks(p, end);
+            if (!parseNumber(p, end, *columns[c])) {
+                return false;
+            }
+        }
+        p = skipBlanks(p, end);
+        const char* name = p;
+        while (p < end && !isBlank(*p)) {
+            ++p;
+        }
+        if (p == name || skipBlanks(p, end) != end) {
+            return false;
+        }
+        state.names[i].assign(name, p);
+        return true;
+    }
+
+    // 3 if the body line [p, end) has a number as its sixth field, where a 2D body
+    // has its name, and 2 otherwise.
+    unsigned bodyDimensions(const char* p, const char* end) {
+        for (int field = 0; field < 5; ++field) {
+            p = skipBlanks(p, end);
+            while (p < end && !isBlank(*p)) {
+                ++p;
+            }
+        }
+        p = skipBlanks(p, end);
+        double value;
+        return parseNumber(p, end, value) ? 3 : 2;
+    }
+
+    // Lines of one chunk that hold anything but whitespace, i.e. that are bodies.
+    std::size_t countBodies(const char* p, const char* end) {
+        std::size_t bodies = 0;
+        while (p < end) {
+            const char* next = lineEnd(p, end);
+            if (skipBlanks(p, next) != next) {
+                ++bodies;
+            }
+            p = next + 1;
+        }
+        return bodies;
+    }
+    }  //  namespace
+
+    double parseUniverse(const char* begin, const char* end, BodyState& state,
+                         unsigned threads) {
+        const char* p = skipSpace(begin, end);
+        long long count = 0;
+        double radius = 0;
+        if (!parseNumber(p, end, count) || count < 0) {
+            throw std::runtime_error("Expected the number of bodies");
+        }
+        p = skipSpace(p, end);
+        if (!parseNumber(p, end, radius)) {
+            throw std::runtime_error("Expected the universe radius");
+        }
+        const std::size_t n = static_cast<std::size_t>(count);
+
+        // Chunk boundaries fall just after a newline, so no line is split
+        std::unique_ptr<ThreadPool> pool;
+        std::size_t chunks = 1;
+        if (threads != 1 && static_cast<std::size_t>(end - p) >= kParallelBytes) {
+            pool = std::make_unique<ThreadPool>(threads);
+            chunks = pool->size() * kChunksPerThread;
+        }
+        std::vector<const char*> cuts(chunks + 1, end);
+        cuts[0] = p;
+        for (std::size_t k = 1; k < chunks; ++k) {
+            const char* cut = std::max(cuts[k - 1], p + (end - p) * k / chunks);
+            cuts[k] = cut < end ? std::min(end, lineEnd(cut, end) + 1) : end;
+        }
+        auto forEachChunk = [&](const ThreadPool::RangeTask& task) {
+            if (pool) {
+                pool->parallelFor(chunks, task);
+            } else {
+                task(0, chunks);
+            }
+        };
+
+        // First pass counts each chunk's bodies, so every chunk knows its first row
+        std::vector<std::size_t> firstRow(chunks + 1, 0);
+        forEachChunk([&](std::size_t first, std::size_t last) {
+            for (std::size_t k = first; k < last; ++k) {
+                firstRow[k + 1] = countBodies(cuts[k], cuts[k + 1]);
+            }
+        });
+        for (std::size_t k = 0; k < chunks; ++k) {
+            firstRow[k + 1] += firstRow[k];
+        }
+        if (firstRow[chunks] < n) {
+            throw std::runtime_error("Expected " + std::to_string(n) + " bodies, found "
+                                     + std::to_string(firstRow[chunks]));
+        }
+
+        // The first body line decides whether the universe is 2D or 3D
+        const char* first = skipSpace(p, end);
+        state.clear();
+        state.setDimensions(n > 0 ? bodyDimensions(first, lineEnd(first, end)) : 2);
+
+        // Second pass parses in place; rows past n are trailing text and are skipped
+        state.resize(n);
+        std::vector<std::size_t> badRow(chunks, n);
+        forEachChunk([&](std::size_t first, std::size_t last) {
+            for (std::size_t k = first; k < last; ++k) {
+                std::size_t row = firstRow[k];
+                for (const char* line = cuts[k]; line < cuts[k + 1] && row < n;) {
+                    const char* next = lineEnd(line, cuts[k + 1]);
+                    if (skipBlanks(line, next) != next) {
+                        if (!parseBody(line, next, state, row)) {
+                            badRow[k] = row;
+                            break;
+                        }
+                        ++row;
+                    }
+                    line = next + 1;
+                }
+            }
+        });
+        const std::size_t bad = *std::min_element(badRow.begin(), badRow.end());
+        if (bad < n) {
+            throw std::runtime_error("Malformed body " + std::to_string(bad + 1));
+        }
+        return radius;
+    }
+
+    void loadUniverse(const std::string& path, Simulation& simulation, unsigned threads) {
+        BodyState state;
+        double radius;
+        {
+            NB_PROFILE_SCOPE(Parse);
+            MappedFile file(path);
+            radius = parseUniverse(file.data(), file.data() + file.size(), state, threads);
+        }
+        simulation.load(std::move(state), radius);
+    }
+}  //  namespace NB
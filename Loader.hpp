@@ -0,0 +1,29 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef LOADER_HPP
+#define LOADER_HPP
+
+#include <string>
+#include "BodyState.hpp"
+#include "Simulation.hpp"
+
+namespace NB {
+
+// Fast reader for universe files, for initial conditions too large for operator>>.
+// The format is the same (body count, radius, then "x y vx vy mass name" per line, or
+// "x y z vx vy vz mass name" throughout if the first body has six numbers), but the
+// file is mapped rather than streamed, the body lines are split into one chunk per
+// thread, and each chunk parses with std::from_chars straight into its rows of the
+// state arrays. As with operator>>, text after the last body is ignored.
+
+// Parses the universe in [begin, end) into `state` and returns its radius. `threads`
+// counts like Simulation::setThreads. Throws std::runtime_error on malformed input.
+double parseUniverse(const char* begin, const char* end, BodyState& state,
+                     unsigned threads = 0);
+
+// Maps the file at `path` and hands the parsed bodies to simulation.load().
+void loadUniverse(const std::string& path, Simulation& simulation, unsigned threads = 0);
+
+}  //  namespace NB
+
+#endif  //  LOADER_HPP
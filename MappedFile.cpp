@@ -0,0 +1,39 @@
+//  Copyright 2024 Vy Tran
+
+#include "MappedFile.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdexcept>
+
+namespace NB {
+    MappedFile::MappedFile(const std::string& path) : mData(nullptr), mSize(0) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open " + path);
+        }
+        struct stat info;
+        if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+            mSize = static_cast<std::size_t>(info.st_size);
+            void* mapped = ::mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            mData = mapped == MAP_FAILED ? nullptr : static_cast<const char*>(mapped);
+        }
+        ::close(fd);
+        if (!mData) {
+            throw std::runtime_error("Failed to map " + path);
+        }
+    }
+
+    MappedFile::~MappedFile() {
+        ::munmap(const_cast<char*>(mData), mSize);
+    }
+
+    const char* MappedFile::data() const {
+        return mData;
+    }
+
+    std::size_t MappedFile::size() const {
+        return mSize;
+    }
+}  //  namespace NB
@@ -0,0 +1,30 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace NB {
+
+// Read-only mapping of a whole file, unmapped when it goes out of scope. Throws
+// std::runtime_error if the file can't be opened or is empty.
+class MappedFile {
+ public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const;
+    std::size_t size() const;
+
+ private:
+    const char* mData;
+    std::size_t mSize;
+};
+
+}  //  namespace NB
+
+#endif  //  MAPPEDFILE_HPP
@@ -0,0 +1,174 @@
+//  Copyright 2024 Vy Tran
+
+#include "Options.hpp"
+#include <algorithm>
+#include <cctype>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+namespace NB {
+    namespace {
+    // Digits only, so "-1" is rejected instead of wrapping around to a huge count.
+    template <typename Count>
+    Count parseCount(const std::string& option, const std::string& value, Count low = 0,
+                     Count high = std::numeric_limits<Count>::max()) {
+        const std::string range = option + " must be a count between " + std::to_string(low)
+                                + " and " + std::to_string(high);
+        if (value.empty() || !std::all_of(value.begin(), value.end(), [](unsigned char c) {
+                return std::isdigit(c);
+            })) {
+            throw std::invalid_argument(range);
+        }
+        unsigned long long count;
+        try {
+            count = std::stoull(value);
+        } catch (const std::out_of_range&) {
+            throw std::invalid_argument(range);
+        }
+        if (count < low || count > high) {
+            throw std::invalid_argument(range);
+        }
+        return static_cast<Count>(count);
+    }
+    }  //  namespace
+
+    Options parseOptions(int argc, char* argv[]) {
+        if (argc < 3) {
+            throw std::invalid_argument("Missing T and deltaT");
+        }
+        Options options;
+        //  Threads beyond a few per core only add contention
+        const unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency()) * 4;
+        options.totalTime = std::stod(argv[1]);
+        options.deltaT = std::stod(argv[2]);
+        for (int i = 3; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--headless") {
+                options.headless = true;
+            } else if (arg == "--physics-thread") {
+                options.physicsThread = true;
+            } else if (arg == "--substeps" && i + 1 < argc) {
+                options.substeps = parseCount<unsigned>(arg, argv[++i]);
+            } else if (arg == "--backend" && i + 1 < argc) {
+                options.backend = forceBackendFromString(argv[++i]);
+            } else if (arg == "--sequential") {
+                options.sequential = true;
+            } else if (arg == "--integrator" && i + 1 < argc) {
+                options.integrator = integratorFromString(argv[++i]);
+            } else if (arg == "--tolerance" && i + 1 < argc) {
+                options.tolerance = std::stod(argv[++i]);
+            } else if (arg == "--precision" && i + 1 < argc) {
+                options.precision = precisionFromString(argv[++i]);
+            } else if (arg == "--block-levels" && i + 1 < argc) {
+                options.blockLevels = parseCount<unsigned>(arg, argv[++i], 0u, 30u);
+            } else if (arg == "--block-accuracy" && i + 1 < argc) {
+                options.blockAccuracy = std::stod(argv[++i]);
+            } else if (arg == "--threads" && i + 1 < argc) {
+                options.threads = parseCount<unsigned>(arg, argv[++i], 0u, maxThreads);
+            } else if (arg == "--theta" && i + 1 < argc) {
+                options.theta = std::stod(argv[++i]);
+            } else if (arg == "--fmm-order" && i + 1 < argc) {
+                options.fmmOrder = parseCount<unsigned>(arg, argv[++i]);
+            } else if (arg == "--pm-grid" && i + 1 < argc) {
+                options.meshGrid = parseCount<unsigned long>(arg, argv[++i]);
+            } else if (arg == "--p3m") {
+                options.p3m = true;
+            } else if (arg == "--lod" && i + 1 < argc) {
+                options.detailLimit = parseCount<unsigned long>(arg, argv[++i]);
+            } else if (arg == "--accuracy" && i + 1 < argc) {
+                options.accuracySamples = parseCount<unsigned long>(arg, argv[++i]);
+            } else if (arg == "--checkpoint" && i + 1 < argc) {
+                options.checkpointPath = argv[++i];
+            } else if (arg == "--checkpoint-every" && i + 1 < argc) {
+                options.checkpointEvery = parseCount<unsigned long>(arg, argv[++i]);
+            } else if (arg == "--input" && i + 1 < argc) {
+                options.inputPath = argv[++i];
+            } else if (arg == "--ensemble" && i + 1 < argc) {
+                options.ensemblePath = argv[++i];
+            } else if (arg == "--copies" && i + 1 < argc) {
+                options.copies = parseCount<unsigned>(arg, argv[++i]);
+            } else if (arg == "--perturb" && i + 2 < argc) {
+                options.perturbPosition = std::stod(argv[++i]);
+                options.perturbVelocity = std::stod(argv[++i]);
+            } else if (arg == "--seed" && i + 1 < argc) {
+                options.seed = parseCount<std::uint64_t>(arg, argv[++i]);
+            } else if (arg == "--output-dir" && i + 1 < argc) {
+                options.outputDir = argv[++i];
+            } else if (arg == "--resume" && i + 1 < argc) {
+                options.resumePath = argv[++i];
+            } else if (arg == "--trajectory" && i + 1 < argc) {
+                options.trajectoryPath = argv[++i];
+            } else if (arg == "--trajectory-every" && i + 1 < argc) {
+                options.trajectoryEvery = parseCount<unsigned long>(arg, argv[++i], 1ul);
+            } else if (arg == "--trajectory-format" && i + 1 < argc) {
+                options.trajectoryEncoding = trajectoryEncodingFromString(argv[++i]);
+            } else if (arg == "--softening" && i + 1 < argc) {
+                options.softening = std::stod(argv[++i]);
+            } else if (arg == "--merge-radius" && i + 1 < argc) {
+                options.mergeRadius = std::stod(argv[++i]);
+            } else if (arg == "--diagnostics" && i + 1 < argc) {
+                options.diagnosticsEvery = parseCount<unsigned long>(arg, argv[++i]);
+            } else if (arg == "--deterministic") {
+                options.deterministic = true;
+            } else if (arg == "--hash" && i + 1 < argc) {
+                options.hashEvery = parseCount<unsigned long>(arg, argv[++i]);
+            } else if (arg == "--profile") {
+                options.profile = true;
+            } else if (arg == "--profile-trace" && i + 1 < argc) {
+                options.profile = true;
+                options.profileTrace = argv[++i];
+            } else {
+                throw std::invalid_argument("Unknown option: " + arg);
+            }
+        }
+        if (options.fmmOrder < 1 || options.fmmOrder > FastMultipole::kMaxOrder) {
+            throw std::invalid_argument("--fmm-order must be between 1 and "
+                                        + std::to_string(FastMultipole::kMaxOrder));
+        }
+        if (options.meshGrid < ParticleMesh::kMinGrid || options.meshGrid > ParticleMesh::kMaxGrid
+            || (options.meshGrid & (options.meshGrid - 1)) != 0) {
+            throw std::invalid_argument("--pm-grid must be a power of two between "
+                                        + std::to_string(ParticleMesh::kMinGrid) + " and "
+                                        + std::to_string(ParticleMesh::kMaxGrid));
+        }
+        if (!options.checkpointPath.empty() && options.checkpointEvery == 0) {
+            throw std::invalid_argument("--checkpoint needs --checkpoint-every K");
+        }
+        return options;
+    }
+
+    std::string usage(const std::string& program) {
+        return "Usage: " + program + " T deltaT [--headless] [--physics-thread [--substeps K]]"
+               " [--lod K]"
+               " [--backend pairwise|simd|barnes-hut|symmetric|fmm|pm] [--sequential] [--threads N]"
+               " [--theta THETA] [--fmm-order P] [--pm-grid N [--p3m]] [--precision double|mixed]"
+               " [--integrator euler|leapfrog|yoshida4|rk4|adaptive|block] [--tolerance TOL]"
+               " [--block-levels L] [--block-accuracy ETA]"
+               " [--accuracy SAMPLES]"
+               " [--input PATH] [--checkpoint PATH --checkpoint-every K] [--resume PATH]"
+               " [--ensemble LIST] [--copies K [--perturb DX DV] [--seed S]] [--output-dir DIR]"
+               " [--trajectory PATH|- [--trajectory-every K] [--trajectory-format double|delta]]"
+               " [--softening EPS] [--merge-radius R] [--diagnostics K] [--profile] [--profile-trace PATH]"
+               " [--deterministic] [--hash K]";
+    }
+
+    void configure(Simulation& simulation, const Options& options) {
+        simulation.setForceBackend(options.backend);
+        simulation.setThreads(options.threads);
+        simulation.setDeterministic(options.deterministic);
+        simulation.setSequentialUpdate(options.sequential);
+        simulation.setTheta(options.theta);
+        simulation.setFmmOrder(options.fmmOrder);
+        simulation.setMeshGrid(options.meshGrid);
+        simulation.setMeshShortRange(options.p3m);
+        simulation.setPrecision(options.precision);
+        simulation.setTolerance(options.tolerance);
+        simulation.setBlockLevels(options.blockLevels);
+        simulation.setBlockAccuracy(options.blockAccuracy);
+        simulation.setIntegrator(options.integrator);
+        simulation.setSoftening(options.softening);
+        simulation.setMergeRadius(options.mergeRadius);
+        simulation.setTrackPotential(options.diagnosticsEvery > 0);
+    }
+}  //  namespace NB
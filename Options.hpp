@@ -0,0 +1,66 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <cstdint>
+#include <string>
+#include "ForceKernels.hpp"
+#include "Integrators.hpp"
+#include "Simulation.hpp"
+#include "Trajectory.hpp"
+
+namespace NB {
+
+// Command line of NBody: "T deltaT [options]".
+struct Options {
+    double totalTime = 0;  // Total simulation time
+    double deltaT = 0;     // Time step
+    ForceBackend backend = ForceBackend::Pairwise;
+    unsigned threads = 1;  // 0 means one thread per core
+    double theta = 0.5;    // Barnes-Hut opening angle and fmm separation ratio
+    unsigned fmmOrder = 8;  // Expansion order of the fmm backend
+    unsigned long meshGrid = 256;  // Cells per side of the pm backend's grid
+    bool p3m = false;  // Exact short-range pairs on top of the pm grid
+    bool sequential = false;  // Original in-place pairwise update, for regression comparison
+    IntegratorKind integrator = IntegratorKind::Euler;
+    Precision precision = Precision::Double;
+    double tolerance = 1e-9;  // Relative error per step of the adaptive integrator
+    unsigned blockLevels = 10;    // Finest step of the block integrator is deltaT / 2^levels
+    double blockAccuracy = 0.02;  // eta in the block integrator's dt = eta |a| / |da/dt|
+    unsigned long accuracySamples = 0;  // Bodies to check against direct summation, 0 = off
+    bool headless = false;  // Run without window or audio
+    bool physicsThread = false;  // Step on a thread of its own, decoupled from drawing
+    unsigned long detailLimit = 8;  // Sprites per screen cell before a splat; 0 = all sprites
+    unsigned substeps = 0;  // Steps per frame with a physics thread; 0 = fill the frame budget
+    std::string checkpointPath;  // Where periodic checkpoints go; empty = none
+    unsigned long checkpointEvery = 0;  // Steps between checkpoints
+    std::string inputPath;   // Universe file to map and parse in parallel instead of stdin
+    std::string resumePath;  // Checkpoint to start from instead of reading the input
+    std::string ensemblePath;  // File listing universes to run side by side; empty = none
+    unsigned copies = 0;  // Ensemble members per universe, all but the first perturbed
+    double perturbPosition = 0;  // Position noise of the copies, as a fraction of the radius
+    double perturbVelocity = 0;  // Velocity noise of the copies, as a fraction of RMS speed
+    std::uint64_t seed = 1;  // Seed of the first perturbed copy; later ones count up
+    std::string outputDir = "ensemble";  // Where ensemble final states and summary go
+    std::string trajectoryPath;  // Where to stream every Kth state; "-" = stdout, empty = off
+    unsigned long trajectoryEvery = 1;  // Steps between recorded frames
+    TrajectoryEncoding trajectoryEncoding = TrajectoryEncoding::Double;
+    double softening = 0;  // Plummer softening length in meters
+    double mergeRadius = 0;  // Bodies closer than this after a step merge; 0 = never
+    unsigned long diagnosticsEvery = 0;  // Steps between energy/momentum reports; 0 = off
+    bool deterministic = false;  // Scalar direct-summation kernels, for runs across machines
+    unsigned long hashEvery = 0;  // Steps between state hashes printed to stderr; 0 = off
+    bool profile = false;  // Print time per phase to stderr at the end
+    std::string profileTrace;  // Chrome trace-event JSON of every timed scope; empty = none
+};
+
+// Throws std::invalid_argument (or std::out_of_range for numbers) on bad input.
+Options parseOptions(int argc, char* argv[]);
+std::string usage(const std::string& program);
+// Applies the physics settings of `options` to a loaded simulation.
+void configure(Simulation& simulation, const Options& options);
+
+}  //  namespace NB
+
+#endif  //  OPTIONS_HPP
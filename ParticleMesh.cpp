@@ -0,0 +1,494 @@
+//  Copyright 2024 Vy Tran
+
+#include "ParticleMesh.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include "ForceKernels.hpp"
+
+namespace NB {
+    namespace {
+    constexpr double kSplit = 1.25;              // r_s, in cells
+    constexpr double kCutoff = 4.5 * kSplit;     // Short-range pairs end here, in cells
+    constexpr std::size_t kTableSize = 2048;     // Intervals of the erfc tables
+    constexpr double kMargin = 2.5;              // Cells between the bodies and the grid edge
+
+    // Long-range kernel erf(u / 2 r_s) / u at `u` cells, and its limit at 0.
+    double longRange(double u) {
+        return u > 0.0 ? std::erf(u / (2.0 * kSplit)) / u : 1.0 / (kSplit * std::sqrt(M_PI));
+    }
+
+    void forEachRange(ThreadPool* pool, std::size_t n, const ThreadPool::RangeTask& task) {
+        if (pool) {
+            pool->parallelFor(n, task);
+        } else {
+            task(0, n);
+        }
+    }
+
+    // In-place radix-2 FFT of `length` values, with twiddles e^(-2 pi i k / length)
+    // for k < length / 2; conjugated for the inverse, which is left unscaled.
+    void fft(std::complex<double>* data, std::size_t length,
+             const std::vector<std::complex<double>>& twiddles, bool inverse) {
+        for (std::size_t i = 1, j = 0; i < length; ++i) {
+            std::size_t bit = length >> 1;
+            for (; j & bit; bit >>= 1) {
+                j ^= bit;
+            }
+            j ^= bit;
+            if (i < j) {
+                std::swap(data[i], data[j]);
+            }
+        }
+        for (std::size_t half = 1; half < length; half <<= 1) {
+            const std::size_t step = length / (2 * half);
+            for (std::size_t start = 0; start < length; start += 2 * half) {
+                for (std::size_t k = 0; k < half; ++k) {
+                    std::complex<double> w = twiddles[k * step];
+                    if (inverse) {
+                        w = std::conj(w);
+                    }
+                    const std::complex<double> odd = w * data[start + k + half];
+                    data[start + k + half] = data[start + k] - odd;
+                    data[start + k] += odd;
+                }
+            }
+        }
+    }
+    }  //  namespace
+
+    ParticleMesh::ParticleMesh(std::size_t grid, bool shortRange)
+    : mGrid(kMinGrid), mShortRange(shortRange), mSoftening(0), spacing(1), origin{},
+      padded(0), greensDimensions(0), greensGrid(0), selfPotential{}, bins(0), binSize(1) {
+        setGrid(grid);
+        forceTable.resize(kTableSize + 1);
+        potentialTable.resize(kTableSize + 1);
+        for (std::size_t k = 0; k <= kTableSize; ++k) {
+            const double u = kCutoff * k / kTableSize;
+            const double x = u / (2.0 * kSplit);
+            potentialTable[k] = std::erfc(x);
+            forceTable[k] = std::erfc(x) + u / (kSplit * std::sqrt(M_PI)) * std::exp(-x * x);
+        }
+    }
+
+    void ParticleMesh::setGrid(std::size_t grid) {
+        if (grid < kMinGrid || grid > kMaxGrid || (grid & (grid - 1)) != 0) {
+            throw std::invalid_argument("Particle-mesh grid must be a power of two between "
+                                        + std::to_string(kMinGrid) + " and "
+                                        + std::to_string(kMaxGrid));
+        }
+        mGrid = grid;
+    }
+
+    std::size_t ParticleMesh::grid() const {
+        return mGrid;
+    }
+
+    void ParticleMesh::setShortRange(bool shortRange) {
+        mShortRange = shortRange;
+    }
+
+    bool ParticleMesh::shortRange() const {
+        return mShortRange;
+    }
+
+    void ParticleMesh::setSoftening(double softening) {
+        mSoftening = softening;
+    }
+
+    double ParticleMesh::softening() const {
+        return mSoftening;
+    }
+
+    double ParticleMesh::cellSize() const {
+        return spacing;
+    }
+
+    void ParticleMesh::shortRangeFactors(double u, double& force, double& potential) const {
+        const double position = u * (kTableSize / kCutoff);
+        const std::size_t k = std::min(static_cast<std::size_t>(position), kTableSize - 1);
+        const double fraction = position - k;
+        force = forceTable[k] + fraction * (forceTable[k + 1] - forceTable[k]);
+        potential = potentialTable[k] + fraction * (potentialTable[k + 1] - potentialTable[k]);
+    }
+
+    template <int Dim>
+    void ParticleMesh::transform(bool inverse, bool prune, ThreadPool* pool) {
+        std::size_t lines = 1;
+        for (int axis = 1; axis < Dim; ++axis) {
+            lines *= padded;
+        }
+        for (int pass = 0; pass < Dim; ++pass) {
+            //  Forward runs the axes in order and inverse in reverse, so along `axis`
+            //  the later axes are still untransformed: the padding is zero there going
+            //  forward, and going back only their first half is ever read
+            const int axis = inverse ? Dim - 1 - pass : pass;
+            std::size_t stride = 1;
+            for (int a = 0; a < axis; ++a) {
+                stride *= padded;
+            }
+            forEachRange(pool, lines, [&](std::size_t begin, std::size_t end) {
+                std::vector<std::complex<double>> line(padded);
+                for (std::size_t l = begin; l < end; ++l) {
+                    const std::size_t lower = l % stride;
+                    const std::size_t upper = l / stride;
+                    if (prune && Dim - 1 > axis) {
+                        //  upper holds the indices of the later axes, lowest first
+                        bool empty = false;
+                        for (std::size_t rest = upper; rest > 0 && !empty; rest /= padded) {
+                            empty = rest % padded >= mGrid;
+                        }
+                        if (empty) {
+                            continue;
+                        }
+                    }
+                    std::complex<double>* first = &mesh[lower + upper * stride * padded];
+                    for (std::size_t k = 0; k < padded; ++k) {
+                        line[k] = first[k * stride];
+                    }
+                    fft(line.data(), padded, twiddles, inverse);
+                    for (std::size_t k = 0; k < padded; ++k) {
+                        first[k * stride] = line[k];
+                    }
+                }
+            });
+        }
+    }
+
+    template <int Dim>
+    void ParticleMesh::prepare() {
+        padded = 2 * mGrid;
+        std::size_t nodes = 1;
+        for (int axis = 0; axis < Dim; ++axis) {
+            nodes *= padded;
+        }
+        mesh.resize(nodes);
+        if (greensDimensions == Dim && greensGrid == mGrid) {
+            return;
+        }
+        twiddles.resize(padded / 2);
+        for (std::size_t k = 0; k < padded / 2; ++k) {
+            twiddles[k] = std::polar(1.0, -2.0 * M_PI * k / padded);
+        }
+        //  The kernel at every offset the padded grid can represent, negative
+        //  offsets wrapped to the upper half
+        for (std::size_t index = 0; index < nodes; ++index) {
+            double u2 = 0.0;
+            std::size_t rest = index;
+            for (int axis = 0; axis < Dim; ++axis) {
+                const std::size_t k = rest % padded;
+                rest /= padded;
+                const double offset = static_cast<double>(k)
+                                      - (k < mGrid ? 0.0 : static_cast<double>(padded));
+                u2 += offset * offset;
+            }
+            mesh[index] = longRange(std::sqrt(u2));
+        }
+        transform<Dim>(false, false, nullptr);
+        //  Assignment and interpolation each smooth by the cloud-in-cell window
+        //  sinc^2(pi f) along every axis; dividing it out twice sharpens the force at
+        //  a few cells, and the erf kernel has already damped the high frequencies
+        greens.resize(nodes);
+        for (std::size_t index = 0; index < nodes; ++index) {
+            double window = 1.0;
+            std::size_t rest = index;
+            for (int axis = 0; axis < Dim; ++axis) {
+                const std::size_t k = rest % padded;
+                rest /= padded;
+                const double x = M_PI * static_cast<double>(std::min(k, padded - k)) / padded;
+                const double sinc = x > 0.0 ? std::sin(x) / x : 1.0;
+                window *= sinc * sinc * sinc * sinc;
+            }
+            greens[index] = mesh[index].real() / window;
+        }
+        for (int a = 0; a < 2; ++a) {
+            for (int b = 0; b < 2; ++b) {
+                for (int c = 0; c < 2; ++c) {
+                    selfPotential[a][b][c] = longRange(std::sqrt(a + b + c));
+                }
+            }
+        }
+        greensDimensions = Dim;
+        greensGrid = mGrid;
+    }
+
+    template <int Dim>
+    void ParticleMesh::deposit(const BodyState& state) {
+        double low[Dim], high[Dim];
+        for (int axis = 0; axis < Dim; ++axis) {
+            const double* position = state.position(axis).data();
+            auto bounds = std::minmax_element(position, position + state.size());
+            low[axis] = *bounds.first;
+            high[axis] = *bounds.second;
+        }
+        double extent = 0.0;
+        for (int axis = 0; axis < Dim; ++axis) {
+            extent = std::max(extent, high[axis] - low[axis]);
+        }
+        //  Bodies stay kMargin cells inside the grid, so the four-point differences
+        //  at any node a body touches stay on it
+        spacing = extent > 0.0 ? extent / (mGrid - 2.0 * kMargin - 1.0) : 1.0;
+        for (int axis = 0; axis < Dim; ++axis) {
+            origin[axis] = low[axis] - kMargin * spacing;
+        }
+
+        std::fill(mesh.begin(), mesh.end(), std::complex<double>());
+        for (std::size_t i = 0; i < state.size(); ++i) {
+            std::size_t base = 0, stride = 1;
+            double weight[Dim][2];
+            for (int axis = 0; axis < Dim; ++axis) {
+                const double u = (state.position(axis)[i] - origin[axis]) / spacing;
+                const std::size_t node = static_cast<std::size_t>(u);
+                const double fraction = u - node;
+                weight[axis][0] = 1.0 - fraction;
+                weight[axis][1] = fraction;
+                base += node * stride;
+                stride *= padded;
+            }
+            for (int corner = 0; corner < (1 << Dim); ++corner) {
+                double w = state.mass[i];
+                std::size_t index = base;
+                std::size_t axisStride = 1;
+                for (int axis = 0; axis < Dim; ++axis) {
+                    const int side = (corner >> axis) & 1;
+                    w *= weight[axis][side];
+                    index += side * axisStride;
+                    axisStride *= padded;
+                }
+                mesh[index] += w;
+            }
+        }
+    }
+
+    template <int Dim>
+    void ParticleMesh::interpolate(const BodyState& state, std::size_t begin, std::size_t end,
+                                   double* ax, double* ay, double* az, double* potential) const {
+        //  The inverse transform is unscaled
+        double norm = 1.0;
+        for (int axis = 0; axis < Dim; ++axis) {
+            norm /= padded;
+        }
+        const double accelerationScale = G * norm / (spacing * spacing);
+        const double potentialScale = -G * norm / spacing;
+        std::size_t strides[Dim];
+        strides[0] = 1;
+        for (int axis = 1; axis < Dim; ++axis) {
+            strides[axis] = strides[axis - 1] * padded;
+        }
+        for (std::size_t i = begin; i < end; ++i) {
+            std::size_t base = 0;
+            double weight[Dim][2];
+            for (int axis = 0; axis < Dim; ++axis) {
+                const double u = (state.position(axis)[i] - origin[axis]) / spacing;
+                const std::size_t node = static_cast<std::size_t>(u);
+                const double fraction = u - node;
+                weight[axis][0] = 1.0 - fraction;
+                weight[axis][1] = fraction;
+                base += node * strides[axis];
+            }
+            double gradient[Dim] = {};
+            double phi = 0.0;
+            double self = 0.0;
+            for (int corner = 0; corner < (1 << Dim); ++corner) {
+                double w = 1.0;
+                std::size_t index = base;
+                for (int axis = 0; axis < Dim; ++axis) {
+                    const int side = (corner >> axis) & 1;
+                    w *= weight[axis][side];
+                    index += side * strides[axis];
+                }
+                const std::complex<double>* node = &mesh[index];
+                phi += w * node->real();
+                for (int axis = 0; axis < Dim; ++axis) {
+                    const std::ptrdiff_t s = strides[axis];
+                    gradient[axis] += w * (8.0 * (node[s].real() - node[-s].real())
+                                           - (node[2 * s].real() - node[-2 * s].real()))
+                                    / 12.0;
+                }
+                if (potential) {
+                    //  The body's own cloud, seen from this node
+                    for (int other = 0; other < (1 << Dim); ++other) {
+                        double v = w;
+                        int offset[3] = {};
+                        for (int axis = 0; axis < Dim; ++axis) {
+                            const int side = (other >> axis) & 1;
+                            v *= weight[axis][side];
+                            offset[axis] = side != ((corner >> axis) & 1);
+                        }
+                        self += v * selfPotential[offset[0]][offset[1]][offset[2]];
+                    }
+                }
+            }
+            ax[i] = accelerationScale * gradient[0];
+            ay[i] = accelerationScale * gradient[1];
+            if constexpr (Dim == 3) {
+                az[i] = accelerationScale * gradient[2];
+            }
+            if (potential) {
+                potential[i] = potentialScale * phi + G / spacing * state.mass[i] * self;
+            }
+        }
+    }
+
+    template <int Dim>
+    void ParticleMesh::shortRangeBins(const BodyState& state) {
+        //  Bodies lie within mGrid - kMargin - 1 cells of the origin
+        const double span = mGrid - kMargin - 1.0;
+        bins = std::max<std::size_t>(1, static_cast<std::size_t>(span / kCutoff));
+        binSize = span / bins * spacing;
+        std::size_t total = 1;
+        for (int axis = 0; axis < Dim; ++axis) {
+            total *= bins;
+        }
+        std::vector<std::size_t> binOf(state.size());
+        binStart.assign(total + 1, 0);
+        for (std::size_t i = 0; i < state.size(); ++i) {
+            std::size_t bin = 0;
+            for (int axis = Dim - 1; axis >= 0; --axis) {
+                const double u = (state.position(axis)[i] - origin[axis]) / binSize;
+                bin = bin * bins + std::min(bins - 1, static_cast<std::size_t>(u));
+            }
+            binOf[i] = bin;
+            ++binStart[bin + 1];
+        }
+        for (std::size_t bin = 0; bin < total; ++bin) {
+            binStart[bin + 1] += binStart[bin];
+        }
+        std::vector<std::size_t> next(binStart.begin(), binStart.end() - 1);
+        binnedX.resize(state.size());
+        binnedY.resize(state.size());
+        binnedZ.resize(Dim == 3 ? state.size() : 0);
+        binnedMass.resize(state.size());
+        binned.resize(state.size());
+        for (std::size_t i = 0; i < state.size(); ++i) {
+            const std::size_t slot = next[binOf[i]]++;
+            binned[slot] = i;
+            binnedX[slot] = state.x[i];
+            binnedY[slot] = state.y[i];
+            if constexpr (Dim == 3) {
+                binnedZ[slot] = state.z[i];
+            }
+            binnedMass[slot] = state.mass[i];
+        }
+    }
+
+    template <int Dim>
+    void ParticleMesh::shortRangeForces(const BodyState& state, std::size_t begin,
+                                        std::size_t end, double* ax, double* ay, double* az,
+                                        double* potential) const {
+        const double cutoff2 = kCutoff * kCutoff * spacing * spacing;
+        const double softening2 = mSoftening * mSoftening;
+        const double* partner[3] = {binnedX.data(), binnedY.data(), binnedZ.data()};
+        for (std::size_t i = begin; i < end; ++i) {
+            std::size_t low[3] = {}, high[3] = {};
+            double target[Dim];
+            for (int axis = 0; axis < Dim; ++axis) {
+                target[axis] = state.position(axis)[i];
+                const std::size_t bin = std::min(bins - 1, static_cast<std::size_t>(
+                    (target[axis] - origin[axis]) / binSize));
+                low[axis] = bin > 0 ? bin - 1 : 0;
+                high[axis] = std::min(bins - 1, bin + 1);
+            }
+            double sum[Dim] = {};
+            double phi = 0.0;
+            for (std::size_t bz = low[2]; bz <= high[2]; ++bz) {
+                for (std::size_t by = low[1]; by <= high[1]; ++by) {
+                    const std::size_t row = (bz * bins + by) * bins;
+                    //  The bins of one row are consecutive in the binned arrays
+                    const std::size_t first = binStart[row + low[0]];
+                    const std::size_t last = binStart[row + high[0] + 1];
+                    for (std::size_t k = first; k < last; ++k) {
+                        if (binned[k] == i) {
+                            continue;
+                        }
+                        double d[Dim];
+                        double r2 = 0.0;
+                        for (int axis = 0; axis < Dim; ++axis) {
+                            d[axis] = partner[axis][k] - target[axis];
+                            r2 += d[axis] * d[axis];
+                        }
+                        if (r2 >= cutoff2 || r2 + softening2 == 0.0) {
+                            continue;
+                        }
+                        double force, part;
+                        shortRangeFactors(std::sqrt(r2) / spacing, force, part);
+                        const double invR = 1.0 / std::sqrt(r2 + softening2);
+                        const double s = binnedMass[k] * force * invR * invR * invR;
+                        for (int axis = 0; axis < Dim; ++axis) {
+                            sum[axis] += s * d[axis];
+                        }
+                        phi += binnedMass[k] * part * invR;
+                    }
+                }
+            }
+            ax[i] += G * sum[0];
+            ay[i] += G * sum[1];
+            if constexpr (Dim == 3) {
+                az[i] += G * sum[2];
+            }
+            if (potential) {
+                potential[i] -= G * phi;
+            }
+        }
+    }
+
+    template <int Dim>
+    void ParticleMesh::compute(const BodyState& state, double* ax, double* ay, double* az,
+                               double* potential, ThreadPool* pool) {
+        prepare<Dim>();
+        deposit<Dim>(state);
+        transform<Dim>(false, true, pool);
+        forEachRange(pool, mesh.size(), [&](std::size_t begin, std::size_t end) {
+            for (std::size_t index = begin; index < end; ++index) {
+                mesh[index] *= greens[index];
+            }
+        });
+        transform<Dim>(true, true, pool);
+        if (mShortRange) {
+            shortRangeBins<Dim>(state);
+        }
+        forEachRange(pool, state.size(), [&](std::size_t begin, std::size_t end) {
+            interpolate<Dim>(state, begin, end, ax, ay, az, potential);
+            if (mShortRange) {
+                shortRangeForces<Dim>(state, begin, end, ax, ay, az, potential);
+            }
+        });
+    }
+
+    void ParticleMesh::computeAccelerations(const BodyState& state, double* ax, double* ay,
+                                            double* az, double* potential, ThreadPool* pool) {
+        if (state.size() == 0) {
+            return;
+        }
+        if (state.dimensions == 3) {
+            compute<3>(state, ax, ay, az, potential, pool);
+        } else {
+            compute<2>(state, ax, ay, az, potential, pool);
+        }
+    }
+
+    double ParticleMesh::maxRelativeError(const BodyState& state, std::size_t samples,
+                                          ThreadPool* pool) {
+        const std::size_t n = state.size();
+        samples = std::min(samples, n);
+        const bool is3D = state.dimensions == 3;
+        std::vector<double> meshX(n), meshY(n), meshZ(is3D ? n : 0);
+        std::vector<double> directX(n), directY(n), directZ(is3D ? n : 0);
+        computeAccelerations(state, meshX.data(), meshY.data(), meshZ.data(), nullptr, pool);
+        double maxError = 0.0;
+        for (std::size_t k = 0; k < samples; ++k) {
+            std::size_t i = k * n / samples;
+            NB::computeAccelerations(state, i, i + 1, directX.data(), directY.data(),
+                                     directZ.data(), SimdLevel::Scalar, mSoftening);
+            double dz = is3D ? meshZ[i] - directZ[i] : 0.0;
+            double reference = std::hypot(directX[i], directY[i], is3D ? directZ[i] : 0.0);
+            if (reference > 0.0) {
+                maxError = std::max(maxError, std::hypot(meshX[i] - directX[i],
+                                                         meshY[i] - directY[i], dz)
+                                              / reference);
+            }
+        }
+        return maxError;
+    }
+}  //  namespace NB
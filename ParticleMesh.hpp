@@ -0,0 +1,96 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef PARTICLEMESH_HPP
+#define PARTICLEMESH_HPP
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+#include "BodyState.hpp"
+#include "ThreadPool.hpp"
+
+namespace NB {
+
+// Particle-mesh gravity on a square (cubic in 3D) grid of grid() cells per side,
+// fitted to the bodies' bounding box every pass. Masses are assigned to the grid
+// nodes cloud-in-cell, the potential is the convolution of that density with the
+// 1/r kernel done by FFT on a grid padded to twice the size (so the universe is
+// isolated rather than periodic), and the accelerations are four-point
+// differences of the potential interpolated back to the bodies cloud-in-cell.
+//
+// The mesh kernel is the long-range part erf(r / 2 r_s) / r of an Ewald split with
+// r_s = 1.25 cells, so it is smooth on the grid. Alone, forces are softened over
+// a few cells. With the short-range correction on (P3M), every pair closer than
+// 4.5 r_s also gets the remaining erfc part directly, from a chaining mesh of
+// cells at least that wide, which restores the exact force at short range.
+//
+// Masses are deposited serially and the FFT lines, interpolation and pair sums
+// are split over the thread pool with each output written by one thread, so the
+// result does not depend on the number of threads.
+class ParticleMesh {
+ public:
+    static constexpr std::size_t kMinGrid = 16;
+    static constexpr std::size_t kMaxGrid = 4096;
+
+    explicit ParticleMesh(std::size_t grid = 256, bool shortRange = false);
+    // Cells per side; throws std::invalid_argument unless a power of two within
+    // kMinGrid..kMaxGrid. The padded grid takes 16 (2 grid)^d bytes.
+    void setGrid(std::size_t grid);
+    std::size_t grid() const;
+    void setShortRange(bool shortRange);
+    bool shortRange() const;
+    // Plummer softening length of the short-range pair term.
+    void setSoftening(double softening);
+    double softening() const;
+    // Accelerations of every body into ax, ay and az (3D only), and potentials if
+    // `potential` is given. `pool`, if given, spreads the work over its threads.
+    void computeAccelerations(const BodyState& state, double* ax, double* ay, double* az,
+                              double* potential = nullptr, ThreadPool* pool = nullptr);
+    // Largest |a_mesh - a_direct| / |a_direct| over `samples` evenly spaced bodies.
+    double maxRelativeError(const BodyState& state, std::size_t samples,
+                            ThreadPool* pool = nullptr);
+    // Side of a grid cell in meters, as of the latest pass.
+    double cellSize() const;
+
+ private:
+    template <int Dim> void prepare();
+    template <int Dim> void deposit(const BodyState& state);
+    // FFT along every axis; `prune` skips the lines that are all padding.
+    template <int Dim> void transform(bool inverse, bool prune, ThreadPool* pool);
+    template <int Dim> void interpolate(const BodyState& state, std::size_t begin,
+                                        std::size_t end, double* ax, double* ay, double* az,
+                                        double* potential) const;
+    template <int Dim> void shortRangeBins(const BodyState& state);
+    template <int Dim> void shortRangeForces(const BodyState& state, std::size_t begin,
+                                             std::size_t end, double* ax, double* ay,
+                                             double* az, double* potential) const;
+    template <int Dim> void compute(const BodyState& state, double* ax, double* ay,
+                                    double* az, double* potential, ThreadPool* pool);
+    // erfc part of the force and potential at `u` cells, interpolated from tables.
+    void shortRangeFactors(double u, double& force, double& potential) const;
+
+    std::size_t mGrid;
+    bool mShortRange;
+    double mSoftening;
+    double spacing;            // Cell side in meters
+    double origin[3];          // Position of grid node 0 along each axis
+    std::size_t padded;        // 2 grid, the FFT length along each axis
+    unsigned greensDimensions; // Dimensions the kernel below was transformed for, 0 = none
+    std::size_t greensGrid;    // Grid it was transformed for
+    std::vector<double> greens;  // Transform of the kernel on the padded grid, real by symmetry
+    std::vector<std::complex<double>> mesh;  // Density, then potential, on the padded grid
+    std::vector<std::complex<double>> twiddles;  // e^(-2 pi i k / padded), k < padded / 2
+    double selfPotential[2][2][2];  // Kernel between nodes offset by 0 or 1 along each axis
+    std::vector<double> forceTable, potentialTable;  // erfc parts by distance in cells
+    // Chaining mesh of the short-range sum: bodies sorted by bin, bins at least the
+    // cutoff wide so a body's partners lie in the 3^d bins around its own.
+    std::size_t bins;             // Bins per side
+    double binSize;               // In meters
+    std::vector<std::size_t> binStart;  // First entry of each bin in `binned`, plus the end
+    std::vector<std::size_t> binned;    // Body indices in bin order
+    std::vector<double> binnedX, binnedY, binnedZ, binnedMass;  // Their bodies, copied
+};
+
+}  //  namespace NB
+
+#endif  //  PARTICLEMESH_HPP
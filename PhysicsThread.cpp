@@ -0,0 +1,111 @@
+//  Copyright 2024 Vy Tran
+
+#include "PhysicsThread.hpp"
+#include <chrono>
+#include <utility>
+
+namespace NB {
+    PhysicsThread::PhysicsThread(Simulation& simulation, double deltaT, double totalTime,
+                                 unsigned substepsPerFrame, const RunPosition& start,
+                                 StepHook afterStep)
+    : simulation(simulation),
+      deltaT(deltaT),
+      totalTime(totalTime),
+      substepsPerFrame(substepsPerFrame),
+      origin(start),
+      afterStep(std::move(afterStep)),
+      stopping(false),
+      done(false),
+      framesPublished(0),
+      framesRendered(0) {
+        // The renderer has the initial state before the thread starts
+        publish(origin.elapsedTime, origin.steps);
+        latest();
+    }
+
+    PhysicsThread::~PhysicsThread() {
+        stop();
+    }
+
+    void PhysicsThread::start() {
+        if (!thread.joinable()) {
+            thread = std::thread(&PhysicsThread::run, this);
+        }
+    }
+
+    void PhysicsThread::stop() {
+        stopping = true;
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    bool PhysicsThread::finished() const {
+        return done;
+    }
+
+    void PhysicsThread::rethrowFailure() const {
+        if (done && failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+
+    const Snapshot& PhysicsThread::latest() {
+        if (snapshots.update()) {
+            ++framesRendered;
+        }
+        return snapshots.front();
+    }
+
+    void PhysicsThread::publish(double elapsedTime, std::uint64_t steps) {
+        Snapshot& snapshot = snapshots.back();
+        const BodyState& state = simulation.bodies();
+        snapshot.x.assign(state.x.begin(), state.x.end());
+        snapshot.y.assign(state.y.begin(), state.y.end());
+        if (snapshot.layout != simulation.layoutVersion()) {
+            snapshot.names = state.names;
+            snapshot.layout = simulation.layoutVersion();
+        }
+        snapshot.elapsedTime = elapsedTime;
+        snapshot.steps = steps;
+        snapshots.publish();
+        ++framesPublished;
+    }
+
+    void PhysicsThread::run() {
+        using Clock = std::chrono::steady_clock;
+        const auto budget = std::chrono::duration<double>(kFrameBudget);
+        double elapsedTime = origin.elapsedTime;
+        std::uint64_t steps = origin.steps;
+        try {
+            while (!stopping && elapsedTime < totalTime) {
+                if (substepsPerFrame > 0) {
+                    // Lockstep: never get more than one frame ahead of the renderer
+                    while (!stopping && framesPublished > framesRendered) {
+                        std::this_thread::yield();
+                    }
+                }
+                const auto frameStart = Clock::now();
+                unsigned substeps = 0;
+                while (!stopping && elapsedTime < totalTime) {
+                    simulation.step(deltaT);
+                    elapsedTime += deltaT;
+                    ++steps;
+                    ++substeps;
+                    if (afterStep) {
+                        afterStep(simulation, {steps, elapsedTime});
+                    }
+                    if (substepsPerFrame > 0 ? substeps == substepsPerFrame
+                                             : Clock::now() - frameStart >= budget) {
+                        break;
+                    }
+                }
+                publish(elapsedTime, steps);
+            }
+        } catch (...) {
+            // Hand it to the render thread instead of terminating
+            failure = std::current_exception();
+        }
+        done = true;
+    }
+}  //  namespace NB
@@ -0,0 +1,82 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef PHYSICSTHREAD_HPP
+#define PHYSICSTHREAD_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Checkpoint.hpp"
+#include "Simulation.hpp"
+#include "TripleBuffer.hpp"
+
+namespace NB {
+
+// What the render thread needs of one physics state.
+struct Snapshot {
+    std::vector<double> x, y;  // Body positions, projected onto the xy plane in 3D
+    std::vector<std::string> names;  // Body names, copied only when the layout changes
+    std::uint64_t layout = ~std::uint64_t(0);  // Simulation::layoutVersion() of `names`
+    double elapsedTime = 0;    // Simulated seconds at this state
+    std::uint64_t steps = 0;   // Steps taken to get here
+};
+
+// Steps a simulation on a thread of its own and publishes position snapshots
+// to the render thread through a triple buffer, so drawing never waits on
+// physics and physics only waits on drawing when asked to stay in lockstep.
+class PhysicsThread {
+ public:
+    using StepHook = std::function<void(const Simulation&, const RunPosition&)>;
+
+    // Frame budget used when no fixed substep count is given: 60 FPS.
+    static constexpr double kFrameBudget = 1.0 / 60.0;
+
+    // With substepsPerFrame > 0 the thread runs that many steps per rendered
+    // frame, at most one frame ahead of the renderer. With 0 it runs flat out
+    // and publishes whatever it got through every kFrameBudget seconds.
+    // A resumed run starts from `start`; `afterStep`, if set, runs on the
+    // physics thread after every step, e.g. to checkpoint or record.
+    PhysicsThread(Simulation& simulation, double deltaT, double totalTime,
+                  unsigned substepsPerFrame, const RunPosition& start = RunPosition(),
+                  StepHook afterStep = StepHook());
+    ~PhysicsThread();
+    PhysicsThread(const PhysicsThread&) = delete;
+    PhysicsThread& operator=(const PhysicsThread&) = delete;
+
+    void start();
+    // Asks the thread to stop after its current step and joins it.
+    void stop();
+    // True once totalTime has been reached and the final state published, or once
+    // a step or the afterStep hook has thrown.
+    bool finished() const;
+    // After finished(): rethrows whatever stopped the thread early, if anything.
+    void rethrowFailure() const;
+    // Render side, once per frame: newest published snapshot.
+    const Snapshot& latest();
+
+ private:
+    void run();
+    void publish(double elapsedTime, std::uint64_t steps);
+
+    Simulation& simulation;
+    double deltaT;
+    double totalTime;
+    unsigned substepsPerFrame;
+    RunPosition origin;
+    StepHook afterStep;
+    TripleBuffer<Snapshot> snapshots;
+    std::atomic<bool> stopping;
+    std::atomic<bool> done;
+    std::atomic<std::uint64_t> framesPublished;
+    std::atomic<std::uint64_t> framesRendered;
+    std::exception_ptr failure;  // Written before `done` is set
+    std::thread thread;
+};
+
+}  //  namespace NB
+
+#endif  //  PHYSICSTHREAD_HPP
@@ -0,0 +1,155 @@
+//  Copyright 2024 Vy Tran
+
+#include "Profiler.hpp"
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace NB {
+    namespace {
+    constexpr std::size_t kPhases = static_cast<std::size_t>(Phase::Count);
+    // Caps trace memory at a few hundred MB for very long runs
+    constexpr std::size_t kMaxEventsPerThread = 1 << 22;
+
+    struct Event {
+        Phase phase;
+        Profiler::Clock::time_point start;
+        Profiler::Clock::duration length;
+    };
+
+    // Written only by its own thread; atomics let summary() read a live run safely
+    struct ThreadRecord {
+        unsigned id = 0;
+        std::atomic<std::uint64_t> calls[kPhases] = {};
+        std::atomic<std::uint64_t> nanoseconds[kPhases] = {};
+        std::vector<Event> events;
+    };
+
+    std::mutex registryMutex;
+    // Records outlive their threads so a summary still sees finished workers
+    std::vector<std::unique_ptr<ThreadRecord>> registry;
+    std::atomic<bool> tracing(false);
+    Profiler::Clock::time_point origin = Profiler::Clock::now();
+    thread_local ThreadRecord* current = nullptr;
+
+    ThreadRecord& threadRecord() {
+        if (!current) {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            registry.push_back(std::make_unique<ThreadRecord>());
+            registry.back()->id = registry.size();
+            current = registry.back().get();
+        }
+        return *current;
+    }
+    }  //  namespace
+
+    std::atomic<bool> Profiler::active(false);
+
+    const char* toString(Phase phase) {
+        switch (phase) {
+            case Phase::Parse: return "parse";
+            case Phase::Step: return "step";
+            case Phase::Forces: return "forces";
+            case Phase::Draw: return "draw";
+            case Phase::DrawBackground: return "draw background";
+            case Phase::DrawBodies: return "draw bodies";
+            case Phase::DrawBody: return "draw body";
+            case Phase::Present: return "present";
+            case Phase::Title: return "title";
+            case Phase::Output: return "output";
+            case Phase::Checkpoint: return "checkpoint";
+            case Phase::Trajectory: return "trajectory";
+            case Phase::Count: break;
+        }
+        return "unknown";
+    }
+
+    void Profiler::enable(bool trace) {
+        tracing = trace;
+        origin = Clock::now();
+        active = true;
+    }
+
+    void Profiler::disable() {
+        active = false;
+    }
+
+    void Profiler::record(Phase phase, Clock::time_point start, Clock::time_point end) {
+        ThreadRecord& record = threadRecord();
+        const std::size_t index = static_cast<std::size_t>(phase);
+        const auto length = end - start;
+        record.calls[index].fetch_add(1, std::memory_order_relaxed);
+        record.nanoseconds[index].fetch_add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(length).count(),
+            std::memory_order_relaxed);
+        if (tracing.load(std::memory_order_relaxed) && record.events.size() < kMaxEventsPerThread) {
+            record.events.push_back(Event{phase, start, length});
+        }
+    }
+
+    void Profiler::summary(std::ostream& out) {
+        std::uint64_t calls[kPhases] = {};
+        std::uint64_t nanoseconds[kPhases] = {};
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            for (const auto& record : registry) {
+                for (std::size_t p = 0; p < kPhases; ++p) {
+                    calls[p] += record->calls[p].load(std::memory_order_relaxed);
+                    nanoseconds[p] += record->nanoseconds[p].load(std::memory_order_relaxed);
+                }
+            }
+        }
+        const double wall = std::chrono::duration<double>(Clock::now() - origin).count();
+        out << "Profile over " << std::fixed << std::setprecision(3) << wall << " s"
+            << " (phases nest, so shares add up to more than 100%)" << std::endl
+            << std::left << std::setw(18) << "phase" << std::right << std::setw(10) << "calls"
+            << std::setw(14) << "total ms" << std::setw(14) << "mean us" << std::setw(10)
+            << "share" << std::endl;
+        for (std::size_t p = 0; p < kPhases; ++p) {
+            if (calls[p] == 0) {
+                continue;
+            }
+            const double milliseconds = nanoseconds[p] / 1e6;
+            out << std::left << std::setw(18) << toString(static_cast<Phase>(p)) << std::right
+                << std::setw(10) << calls[p]
+                << std::setw(14) << std::setprecision(3) << milliseconds
+                << std::setw(14) << nanoseconds[p] / 1e3 / calls[p]
+                << std::setw(9) << std::setprecision(1) << 100 * milliseconds / 1e3 / wall << "%"
+                << std::endl;
+        }
+        out << std::defaultfloat << std::setprecision(6);
+    }
+
+    void Profiler::writeTrace(std::ostream& out) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        out << "{\"traceEvents\": [";
+        bool first = true;
+        for (const auto& record : registry) {
+            for (const Event& event : record->events) {
+                out << (first ? "\n" : ",\n") << std::fixed << std::setprecision(3)
+                    << "{\"name\": \"" << toString(event.phase) << "\", \"ph\": \"X\""
+                    << ", \"ts\": "
+                    << std::chrono::duration<double, std::micro>(event.start - origin).count()
+                    << ", \"dur\": "
+                    << std::chrono::duration<double, std::micro>(event.length).count()
+                    << ", \"pid\": 1, \"tid\": " << record->id << "}";
+                first = false;
+            }
+        }
+        out << "\n], \"displayTimeUnit\": \"ms\"}" << std::endl;
+        out << std::defaultfloat << std::setprecision(6);
+    }
+
+    void Profiler::reset() {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (const auto& record : registry) {
+            for (std::size_t p = 0; p < kPhases; ++p) {
+                record->calls[p] = 0;
+                record->nanoseconds[p] = 0;
+            }
+            record->events.clear();
+        }
+        origin = Clock::now();
+    }
+}  //  namespace NB
@@ -0,0 +1,83 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+namespace NB {
+
+// Parts of a run that are timed. Phases nest: Forces is part of Step, and
+// DrawBackground and DrawBodies are part of Draw.
+enum class Phase {
+    Parse, Step, Forces, Draw, DrawBackground, DrawBodies, DrawBody, Present, Title,
+    Output, Checkpoint, Trajectory, Count
+};
+
+const char* toString(Phase phase);
+
+// Per-thread call counts and total time per phase, plus an optional list of
+// individual events for a Chrome trace. Recording is off until enable() is
+// called; while off, a timer costs one relaxed atomic load. Building with
+// -DNB_NO_PROFILE removes the timers altogether.
+class Profiler {
+ public:
+    using Clock = std::chrono::steady_clock;
+
+    // With `trace`, every timed scope is also kept as an event for writeTrace().
+    static void enable(bool trace);
+    static void disable();
+    static bool enabled() {
+        return active.load(std::memory_order_relaxed);
+    }
+    static void record(Phase phase, Clock::time_point start, Clock::time_point end);
+    // Call these once the timed threads are done: per-phase totals over all
+    // threads, and the events as Chrome trace-event JSON (chrome://tracing).
+    static void summary(std::ostream& out);
+    static void writeTrace(std::ostream& out);
+    static void reset();
+
+ private:
+    static std::atomic<bool> active;
+};
+
+// Times its own lifetime as one occurrence of a phase.
+class ScopedTimer {
+ public:
+    explicit ScopedTimer(Phase phase)
+    : phase(phase),
+      running(Profiler::enabled()) {
+        if (running) {
+            start = Profiler::Clock::now();
+        }
+    }
+    ~ScopedTimer() {
+        if (running) {
+            Profiler::record(phase, start, Profiler::Clock::now());
+        }
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+ private:
+    Phase phase;
+    bool running;
+    Profiler::Clock::time_point start;
+};
+
+}  //  namespace NB
+
+#define NB_PROFILE_CONCAT_(a, b) a##b
+#define NB_PROFILE_CONCAT(a, b) NB_PROFILE_CONCAT_(a, b)
+#ifdef NB_NO_PROFILE
+#define NB_PROFILE_SCOPE(phase)
+#else
+// Times the rest of the enclosing scope as `phase`.
+#define NB_PROFILE_SCOPE(phase) \
+    ::NB::ScopedTimer NB_PROFILE_CONCAT(profileScope, __LINE__)(::NB::Phase::phase)
+#endif
+
+#endif  //  PROFILER_HPP
@@ -0,0 +1,745 @@
+//  Copyright 2024 Vy Tran
+
+#include "Simulation.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Profiler.hpp"
+
+namespace NB {
+    namespace {
+    //  True if all of `token` is a number, which a texture name never is.
+    bool isNumber(const std::string& token, double& value) {
+        const char* begin = token.data();
+        const char* end = begin + token.size();
+        if (begin < end && *begin == '+') {
+            ++begin;
+        }
+        auto result = std::from_chars(begin, end, value);
+        return result.ec == std::errc() && result.ptr == end;
+    }
+    }  //  namespace
+
+    Simulation::Simulation()
+    : mRadius(0),
+      mBackend(ForceBackend::Pairwise),
+      mSimdLevel(detectSimdLevel()),
+      mDeterministic(false),
+      mSequential(false),
+      mIntegratorKind(IntegratorKind::Euler),
+      mTolerance(1e-9),
+      mPrecision(Precision::Double),
+      mBlockLevels(10),
+      mBlockAccuracy(0.02),
+      mIntegrator(makeIntegrator(mIntegratorKind, mTolerance, mBlockLevels, mBlockAccuracy)),
+      mSoftening(0),
+      mMergeRadius(0),
+      mMerged(0),
+      mLayoutVersion(0),
+      mTrackPotential(false),
+      latestPotentialEnergy(0),
+      mRequest(Request::None)
+    {}
+
+    double Simulation::radius() const {
+        return mRadius;
+    }
+
+    int Simulation::numPlanets() const {
+        return state.size();
+    }
+
+    const BodyState& Simulation::bodies() const {
+        return state;
+    }
+
+    void Simulation::load(BodyState bodies, double radius) {
+        state = std::move(bodies);
+        mRadius = radius;
+        mIntegrator->reset();
+        restoredIntegrator = IntegratorState();
+        potentialX.clear();
+        mRequest = Request::None;
+        ++mLayoutVersion;
+    }
+
+    std::ostream& operator<<(std::ostream& out, const Simulation& simulation) {
+        NB_PROFILE_SCOPE(Output);
+        out << simulation.numPlanets() << std::endl << simulation.mRadius << std::endl;
+        for (int i = 0; i < simulation.numPlanets(); ++i) {
+            simulation.state.write(out, i) << std::endl;
+        }
+        return out;
+    }
+
+    std::istream& operator>>(std::istream& in, Simulation& simulation) {
+        NB_PROFILE_SCOPE(Parse);
+        int numberOfBodies;
+        in >> numberOfBodies >> simulation.mRadius;
+
+        BodyState& state = simulation.state;
+        state.clear();
+        state.setDimensions(2);
+        if (!in || numberOfBodies < 0) {
+            return in;
+        }
+        int first = 0;
+        if (numberOfBodies > 0) {
+            //  Five numbers, then either the name (2D) or vz (3D)
+            double leading[5];
+            std::string sixth;
+            in >> leading[0] >> leading[1] >> leading[2] >> leading[3] >> leading[4] >> sixth;
+            double vz;
+            if (isNumber(sixth, vz)) {
+                state.setDimensions(3);
+                state.resize(numberOfBodies);
+                state.x[0] = leading[0];
+                state.y[0] = leading[1];
+                state.z[0] = leading[2];
+                state.vx[0] = leading[3];
+                state.vy[0] = leading[4];
+                state.vz[0] = vz;
+                in >> state.mass[0] >> state.names[0];
+            } else {
+                state.resize(numberOfBodies);
+                state.x[0] = leading[0];
+                state.y[0] = leading[1];
+                state.vx[0] = leading[2];
+                state.vy[0] = leading[3];
+                state.mass[0] = leading[4];
+                state.names[0] = sixth;
+            }
+            first = 1;
+        }
+        for (int i = first; i < numberOfBodies; ++i) {
+            state.read(in, i);
+        }
+        simulation.mIntegrator->reset();
+        simulation.restoredIntegrator = IntegratorState();
+        simulation.potentialX.clear();
+        simulation.mRequest = Simulation::Request::None;
+        ++simulation.mLayoutVersion;
+        return in;
+    }
+
+    void Simulation::setForceBackend(ForceBackend backend) {
+        mBackend = backend;
+    }
+
+    ForceBackend Simulation::forceBackend() const {
+        return mBackend;
+    }
+
+    void Simulation::setSimdLevel(SimdLevel level) {
+        mSimdLevel = level;
+    }
+
+    SimdLevel Simulation::simdLevel() const {
+        return mSimdLevel;
+    }
+
+    void Simulation::setDeterministic(bool deterministic) {
+        mDeterministic = deterministic;
+    }
+
+    bool Simulation::deterministic() const {
+        return mDeterministic;
+    }
+
+    SimdLevel Simulation::kernelLevel() const {
+        return mDeterministic ? SimdLevel::Scalar : mSimdLevel;
+    }
+
+    void Simulation::setPrecision(Precision precision) {
+        mPrecision = precision;
+    }
+
+    Precision Simulation::precision() const {
+        return mPrecision;
+    }
+
+    void Simulation::setTheta(double theta) {
+        tree.setTheta(theta);
+        fmm.setTheta(theta);
+    }
+
+    double Simulation::theta() const {
+        return tree.theta();
+    }
+
+    void Simulation::setFmmOrder(unsigned order) {
+        fmm.setOrder(order);
+    }
+
+    unsigned Simulation::fmmOrder() const {
+        return fmm.order();
+    }
+
+    void Simulation::setMeshGrid(std::size_t grid) {
+        mesh.setGrid(grid);
+    }
+
+    std::size_t Simulation::meshGrid() const {
+        return mesh.grid();
+    }
+
+    void Simulation::setMeshShortRange(bool shortRange) {
+        mesh.setShortRange(shortRange);
+    }
+
+    bool Simulation::meshShortRange() const {
+        return mesh.shortRange();
+    }
+
+    double Simulation::forceError(std::size_t samples) {
+        if (mBackend == ForceBackend::ParticleMesh) {
+            mesh.setSoftening(mSoftening);
+            return mesh.maxRelativeError(state, samples, pool.get());
+        }
+        if (mBackend == ForceBackend::Fmm && state.dimensions == 2) {
+            fmm.setSoftening(mSoftening);
+            return fmm.maxRelativeError(state, samples, pool.get());
+        }
+        tree.build(state);
+        return tree.maxRelativeError(state, samples);
+    }
+
+    void Simulation::setSequentialUpdate(bool sequential) {
+        mSequential = sequential;
+    }
+
+    bool Simulation::sequentialUpdate() const {
+        return mSequential;
+    }
+
+    void Simulation::setIntegrator(IntegratorKind kind) {
+        mIntegratorKind = kind;
+        mIntegrator = makeIntegrator(kind, mTolerance, mBlockLevels, mBlockAccuracy);
+    }
+
+    IntegratorKind Simulation::integrator() const {
+        return mIntegratorKind;
+    }
+
+    void Simulation::setTolerance(double tolerance) {
+        mTolerance = tolerance;
+        mIntegrator = makeIntegrator(mIntegratorKind, mTolerance, mBlockLevels, mBlockAccuracy);
+    }
+
+    double Simulation::tolerance() const {
+        return mTolerance;
+    }
+
+    void Simulation::setBlockLevels(unsigned levels) {
+        mBlockLevels = levels;
+        mIntegrator = makeIntegrator(mIntegratorKind, mTolerance, mBlockLevels, mBlockAccuracy);
+    }
+
+    unsigned Simulation::blockLevels() const {
+        return mBlockLevels;
+    }
+
+    void Simulation::setBlockAccuracy(double accuracy) {
+        mBlockAccuracy = accuracy;
+        mIntegrator = makeIntegrator(mIntegratorKind, mTolerance, mBlockLevels, mBlockAccuracy);
+    }
+
+    double Simulation::blockAccuracy() const {
+        return mBlockAccuracy;
+    }
+
+    IntegratorState Simulation::integratorState() const {
+        IntegratorState result;
+        result.kind = mIntegratorKind;
+        result.values = mIntegrator->save();
+        return result;
+    }
+
+    void Simulation::restoreIntegratorState(IntegratorState saved) {
+        restoredIntegrator = std::move(saved);
+    }
+
+    std::size_t Simulation::forceEvaluations() const {
+        return mIntegrator->evaluations();
+    }
+
+    void Simulation::setThreads(unsigned threads) {
+        pool.reset();
+        if (threads != 1) {
+            pool = std::make_unique<ThreadPool>(threads);
+        }
+    }
+
+    unsigned Simulation::threads() const {
+        return pool ? pool->size() : 1;
+    }
+
+    void Simulation::forEachRange(std::size_t n, const ThreadPool::RangeTask& task,
+                                   std::size_t grain) {
+        //  By default chunks stay multiples of the widest SIMD block so no thread gets a
+        //  scalar tail mid-array
+        if (pool) {
+            pool->parallelFor(n, task, grain);
+        } else {
+            task(0, n);
+        }
+    }
+
+    void Simulation::computeAccelerations(std::vector<double>& ax, std::vector<double>& ay,
+                                          std::vector<double>& az) {
+        NB_PROFILE_SCOPE(Forces);
+        const std::size_t n = state.size();
+        const bool is3D = state.dimensions == 3;
+        ax.resize(n);
+        ay.resize(n);
+        az.resize(is3D ? n : 0);
+        double* phi = nullptr;
+        if (mTrackPotential) {
+            potential.resize(n);
+            phi = potential.data();
+        }
+        switch (mBackend) {
+            case ForceBackend::Pairwise:
+                forEachRange(n, [&](std::size_t begin, std::size_t end) {
+                    for (std::size_t body = begin; body < end; ++body) {
+                        if (is3D) {
+                            pairwiseAcceleration<3>(body, ax.data(), ay.data(), az.data(), phi);
+                        } else {
+                            pairwiseAcceleration<2>(body, ax.data(), ay.data(), nullptr, phi);
+                        }
+                    }
+                });
+                break;
+            case ForceBackend::ParticleMesh:
+                mesh.setSoftening(mSoftening);
+                mesh.computeAccelerations(state, ax.data(), ay.data(), az.data(), phi, pool.get());
+                break;
+            case ForceBackend::Fmm:
+                if (!is3D) {
+                    //  Spreads each tree level over the pool itself
+                    fmm.setSoftening(mSoftening);
+                    fmm.computeAccelerations(state, ax.data(), ay.data(), phi, pool.get());
+                    break;
+                }
+                [[fallthrough]];
+            case ForceBackend::BarnesHut:
+                tree.setSoftening(mSoftening);
+                tree.build(state);
+                forEachRange(n, [&](std::size_t begin, std::size_t end) {
+                    tree.computeAccelerations(state, begin, end, ax.data(), ay.data(), az.data(),
+                                              phi);
+                });
+                break;
+            case ForceBackend::Symmetric: {
+                symmetric.plan(n);
+                std::fill(ax.begin(), ax.end(), 0.0);
+                std::fill(ay.begin(), ay.end(), 0.0);
+                std::fill(az.begin(), az.end(), 0.0);
+                if (phi) {
+                    std::fill(potential.begin(), potential.end(), 0.0);
+                }
+                //  Tiles of a round touch disjoint blocks; the next round waits for them all.
+                //  One task serves every round, so the rounds allocate nothing
+                std::size_t round = 0;
+                const ThreadPool::RangeTask tiles = [&](std::size_t begin, std::size_t end) {
+                    symmetric.accumulate(state, round, begin, end, ax.data(), ay.data(),
+                                         az.data(), kernelLevel(), mSoftening, phi);
+                };
+                for (; round < symmetric.rounds(); ++round) {
+                    forEachRange(symmetric.tiles(round), tiles, 1);
+                }
+                forEachRange(n, [&](std::size_t begin, std::size_t end) {
+                    SymmetricForces::finish(state, begin, end, ax.data(), ay.data(), az.data(),
+                                            phi);
+                });
+                break;
+            }
+            case ForceBackend::Simd:
+                if (mPrecision == Precision::Mixed) {
+                    floatBodies.assign(state);
+                    forEachRange(n, [&](std::size_t begin, std::size_t end) {
+                        NB::computeAccelerations(floatBodies, begin, end, ax.data(), ay.data(),
+                                                 az.data(), kernelLevel(), mSoftening, phi);
+                    });
+                    break;
+                }
+                forEachRange(n, [&](std::size_t begin, std::size_t end) {
+                    NB::computeAccelerations(state, begin, end, ax.data(), ay.data(), az.data(),
+                                             kernelLevel(), mSoftening, phi);
+                });
+                break;
+        }
+        if (phi) {
+            latestPotentialEnergy = potentialEnergy(state, phi);
+            potentialX.assign(state.x.begin(), state.x.end());
+            potentialY.assign(state.y.begin(), state.y.end());
+            potentialZ.assign(state.z.begin(), state.z.end());
+            if (mRequest == Request::Pending
+                && potentialMatches(requestedX, requestedY, requestedZ)) {
+                requested.potentialEnergy = latestPotentialEnergy;
+                mRequest = Request::Ready;
+            }
+        }
+    }
+
+    void Simulation::computeAccelerations(const std::vector<std::uint32_t>& bodies,
+                                          std::vector<double>& ax, std::vector<double>& ay,
+                                          std::vector<double>& az) {
+        NB_PROFILE_SCOPE(Forces);
+        const std::size_t n = state.size();
+        if (bodies.size() == n) {
+            //  Every body is due, as at the end of a block step: a full pass costs no more
+            //  and tracks the potential for the diagnostics
+            computeAccelerations(ax, ay, az);
+            return;
+        }
+        const bool is3D = state.dimensions == 3;
+        const bool mixed = mPrecision == Precision::Mixed && mBackend == ForceBackend::Simd;
+        ax.resize(n);
+        ay.resize(n);
+        az.resize(is3D ? n : 0);
+        switch (mBackend) {
+            case ForceBackend::Pairwise:
+                forEachRange(bodies.size(), [&](std::size_t begin, std::size_t end) {
+                    for (std::size_t k = begin; k < end; ++k) {
+                        if (is3D) {
+                            pairwiseAcceleration<3>(bodies[k], ax.data(), ay.data(), az.data(),
+                                                    nullptr);
+                        } else {
+                            pairwiseAcceleration<2>(bodies[k], ax.data(), ay.data(), nullptr,
+                                                    nullptr);
+                        }
+                    }
+                });
+                break;
+            case ForceBackend::ParticleMesh:
+                //  The grid serves every body at once, so a subset costs a full pass;
+                //  only the listed bodies are updated
+                mesh.setSoftening(mSoftening);
+                fullX.resize(n);
+                fullY.resize(n);
+                fullZ.resize(is3D ? n : 0);
+                mesh.computeAccelerations(state, fullX.data(), fullY.data(), fullZ.data(),
+                                          nullptr, pool.get());
+                for (std::uint32_t body : bodies) {
+                    ax[body] = fullX[body];
+                    ay[body] = fullY[body];
+                    if (is3D) {
+                        az[body] = fullZ[body];
+                    }
+                }
+                break;
+            case ForceBackend::Fmm:
+                if (!is3D) {
+                    //  Likewise for the expansions
+                    fmm.setSoftening(mSoftening);
+                    fullX.resize(n);
+                    fullY.resize(n);
+                    fmm.computeAccelerations(state, fullX.data(), fullY.data(), nullptr,
+                                             pool.get());
+                    for (std::uint32_t body : bodies) {
+                        ax[body] = fullX[body];
+                        ay[body] = fullY[body];
+                    }
+                    break;
+                }
+                [[fallthrough]];
+            case ForceBackend::BarnesHut:
+                tree.setSoftening(mSoftening);
+                tree.build(state);
+                forEachRange(bodies.size(), [&](std::size_t begin, std::size_t end) {
+                    for (std::size_t k = begin; k < end; ++k) {
+                        tree.computeAccelerations(state, bodies[k], bodies[k] + 1,
+                                                  ax.data(), ay.data(), az.data());
+                    }
+                });
+                break;
+            case ForceBackend::Simd:
+            case ForceBackend::Symmetric:
+                //  A pair saves nothing when only one side needs it, so a symmetric
+                //  simulation evaluates a subset with the one-sided kernel
+                if (mixed) {
+                    floatBodies.assign(state);
+                }
+                //  Runs of consecutive indices keep the kernel's vector blocks full. Each
+                //  run goes to one thread whole, so its blocks start where they would on one
+                runs.clear();
+                for (std::size_t k = 0; k < bodies.size(); ++k) {
+                    if (k == 0 || bodies[k] != bodies[k - 1] + 1) {
+                        runs.push_back(k);
+                    }
+                }
+                runs.push_back(bodies.size());
+                forEachRange(runs.size() - 1, [&](std::size_t begin, std::size_t end) {
+                    for (std::size_t run = begin; run < end; ++run) {
+                        const std::size_t first = bodies[runs[run]];
+                        const std::size_t last = bodies[runs[run + 1] - 1] + 1;
+                        if (mixed) {
+                            NB::computeAccelerations(floatBodies, first, last, ax.data(),
+                                                     ay.data(), az.data(), kernelLevel(),
+                                                     mSoftening);
+                        } else {
+                            NB::computeAccelerations(state, first, last, ax.data(), ay.data(),
+                                                     az.data(), kernelLevel(), mSoftening);
+                        }
+                    }
+                }, 1);
+                break;
+        }
+    }
+
+    void Simulation::computeJerks(std::vector<double>& jx, std::vector<double>& jy,
+                                  std::vector<double>& jz) {
+        NB_PROFILE_SCOPE(Forces);
+        const std::size_t n = state.size();
+        jx.resize(n);
+        jy.resize(n);
+        jz.resize(state.dimensions == 3 ? n : 0);
+        forEachRange(n, [&](std::size_t begin, std::size_t end) {
+            NB::computeJerks(state, begin, end, jx.data(), jy.data(), jz.data(), mSoftening);
+        });
+    }
+
+    template <int Dim>
+    void Simulation::pairwiseAcceleration(std::size_t body, double* ax, double* ay, double* az,
+                                          double* phi) const {
+        const std::size_t n = state.size();
+        std::array<double, Dim> net = {};
+        double sumPotential = 0.0;
+        for (std::size_t otherBody = 0; otherBody < n; ++otherBody) {
+            if (body != otherBody) {
+                double invR;
+                auto force = calculateGravitationalForce<Dim>(body, otherBody,
+                                                              phi ? &invR : nullptr);
+                for (int axis = 0; axis < Dim; ++axis) {
+                    net[axis] += force[axis];
+                }
+                if (phi) {
+                    sumPotential += state.mass[otherBody] * invR;
+                }
+            }
+        }
+        ax[body] = net[0] / state.mass[body];
+        ay[body] = net[1] / state.mass[body];
+        if constexpr (Dim == 3) {
+            az[body] = net[2] / state.mass[body];
+        }
+        if (phi) {
+            phi[body] = -G * sumPotential;
+        }
+    }
+
+    void Simulation::setTrackPotential(bool track) {
+        mTrackPotential = track;
+        potentialX.clear();
+    }
+
+    bool Simulation::trackPotential() const {
+        return mTrackPotential;
+    }
+
+    bool Simulation::potentialMatches(const std::vector<double>& x, const std::vector<double>& y,
+                                      const std::vector<double>& z) const {
+        return mTrackPotential && potentialX == x && potentialY == y && potentialZ == z;
+    }
+
+    double Simulation::directPotentialEnergy() {
+        const std::size_t n = state.size();
+        std::vector<double> ax(n), ay(n), az(state.dimensions == 3 ? n : 0), phi(n);
+        forEachRange(n, [&](std::size_t begin, std::size_t end) {
+            NB::computeAccelerations(state, begin, end, ax.data(), ay.data(), az.data(),
+                                     kernelLevel(), mSoftening, phi.data());
+        });
+        return potentialEnergy(state, phi.data());
+    }
+
+    Diagnostics Simulation::diagnostics() {
+        Diagnostics result = measureKinematics(state);
+        result.potentialEnergy = potentialMatches(state.x, state.y, state.z)
+                               ? latestPotentialEnergy : directPotentialEnergy();
+        return result;
+    }
+
+    void Simulation::requestDiagnostics() {
+        requested = measureKinematics(state);
+        if (potentialMatches(state.x, state.y, state.z)) {
+            requested.potentialEnergy = latestPotentialEnergy;
+            mRequest = Request::Ready;
+        } else {
+            requestedX.assign(state.x.begin(), state.x.end());
+            requestedY.assign(state.y.begin(), state.y.end());
+            requestedZ.assign(state.z.begin(), state.z.end());
+            mRequest = Request::Pending;
+        }
+    }
+
+    bool Simulation::takeDiagnostics(Diagnostics& diagnostics, bool finish) {
+        if (mRequest == Request::Pending && finish) {
+            //  The bodies may have moved since; the sweep must see the requested positions
+            std::swap(state.x, requestedX);
+            std::swap(state.y, requestedY);
+            std::swap(state.z, requestedZ);
+            requested.potentialEnergy = directPotentialEnergy();
+            std::swap(state.x, requestedX);
+            std::swap(state.y, requestedY);
+            std::swap(state.z, requestedZ);
+            mRequest = Request::Ready;
+        }
+        if (mRequest != Request::Ready) {
+            return false;
+        }
+        diagnostics = requested;
+        mRequest = Request::None;
+        return true;
+    }
+
+    void Simulation::step(double seconds) {
+        NB_PROFILE_SCOPE(Step);
+        if (!restoredIntegrator.values.empty()) {
+            if (restoredIntegrator.kind == mIntegratorKind) {
+                mIntegrator->restore(restoredIntegrator.values, state.size());
+            }
+            restoredIntegrator = IntegratorState();
+        }
+        if (!mSequential || mBackend != ForceBackend::Pairwise
+            || mIntegratorKind != IntegratorKind::Euler) {
+            //  All accelerations come from a frozen snapshot of the positions and land in
+            //  the integrator's scratch buffers, then every body moves
+            mIntegrator->stepIndividually(
+                state, seconds,
+                [this](std::vector<double>& ax, std::vector<double>& ay,
+                       std::vector<double>& az) {
+                    computeAccelerations(ax, ay, az);
+                },
+                [this](const std::vector<std::uint32_t>& bodies, std::vector<double>& ax,
+                       std::vector<double>& ay, std::vector<double>& az) {
+                    computeAccelerations(bodies, ax, ay, az);
+                },
+                [this](std::vector<double>& jx, std::vector<double>& jy,
+                       std::vector<double>& jz) {
+                    computeJerks(jx, jy, jz);
+                });
+            mergeCloseEncounters();
+            return;
+        }
+
+        //  Sequential update: results depend on body order and the loop must stay serial
+        if (state.dimensions == 3) {
+            sequentialStep<3>(seconds);
+        } else {
+            sequentialStep<2>(seconds);
+        }
+        mergeCloseEncounters();
+    }
+
+    template <int Dim>
+    void Simulation::sequentialStep(double seconds) {
+        const std::size_t n = state.size();
+        for (std::size_t body = 0; body < n; ++body) {
+            std::array<double, Dim> net = {};
+
+            // Calculate the net force on this body
+            for (std::size_t otherBody = 0; otherBody < n; ++otherBody) {
+                //  Make sure we're not calculating a body's force on itself
+                if (body != otherBody) {
+                    auto force = calculateGravitationalForce<Dim>(body, otherBody);
+                    for (int axis = 0; axis < Dim; ++axis) {
+                        net[axis] += force[axis];
+                    }
+                }
+            }
+
+            // Apply the net force to the body
+            if constexpr (Dim == 3) {
+                state.applyForce(body, net[0], net[1], net[2], seconds);
+            } else {
+                state.applyForce(body, net[0], net[1], seconds);
+            }
+        }
+    }
+
+    void Simulation::mergeCloseEncounters() {
+        if (mMergeRadius <= 0 || !encounters.find(state, mMergeRadius)) {
+            return;
+        }
+        //  A request still waiting for its force pass needs the bodies it was made for
+        Diagnostics pending;
+        const bool wasPending = mRequest == Request::Pending;
+        if (wasPending) {
+            takeDiagnostics(pending, true);
+        }
+        mMerged += encounters.merge(state);
+        ++mLayoutVersion;
+        //  Cached accelerations and potentials belong to the old body list
+        mIntegrator->reset();
+        potentialX.clear();
+        if (wasPending) {
+            requested = pending;
+            mRequest = Request::Ready;
+        }
+    }
+
+    void Simulation::setSoftening(double softening) {
+        mSoftening = softening;
+    }
+
+    double Simulation::softening() const {
+        return mSoftening;
+    }
+
+    void Simulation::setMergeRadius(double radius) {
+        mMergeRadius = radius;
+    }
+
+    double Simulation::mergeRadius() const {
+        return mMergeRadius;
+    }
+
+    std::size_t Simulation::mergedBodies() const {
+        return mMerged;
+    }
+
+    std::uint64_t Simulation::layoutVersion() const {
+        return mLayoutVersion;
+    }
+
+    // Function to calculate gravitational force between two celestial bodies
+    template <int Dim>
+    std::array<double, Dim> Simulation::calculateGravitationalForce
+    (std::size_t body, std::size_t otherBody, double* inverseDistance) const {
+        std::array<double, Dim> delta;  // Separation, from body to otherBody
+        delta[0] = state.x[otherBody] - state.x[body];  // Difference in x positions
+        delta[1] = state.y[otherBody] - state.y[body];  // Difference in y positions
+        // Square of the (softened) distance between the bodies
+        double distanceSquared = delta[0] * delta[0] + delta[1] * delta[1];
+        if constexpr (Dim == 3) {
+            delta[2] = state.z[otherBody] - state.z[body];  // Difference in z positions
+            distanceSquared += delta[2] * delta[2];
+        }
+        distanceSquared += mSoftening * mSoftening;
+        double distance = std::sqrt(distanceSquared);  // Distance between the bodies
+
+        std::array<double, Dim> force = {};
+        if (distance == 0) {
+            if (inverseDistance) {
+                *inverseDistance = 0.0;
+            }
+            return force;  // Avoid division by zero
+        }
+        if (inverseDistance) {
+            *inverseDistance = 1.0 / distance;  // Lets the caller add the potential cheaply
+        }
+
+        // Magnitude of the gravitational force
+        double forceMagnitude = G * state.mass[body] * state.mass[otherBody] / distanceSquared;
+        for (int axis = 0; axis < Dim; ++axis) {
+            force[axis] = forceMagnitude * delta[axis] / distance;  // Component along axis
+        }
+        return force;
+    }
+
+}  //  namespace NB
@@ -0,0 +1,200 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef SIMULATION_HPP
+#define SIMULATION_HPP
+
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "BarnesHut.hpp"
+#include "BodyState.hpp"
+#include "Diagnostics.hpp"
+#include "Encounters.hpp"
+#include "FastMultipole.hpp"
+#include "ForceKernels.hpp"
+#include "Integrators.hpp"
+#include "ParticleMesh.hpp"
+#include "SymmetricForces.hpp"
+#include "ThreadPool.hpp"
+
+namespace NB {
+
+// Physics core of a universe: body state, force backends and stepping. Has no
+// SFML dependency, so it can be linked into render-less builds on its own.
+// Universes are 2D or 3D as their bodies are; see BodyState::dimensions.
+class Simulation {
+ public:
+    Simulation();
+    virtual ~Simulation() = default;
+    //  Bodies are "x y vx vy mass name", or "x y z vx vy vz mass name" for a 3D universe;
+    //  the first body decides which, by whether its sixth field is a number.
+    friend std::istream& operator>>(std::istream& in, Simulation& simulation);
+    friend std::ostream& operator<<(std::ostream& out, const Simulation& simulation);
+    double radius() const;
+    int numPlanets() const;
+    const BodyState& bodies() const;
+    //  Replaces all bodies and the radius, as reading a universe does.
+    virtual void load(BodyState bodies, double radius);
+    void step(double seconds);
+    void setForceBackend(ForceBackend backend);
+    ForceBackend forceBackend() const;
+    //  The SIMD backend picks the best instruction set at construction; tests may override it.
+    void setSimdLevel(SimdLevel level);
+    SimdLevel simdLevel() const;
+    //  Opening angle of the Barnes-Hut backend and separation ratio of the fmm backend;
+    //  smaller is more accurate and slower.
+    void setTheta(double theta);
+    double theta() const;
+    //  Expansion order of the fmm backend, 1 to FastMultipole::kMaxOrder; higher is more
+    //  accurate and slower.
+    void setFmmOrder(unsigned order);
+    unsigned fmmOrder() const;
+    //  Cells per side of the pm backend's grid, a power of two from ParticleMesh::kMinGrid
+    //  to kMaxGrid, and whether pairs closer than a few cells also get the exact
+    //  short-range force (P3M).
+    void setMeshGrid(std::size_t grid);
+    std::size_t meshGrid() const;
+    void setMeshShortRange(bool shortRange);
+    bool meshShortRange() const;
+    //  Max relative force error of the Barnes-Hut backend, or of the fmm or pm backend when
+    //  that is selected, against direct summation over a sample of bodies.
+    double forceError(std::size_t samples);
+    //  The original update: pairwise forces with each body moved as soon as its force is
+    //  known, so later bodies see earlier ones already moved. Kept for regression checks;
+    //  only applies to the pairwise backend with the euler integrator.
+    void setSequentialUpdate(bool sequential);
+    bool sequentialUpdate() const;
+    //  Time integration scheme.
+    void setIntegrator(IntegratorKind kind);
+    IntegratorKind integrator() const;
+    //  Relative error per step targeted by the adaptive integrator.
+    void setTolerance(double tolerance);
+    double tolerance() const;
+    //  Block integrator: number of times a body's step may be halved within deltaT, and
+    //  eta in dt = eta |a| / |da/dt|, the step each body asks for.
+    void setBlockLevels(unsigned levels);
+    unsigned blockLevels() const;
+    void setBlockAccuracy(double accuracy);
+    double blockAccuracy() const;
+    //  What the integrator carries between steps, for checkpoints. A restored state is
+    //  taken by the next step if the integrator is then of the same kind, so it survives
+    //  setIntegrator() and the other integrator settings; load() and reading a universe
+    //  drop it.
+    IntegratorState integratorState() const;
+    void restoreIntegratorState(IntegratorState saved);
+    //  Force evaluations made by the integrator so far.
+    std::size_t forceEvaluations() const;
+    //  Number of threads the force and update loops are split across; 0 means one per core.
+    void setThreads(unsigned threads);
+    unsigned threads() const;
+    //  Results never depend on the number of threads: every body's force is summed by one
+    //  thread in a fixed order, and passes are split where they cannot move a body between
+    //  a kernel's vector blocks and its scalar tail. Deterministic mode also runs the direct
+    //  summation kernels scalar, whatever simdLevel() says, so runs on machines with
+    //  different instruction sets (or rsqrt estimates) match bit for bit too.
+    void setDeterministic(bool deterministic);
+    bool deterministic() const;
+    //  Arithmetic of the simd backend's pair terms. Mixed trades force accuracy for
+    //  throughput; the bodies are still stored and integrated in double.
+    void setPrecision(Precision precision);
+    Precision precision() const;
+    //  Plummer softening length: pairs interact as if r^2 were r^2 + eps^2, which bounds
+    //  the force of close encounters so deltaT need not shrink to resolve them.
+    void setSoftening(double softening);
+    double softening() const;
+    //  Bodies that end a step closer than this are merged into one, conserving mass and
+    //  momentum; 0 turns merging off.
+    void setMergeRadius(double radius);
+    double mergeRadius() const;
+    //  Bodies removed by merging so far.
+    std::size_t mergedBodies() const;
+    //  Changes whenever bodies are added, removed or reordered, so views such as the
+    //  renderer's texture table know to rebuild.
+    std::uint64_t layoutVersion() const;
+    //  Conserved quantities of the current state. The potential energy comes from the
+    //  latest force pass when potential tracking is on and that pass was made at the
+    //  current positions; otherwise this costs a separate direct-summation sweep.
+    Diagnostics diagnostics();
+    //  Accumulates the potential during force passes, one multiply-add per interaction.
+    void setTrackPotential(bool track);
+    bool trackPotential() const;
+    //  Measures the current state now and leaves the potential energy to the next
+    //  force pass made at these positions, such as the first of the next euler step,
+    //  unless the latest pass already was. Replaces any request not yet taken, so finish
+    //  that one first with takeDiagnostics(diagnostics, true).
+    void requestDiagnostics();
+    //  Hands over a completed request. With `finish`, a request still waiting for its
+    //  force pass is completed with a direct sweep instead.
+    bool takeDiagnostics(Diagnostics& diagnostics, bool finish = false);
+ protected:
+    BodyState state;  //  Physical state of all celestial bodies, one array per field
+    double mRadius;  //  Radius of the universe, used for scaling
+ private:
+    ForceBackend mBackend;
+    SimdLevel mSimdLevel;
+    bool mDeterministic;
+    bool mSequential;
+    IntegratorKind mIntegratorKind;
+    double mTolerance;
+    Precision mPrecision;
+    FloatBodies floatBodies;  //  Float positions for mixed precision, refilled every pass
+    unsigned mBlockLevels;
+    double mBlockAccuracy;
+    std::unique_ptr<Integrator> mIntegrator;
+    IntegratorState restoredIntegrator;  //  From a checkpoint, until the next step takes it
+    std::unique_ptr<ThreadPool> pool;  //  Persistent workers, null when single-threaded
+    BarnesHut tree;
+    SymmetricForces symmetric;
+    FastMultipole fmm;
+    ParticleMesh mesh;
+    //  Full pass the subset evaluations of the fmm and pm backends copy from
+    std::vector<double> fullX, fullY, fullZ;
+    double mSoftening;
+    double mMergeRadius;
+    Encounters encounters;
+    std::size_t mMerged;
+    std::uint64_t mLayoutVersion;
+    void mergeCloseEncounters();
+    bool mTrackPotential;
+    std::vector<double> potential;  //  Per body, from the latest tracked force pass
+    std::vector<double> potentialX, potentialY, potentialZ;  //  Positions of that pass
+    double latestPotentialEnergy;
+    enum class Request { None, Pending, Ready } mRequest;
+    Diagnostics requested;
+    std::vector<double> requestedX, requestedY, requestedZ;
+    bool potentialMatches(const std::vector<double>& x, const std::vector<double>& y,
+                          const std::vector<double>& z) const;
+    double directPotentialEnergy();
+    std::vector<std::size_t> runs;  //  Starts of the runs of consecutive bodies in a subset
+    void forEachRange(std::size_t n, const ThreadPool::RangeTask& task,
+                      std::size_t grain = kWidestBlock);
+    //  Instruction set the direct summation kernels run with.
+    SimdLevel kernelLevel() const;
+    //  Accelerations at the current positions with the selected backend; az is only
+    //  filled for a 3D state.
+    void computeAccelerations(std::vector<double>& ax, std::vector<double>& ay,
+                              std::vector<double>& az);
+    //  Accelerations of the listed bodies only, written at their indices in ax, ay, az.
+    void computeAccelerations(const std::vector<std::uint32_t>& bodies,
+                              std::vector<double>& ax, std::vector<double>& ay,
+                              std::vector<double>& az);
+    //  Time derivatives of the accelerations of every body by direct summation, for the
+    //  block integrator's first levels.
+    void computeJerks(std::vector<double>& jx, std::vector<double>& jy,
+                      std::vector<double>& jz);
+    //  Acceleration of one body (and its potential if phi is given) by the pairwise loop.
+    template <int Dim>
+    void pairwiseAcceleration(std::size_t body, double* ax, double* ay, double* az,
+                              double* phi) const;
+    template <int Dim>
+    void sequentialStep(double seconds);
+    template <int Dim>
+    std::array<double, Dim> calculateGravitationalForce
+    (std::size_t body, std::size_t otherBody, double* inverseDistance = nullptr) const;
+};
+
+}  //  namespace NB
+
+#endif  //  SIMULATION_HPP
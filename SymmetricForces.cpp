@@ -0,0 +1,358 @@
+//  Copyright 2024 Vy Tran
+
+#include "SymmetricForces.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NB_HAVE_X86_SIMD 1
+#endif
+
+namespace NB {
+    namespace {
+    // Pairs of body i with bodies [j, jEnd): adds their pull on i to sum (x, y, z,
+    // potential) and scatters the opposite pull straight into their own sums. Also
+    // used for the bodies left over after the vector blocks.
+    template <int Dim, bool WithPotential>
+    void rowScalar(const BodyState& state, std::size_t i, std::size_t j, std::size_t jEnd,
+                   double softening2, double* ax, double* ay, double* az, double* potential,
+                   double* sum) {
+        const double* x = state.x.data();
+        const double* y = state.y.data();
+        const double* z = state.z.data();
+        const double* m = state.mass.data();
+        for (; j < jEnd; ++j) {
+            double dx = x[j] - x[i];
+            double dy = y[j] - y[i];
+            double dz = 0.0;
+            double r2 = dx * dx + dy * dy;
+            if constexpr (Dim == 3) {
+                dz = z[j] - z[i];
+                r2 += dz * dz;
+            }
+            r2 += softening2;
+            double invR = r2 > 0.0 ? 1.0 / std::sqrt(r2) : 0.0;
+            double invR3 = invR * invR * invR;
+            double si = m[j] * invR3;
+            double sj = m[i] * invR3;
+            sum[0] += si * dx;
+            sum[1] += si * dy;
+            ax[j] -= sj * dx;
+            ay[j] -= sj * dy;
+            if constexpr (Dim == 3) {
+                sum[2] += si * dz;
+                az[j] -= sj * dz;
+            }
+            if (WithPotential) {
+                sum[3] += m[j] * invR;
+                potential[j] += m[i] * invR;
+            }
+        }
+    }
+
+    template <int Dim, bool WithPotential>
+    void tileScalar(const BodyState& state, std::size_t iBegin, std::size_t iEnd,
+                    std::size_t jBegin, std::size_t jEnd, double* ax, double* ay, double* az,
+                    double softening2, double* potential) {
+        const bool diagonal = iBegin == jBegin;
+        for (std::size_t i = iBegin; i < iEnd; ++i) {
+            double sum[4] = {};
+            rowScalar<Dim, WithPotential>(state, i, diagonal ? i + 1 : jBegin, jEnd, softening2,
+                                          ax, ay, az, potential, sum);
+            ax[i] += sum[0];
+            ay[i] += sum[1];
+            if constexpr (Dim == 3) {
+                az[i] += sum[2];
+            }
+            if (WithPotential) {
+                potential[i] += sum[3];
+            }
+        }
+    }
+
+#ifdef NB_HAVE_X86_SIMD
+    __attribute__((target("avx2,fma")))
+    inline double horizontalSum(__m256d value) {
+        __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(value), _mm256_extractf128_pd(value, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+    }
+
+    // Maskz extracts, unlike _mm512_reduce_add_pd, read no undefined register
+    __attribute__((target("avx512f")))
+    inline double horizontalSum(__m512d value) {
+        __m256d quad = _mm256_add_pd(_mm512_maskz_extractf64x4_pd(0xff, value, 0),
+                                     _mm512_maskz_extractf64x4_pd(0xff, value, 1));
+        __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(quad), _mm256_extractf128_pd(quad, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+    }
+
+    // One target body broadcast against four sources per register. The sources'
+    // sums are loaded, updated and stored back in the same iteration; 1/sqrt(r2) is
+    // refined from the float estimate exactly as in the one-sided AVX2 kernel.
+    template <int Dim, bool WithPotential>
+    __attribute__((target("avx2,fma")))
+    void tileAvx2(const BodyState& state, std::size_t iBegin, std::size_t iEnd,
+                  std::size_t jBegin, std::size_t jEnd, double* ax, double* ay, double* az,
+                  double softening2, double* potential) {
+        const double* x = state.x.data();
+        const double* y = state.y.data();
+        const double* z = state.z.data();
+        const double* m = state.mass.data();
+        const __m256d half = _mm256_set1_pd(0.5);
+        const __m256d threeHalves = _mm256_set1_pd(1.5);
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d eps2 = _mm256_set1_pd(softening2);
+        const bool diagonal = iBegin == jBegin;
+        for (std::size_t i = iBegin; i < iEnd; ++i) {
+            const __m256d xi = _mm256_set1_pd(x[i]);
+            const __m256d yi = _mm256_set1_pd(y[i]);
+            const __m256d zi = Dim == 3 ? _mm256_set1_pd(z[i]) : zero;
+            const __m256d mi = _mm256_set1_pd(m[i]);
+            __m256d sumX = zero;
+            __m256d sumY = zero;
+            __m256d sumZ = zero;
+            __m256d sumPotential = zero;
+            std::size_t j = diagonal ? i + 1 : jBegin;
+            for (; j + 4 <= jEnd; j += 4) {
+                __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + j), xi);
+                __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + j), yi);
+                __m256d r2 = _mm256_fmadd_pd(dy, dy, _mm256_fmadd_pd(dx, dx, eps2));
+                __m256d dz = zero;
+                if constexpr (Dim == 3) {
+                    dz = _mm256_sub_pd(_mm256_loadu_pd(z + j), zi);
+                    r2 = _mm256_fmadd_pd(dz, dz, r2);
+                }
+                __m256d invR = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r2)));
+                __m256d halfR2 = _mm256_mul_pd(half, r2);
+                invR = _mm256_mul_pd(invR, _mm256_fnmadd_pd(halfR2, _mm256_mul_pd(invR, invR),
+                                                            threeHalves));
+                invR = _mm256_mul_pd(invR, _mm256_fnmadd_pd(halfR2, _mm256_mul_pd(invR, invR),
+                                                            threeHalves));
+                invR = _mm256_and_pd(invR, _mm256_cmp_pd(r2, zero, _CMP_GT_OQ));
+                __m256d invR3 = _mm256_mul_pd(invR, _mm256_mul_pd(invR, invR));
+                __m256d mj = _mm256_loadu_pd(m + j);
+                __m256d si = _mm256_mul_pd(mj, invR3);
+                __m256d sj = _mm256_mul_pd(mi, invR3);
+                sumX = _mm256_fmadd_pd(si, dx, sumX);
+                sumY = _mm256_fmadd_pd(si, dy, sumY);
+                _mm256_storeu_pd(ax + j, _mm256_fnmadd_pd(sj, dx, _mm256_loadu_pd(ax + j)));
+                _mm256_storeu_pd(ay + j, _mm256_fnmadd_pd(sj, dy, _mm256_loadu_pd(ay + j)));
+                if constexpr (Dim == 3) {
+                    sumZ = _mm256_fmadd_pd(si, dz, sumZ);
+                    _mm256_storeu_pd(az + j, _mm256_fnmadd_pd(sj, dz, _mm256_loadu_pd(az + j)));
+                }
+                if (WithPotential) {
+                    sumPotential = _mm256_fmadd_pd(mj, invR, sumPotential);
+                    __m256d phi = _mm256_loadu_pd(potential + j);
+                    _mm256_storeu_pd(potential + j, _mm256_fmadd_pd(mi, invR, phi));
+                }
+            }
+            double sum[4] = {horizontalSum(sumX), horizontalSum(sumY), horizontalSum(sumZ),
+                             horizontalSum(sumPotential)};
+            rowScalar<Dim, WithPotential>(state, i, j, jEnd, softening2, ax, ay, az, potential,
+                                          sum);
+            ax[i] += sum[0];
+            ay[i] += sum[1];
+            if constexpr (Dim == 3) {
+                az[i] += sum[2];
+            }
+            if (WithPotential) {
+                potential[i] += sum[3];
+            }
+        }
+    }
+
+    // Eight sources per register; rsqrt14 has double range, so no float round trip.
+    template <int Dim, bool WithPotential>
+    __attribute__((target("avx512f")))
+    void tileAvx512(const BodyState& state, std::size_t iBegin, std::size_t iEnd,
+                    std::size_t jBegin, std::size_t jEnd, double* ax, double* ay, double* az,
+                    double softening2, double* potential) {
+        const double* x = state.x.data();
+        const double* y = state.y.data();
+        const double* z = state.z.data();
+        const double* m = state.mass.data();
+        const __m512d half = _mm512_set1_pd(0.5);
+        const __m512d threeHalves = _mm512_set1_pd(1.5);
+        const __m512d zero = _mm512_setzero_pd();
+        const __m512d eps2 = _mm512_set1_pd(softening2);
+        const bool diagonal = iBegin == jBegin;
+        for (std::size_t i = iBegin; i < iEnd; ++i) {
+            const __m512d xi = _mm512_set1_pd(x[i]);
+            const __m512d yi = _mm512_set1_pd(y[i]);
+            const __m512d zi = Dim == 3 ? _mm512_set1_pd(z[i]) : zero;
+            const __m512d mi = _mm512_set1_pd(m[i]);
+            __m512d sumX = zero;
+            __m512d sumY = zero;
+            __m512d sumZ = zero;
+            __m512d sumPotential = zero;
+            std::size_t j = diagonal ? i + 1 : jBegin;
+            for (; j + 8 <= jEnd; j += 8) {
+                __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(x + j), xi);
+                __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(y + j), yi);
+                __m512d r2 = _mm512_fmadd_pd(dy, dy, _mm512_fmadd_pd(dx, dx, eps2));
+                __m512d dz = zero;
+                if constexpr (Dim == 3) {
+                    dz = _mm512_sub_pd(_mm512_loadu_pd(z + j), zi);
+                    r2 = _mm512_fmadd_pd(dz, dz, r2);
+                }
+                __mmask8 nonzero = _mm512_cmp_pd_mask(r2, zero, _CMP_GT_OQ);
+                __m512d invR = _mm512_maskz_rsqrt14_pd(nonzero, r2);
+                __m512d halfR2 = _mm512_mul_pd(half, r2);
+                invR = _mm512_mul_pd(invR, _mm512_fnmadd_pd(halfR2, _mm512_mul_pd(invR, invR),
+                                                            threeHalves));
+                invR = _mm512_mul_pd(invR, _mm512_fnmadd_pd(halfR2, _mm512_mul_pd(invR, invR),
+                                                            threeHalves));
+                __m512d invR3 = _mm512_mul_pd(invR, _mm512_mul_pd(invR, invR));
+                __m512d mj = _mm512_loadu_pd(m + j);
+                __m512d si = _mm512_mul_pd(mj, invR3);
+                __m512d sj = _mm512_mul_pd(mi, invR3);
+                sumX = _mm512_fmadd_pd(si, dx, sumX);
+                sumY = _mm512_fmadd_pd(si, dy, sumY);
+                _mm512_storeu_pd(ax + j, _mm512_fnmadd_pd(sj, dx, _mm512_loadu_pd(ax + j)));
+                _mm512_storeu_pd(ay + j, _mm512_fnmadd_pd(sj, dy, _mm512_loadu_pd(ay + j)));
+                if constexpr (Dim == 3) {
+                    sumZ = _mm512_fmadd_pd(si, dz, sumZ);
+                    _mm512_storeu_pd(az + j, _mm512_fnmadd_pd(sj, dz, _mm512_loadu_pd(az + j)));
+                }
+                if (WithPotential) {
+                    sumPotential = _mm512_fmadd_pd(mj, invR, sumPotential);
+                    __m512d phi = _mm512_loadu_pd(potential + j);
+                    _mm512_storeu_pd(potential + j, _mm512_fmadd_pd(mi, invR, phi));
+                }
+            }
+            double sum[4] = {horizontalSum(sumX), horizontalSum(sumY), horizontalSum(sumZ),
+                             horizontalSum(sumPotential)};
+            rowScalar<Dim, WithPotential>(state, i, j, jEnd, softening2, ax, ay, az, potential,
+                                          sum);
+            ax[i] += sum[0];
+            ay[i] += sum[1];
+            if constexpr (Dim == 3) {
+                az[i] += sum[2];
+            }
+            if (WithPotential) {
+                potential[i] += sum[3];
+            }
+        }
+    }
+#endif
+
+    template <int Dim, bool WithPotential>
+    void dispatch(const BodyState& state, std::size_t iBegin, std::size_t iEnd,
+                  std::size_t jBegin, std::size_t jEnd, double* ax, double* ay, double* az,
+                  SimdLevel level, double softening2, double* potential) {
+#ifdef NB_HAVE_X86_SIMD
+        switch (level) {
+            case SimdLevel::Avx512:
+                tileAvx512<Dim, WithPotential>(state, iBegin, iEnd, jBegin, jEnd, ax, ay, az,
+                                               softening2, potential);
+                return;
+            case SimdLevel::Avx2:
+                tileAvx2<Dim, WithPotential>(state, iBegin, iEnd, jBegin, jEnd, ax, ay, az,
+                                             softening2, potential);
+                return;
+            case SimdLevel::Scalar:
+                break;
+        }
+#endif
+        tileScalar<Dim, WithPotential>(state, iBegin, iEnd, jBegin, jEnd, ax, ay, az,
+                                       softening2, potential);
+    }
+    }  //  namespace
+
+    void SymmetricForces::plan(std::size_t count) {
+        if (count == bodies && !roundStart.empty()) {
+            return;
+        }
+        bodies = count;
+        //  Aim for 16 blocks so a round has work for 8 threads, within L1-sized limits
+        block = std::clamp<std::size_t>((count / 16 + 7) / 8 * 8, 64, kMaxBlock);
+        const std::size_t blocks = (count + block - 1) / block;
+        schedule.clear();
+        roundStart.assign(1, 0);
+        //  Circle method: block `players - 1` stays put while the others rotate one place a
+        //  round, and position k plays position players - 1 - k. With an odd block count
+        //  the extra player is a bye, and the block drawn against it does its own tile.
+        const std::size_t players = blocks + blocks % 2;
+        for (std::size_t round = 0; round + 1 < players; ++round) {
+            for (std::size_t k = 0; k < players / 2; ++k) {
+                auto player = [&](std::size_t position) {
+                    return position + 1 == players ? position : (round + position) % (players - 1);
+                };
+                std::size_t a = player(k);
+                std::size_t b = player(players - 1 - k);
+                if (a >= blocks || b >= blocks) {
+                    a = b = std::min(a, b);
+                }
+                schedule.push_back({static_cast<std::uint32_t>(std::min(a, b)),
+                                    static_cast<std::uint32_t>(std::max(a, b))});
+            }
+            roundStart.push_back(schedule.size());
+        }
+        if (blocks % 2 == 0 && blocks > 0) {
+            for (std::size_t b = 0; b < blocks; ++b) {
+                schedule.push_back({static_cast<std::uint32_t>(b), static_cast<std::uint32_t>(b)});
+            }
+            roundStart.push_back(schedule.size());
+        }
+    }
+
+    std::size_t SymmetricForces::rounds() const {
+        return roundStart.empty() ? 0 : roundStart.size() - 1;
+    }
+
+    std::size_t SymmetricForces::tiles(std::size_t round) const {
+        return roundStart[round + 1] - roundStart[round];
+    }
+
+    void SymmetricForces::accumulate(const BodyState& state, std::size_t round,
+                                     std::size_t begin, std::size_t end, double* ax, double* ay,
+                                     double* az, SimdLevel level, double softening,
+                                     double* potential) const {
+        if (state.size() != bodies) {
+            throw std::logic_error("Symmetric force plan is for a different body count");
+        }
+        const double softening2 = softening * softening;
+        const bool is3D = state.dimensions == 3;
+        if (is3D && !az) {
+            throw std::invalid_argument("3D bodies need a buffer for z accelerations");
+        }
+        for (std::size_t t = roundStart[round] + begin; t < roundStart[round] + end; ++t) {
+            const std::size_t iBegin = schedule[t].first * block;
+            const std::size_t iEnd = std::min(iBegin + block, bodies);
+            const std::size_t jBegin = schedule[t].second * block;
+            const std::size_t jEnd = std::min(jBegin + block, bodies);
+            if (is3D) {
+                if (potential) {
+                    dispatch<3, true>(state, iBegin, iEnd, jBegin, jEnd, ax, ay, az, level,
+                                      softening2, potential);
+                } else {
+                    dispatch<3, false>(state, iBegin, iEnd, jBegin, jEnd, ax, ay, az, level,
+                                       softening2, nullptr);
+                }
+            } else if (potential) {
+                dispatch<2, true>(state, iBegin, iEnd, jBegin, jEnd, ax, ay, nullptr, level,
+                                  softening2, potential);
+            } else {
+                dispatch<2, false>(state, iBegin, iEnd, jBegin, jEnd, ax, ay, nullptr, level,
+                                   softening2, nullptr);
+            }
+        }
+    }
+
+    void SymmetricForces::finish(const BodyState& state, std::size_t begin, std::size_t end,
+                                 double* ax, double* ay, double* az, double* potential) {
+        const bool is3D = state.dimensions == 3;
+        for (std::size_t i = begin; i < end; ++i) {
+            ax[i] *= G;
+            ay[i] *= G;
+            if (is3D) {
+                az[i] *= G;
+            }
+            if (potential) {
+                potential[i] *= -G;
+            }
+        }
+    }
+}  //  namespace NB
@@ -0,0 +1,60 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef SYMMETRICFORCES_HPP
+#define SYMMETRICFORCES_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "BodyState.hpp"
+#include "ForceKernels.hpp"
+
+namespace NB {
+
+// Direct summation that evaluates each pair once and applies it to both bodies
+// with opposite signs (Newton's third law), so a pass does half the separations,
+// square roots and divisions of the other direct kernels.
+//
+// Bodies are cut into blocks of at most kMaxBlock, so the positions, masses and
+// sums of two blocks stay in L1, and a tile is one pair of blocks (or one block
+// with itself). Tiles are scheduled by the circle method for round-robin
+// tournaments: within a round no two tiles share a block, so the tiles of one
+// round can run on different threads writing straight into the shared sums,
+// with no locks and no per-thread copies. Rounds run one after another. The
+// block size depends only on the body count, so every body's sum is added in
+// the same order however many threads run the rounds.
+class SymmetricForces {
+ public:
+    static constexpr std::size_t kMaxBlock = 256;
+
+    // Splits `bodies` bodies into blocks and schedules their tiles; does nothing
+    // if the count is unchanged.
+    void plan(std::size_t bodies);
+    std::size_t rounds() const;
+    std::size_t tiles(std::size_t round) const;
+    // Adds tiles [begin, end) of `round` into the sums ax, ay, az (3D only) and
+    // potential (optional), which must be zeroed before the first round. Tiles of
+    // one round may run concurrently on disjoint ranges.
+    void accumulate(const BodyState& state, std::size_t round, std::size_t begin,
+                    std::size_t end, double* ax, double* ay, double* az, SimdLevel level,
+                    double softening = 0, double* potential = nullptr) const;
+    // Turns the sums of bodies [begin, end) into accelerations and potentials
+    // once every round has run.
+    static void finish(const BodyState& state, std::size_t begin, std::size_t end,
+                       double* ax, double* ay, double* az, double* potential = nullptr);
+
+ private:
+    struct Tile {
+        std::uint32_t first;   // Block the targets come from
+        std::uint32_t second;  // Block the sources come from; equal to first on the diagonal
+    };
+
+    std::size_t bodies = 0;
+    std::size_t block = 0;               // Bodies per block, the last one may be short
+    std::vector<Tile> schedule;          // Tiles grouped by round
+    std::vector<std::size_t> roundStart; // Index of each round's first tile, plus the end
+};
+
+}  //  namespace NB
+
+#endif  //  SYMMETRICFORCES_HPP
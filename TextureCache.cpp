@@ -0,0 +1,106 @@
+//  Copyright 2024 Vy Tran
+
+#include "TextureCache.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+
+namespace NB {
+    TextureCache& TextureCache::shared() {
+        static TextureCache cache;
+        return cache;
+    }
+
+    std::shared_ptr<sf::Texture> TextureCache::get(const std::string& filename) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = textures.find(filename);
+        if (found != textures.end()) {
+            return found->second;
+        }
+
+        auto texture = std::make_shared<sf::Texture>();
+        bool loaded;
+        auto queued = std::find_if(queue.begin(), queue.end(), [&](const auto& entry) {
+            return entry.first == filename;
+        });
+        if (queued != queue.end()) {
+            // Not started yet: quicker to load it here than to wait for the decoders
+            queue.erase(queued);
+            pending.erase(filename);
+        }
+        auto prefetched = pending.find(filename);
+        if (prefetched != pending.end()) {
+            // Being decoded, which finishes without the lock held here
+            std::unique_ptr<sf::Image> image = prefetched->second.get();
+            pending.erase(prefetched);
+            loaded = image && texture->loadFromImage(*image);
+        } else {
+            loaded = texture->loadFromFile("assets/" + filename);
+        }
+        if (!loaded) {
+            std::cerr << "Could not load image: " + filename << std::endl;
+            texture = nullptr;
+        }
+        textures.emplace(filename, texture);
+        return texture;
+    }
+
+    void TextureCache::prefetch(const std::vector<std::string>& names) {
+        // Bodies usually come in runs of the same texture, so most names are skipped
+        // by the comparison with the previous one before reaching the set
+        std::unordered_set<std::string_view> seen;
+        const std::string* previous = nullptr;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const std::string& name : names) {
+            if ((previous && name == *previous) || !seen.insert(name).second) {
+                previous = &name;
+                continue;
+            }
+            previous = &name;
+            if (textures.count(name) || pending.count(name)) {
+                continue;
+            }
+            queue.emplace_back(name, Decode());
+            pending.emplace(name, queue.back().second.get_future());
+        }
+        decoders.erase(std::remove_if(decoders.begin(), decoders.end(), [](const auto& decoder) {
+            return decoder.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        }), decoders.end());
+        while (decoding < kMaxDecoders && decoding < queue.size()) {
+            ++decoding;
+            decoders.push_back(std::async(std::launch::async, &TextureCache::decodeQueued, this));
+        }
+    }
+
+    void TextureCache::decodeQueued() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!queue.empty()) {
+            std::string name = std::move(queue.front().first);
+            Decode decode = std::move(queue.front().second);
+            queue.pop_front();
+            lock.unlock();
+            auto image = std::make_unique<sf::Image>();
+            if (!image->loadFromFile("assets/" + name)) {
+                image.reset();
+            }
+            decode.set_value(std::move(image));
+            lock.lock();
+        }
+        --decoding;
+    }
+
+    std::size_t TextureCache::size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return textures.size();
+    }
+
+    void TextureCache::clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        textures.clear();
+        pending.clear();
+        queue.clear();
+    }
+}  //  namespace NB
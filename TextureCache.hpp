@@ -0,0 +1,55 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef TEXTURECACHE_HPP
+#define TEXTURECACHE_HPP
+
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <SFML/Graphics.hpp>
+
+namespace NB {
+
+// Textures from assets/ keyed by filename, so each image is decoded once no
+// matter how many bodies use it. Failed loads are remembered too.
+class TextureCache {
+ public:
+    // Cache shared by every universe and body in the process.
+    static TextureCache& shared();
+
+    // Texture for assets/<filename>, loading it on first use; null if it can't be loaded.
+    std::shared_ptr<sf::Texture> get(const std::string& filename);
+    // Queues the distinct images named in `names` not requested before for decoding
+    // on at most kMaxDecoders background threads. get() then only waits for the
+    // decode and uploads the image, which has to happen on the thread that draws;
+    // an image still queued is taken off the queue and loaded by get() itself.
+    void prefetch(const std::vector<std::string>& names);
+    // Number of distinct filenames requested so far.
+    std::size_t size() const;
+    void clear();
+
+    // Background decoding threads at most, however many images are queued.
+    static constexpr unsigned kMaxDecoders = 4;
+
+ private:
+    using Decode = std::promise<std::unique_ptr<sf::Image>>;
+
+    void decodeQueued();
+
+    mutable std::mutex mutex;
+    std::map<std::string, std::shared_ptr<sf::Texture>> textures;
+    std::map<std::string, std::future<std::unique_ptr<sf::Image>>> pending;  // Prefetched
+    std::deque<std::pair<std::string, Decode>> queue;  // Prefetched, not started yet
+    unsigned decoding = 0;  // Decoder threads still taking from the queue
+    // Last, so they are joined while the queue and mutex they use still exist.
+    std::vector<std::future<void>> decoders;
+};
+
+}  //  namespace NB
+
+#endif  //  TEXTURECACHE_HPP
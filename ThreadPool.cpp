@@ -0,0 +1,96 @@
+//  Copyright 2024 Vy Tran
+
+#include "ThreadPool.hpp"
+#include <algorithm>
+
+namespace NB {
+    ThreadPool::ThreadPool(unsigned threads)
+    : task(nullptr),
+      count(0),
+      chunk(0),
+      generation(0),
+      pending(0),
+      stopping(false) {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        workers.reserve(threads - 1);
+        for (unsigned worker = 1; worker < threads; ++worker) {
+            workers.emplace_back(&ThreadPool::workerLoop, this, worker);
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    unsigned ThreadPool::size() const {
+        return workers.size() + 1;
+    }
+
+    void ThreadPool::parallelFor(std::size_t n, const RangeTask& work, std::size_t grain) {
+        if (n == 0) {
+            return;
+        }
+        grain = std::max<std::size_t>(grain, 1);
+        const std::size_t threads = size();
+        std::size_t perThread = (n + threads - 1) / threads;
+        perThread = (perThread + grain - 1) / grain * grain;
+        if (workers.empty() || perThread >= n) {
+            work(0, n);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = &work;
+            count = n;
+            chunk = perThread;
+            pending = workers.size();
+            ++generation;
+        }
+        wake.notify_all();
+
+        runChunk(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pending == 0; });
+        task = nullptr;
+    }
+
+    void ThreadPool::workerLoop(unsigned worker) {
+        unsigned long seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) {
+                    return;
+                }
+                seen = generation;
+            }
+            runChunk(worker);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                --pending;
+            }
+            done.notify_one();
+        }
+    }
+
+    void ThreadPool::runChunk(unsigned worker) {
+        // task, count and chunk are only written while no chunk is running
+        const std::size_t begin = std::min(count, worker * chunk);
+        const std::size_t end = std::min(count, begin + chunk);
+        if (begin < end) {
+            (*task)(begin, end);
+        }
+    }
+}  //  namespace NB
@@ -0,0 +1,50 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace NB {
+
+// Fixed set of worker threads that live as long as the pool, so stepping a
+// universe never creates threads. The calling thread takes part in the work.
+class ThreadPool {
+ public:
+    using RangeTask = std::function<void(std::size_t begin, std::size_t end)>;
+
+    // Total number of threads, including the caller; 0 means one per core.
+    explicit ThreadPool(unsigned threads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const;
+    // Splits [0, n) into one contiguous chunk per thread, with chunk boundaries
+    // on multiples of `grain`, and blocks until every chunk has run.
+    void parallelFor(std::size_t n, const RangeTask& task, std::size_t grain = 1);
+
+ private:
+    void workerLoop(unsigned worker);
+    void runChunk(unsigned worker);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const RangeTask* task;   // Task of the current parallelFor, null between calls
+    std::size_t count;       // Number of items in the current parallelFor
+    std::size_t chunk;       // Items per thread, a multiple of the grain
+    unsigned long generation;  // Bumped for every parallelFor so workers see new work
+    unsigned pending;        // Workers that have not finished the current generation
+    bool stopping;
+};
+
+}  //  namespace NB
+
+#endif  //  THREADPOOL_HPP
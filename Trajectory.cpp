@@ -0,0 +1,268 @@
+//  Copyright 2024 Vy Tran
+
+#include "Trajectory.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include "Profiler.hpp"
+
+namespace NB {
+    namespace {
+    const char kMagic[8] = {'N', 'B', 'O', 'D', 'Y', 'T', 'R', 'J'};
+    const std::uint32_t kByteOrderMark = 0x01020304;
+    // Quantized deltas span +-2^23, which float32 holds exactly
+    const double kQuantumSteps = 8388608.0;
+
+    struct StreamHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byteOrder;
+        std::uint32_t encoding;
+        std::uint32_t reserved;
+        std::uint64_t interval;
+    };
+
+    struct FrameHeader {
+        std::uint64_t steps;
+        double elapsedTime;
+        std::uint64_t count;
+        std::uint32_t keyframe;  // Deltas are against zero rather than the previous frame
+        std::uint32_t dimensions;  // 0 in version 1 streams, which are 2D
+    };
+
+    template <typename T>
+    void writeRaw(std::ostream& out, const T* data, std::size_t count) {
+        out.write(reinterpret_cast<const char*>(data), count * sizeof(T));
+    }
+
+    template <typename T>
+    bool readRaw(std::istream& in, T* data, std::size_t count) {
+        in.read(reinterpret_cast<char*>(data), count * sizeof(T));
+        return static_cast<std::size_t>(in.gcount()) == count * sizeof(T);
+    }
+    }  //  namespace
+
+    TrajectoryEncoding trajectoryEncodingFromString(const std::string& name) {
+        if (name == "double") {
+            return TrajectoryEncoding::Double;
+        }
+        if (name == "delta") {
+            return TrajectoryEncoding::DeltaFloat;
+        }
+        throw std::invalid_argument("Unknown trajectory format: " + name);
+    }
+
+    std::string toString(TrajectoryEncoding encoding) {
+        return encoding == TrajectoryEncoding::Double ? "double" : "delta";
+    }
+
+    TrajectoryRecorder::TrajectoryRecorder(std::ostream& out, std::uint64_t interval,
+                                           TrajectoryEncoding encoding, std::size_t capacity)
+    : out(out),
+      interval(std::max<std::uint64_t>(interval, 1)),
+      encoding(encoding),
+      ring(std::max<std::size_t>(capacity, 1)),
+      head(0),
+      queued(0),
+      written(0),
+      stopping(false),
+      previousDimensions(2) {
+        StreamHeader header;
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.version = kTrajectoryVersion;
+        header.byteOrder = kByteOrderMark;
+        header.encoding = static_cast<std::uint32_t>(encoding);
+        header.reserved = 0;
+        header.interval = this->interval;
+        writeRaw(out, &header, 1);
+        writer = std::thread(&TrajectoryRecorder::writerLoop, this);
+    }
+
+    TrajectoryRecorder::~TrajectoryRecorder() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        notEmpty.notify_one();
+        writer.join();
+        out.flush();
+    }
+
+    void TrajectoryRecorder::record(const BodyState& state, const RunPosition& position) {
+        if (position.steps % interval != 0) {
+            return;
+        }
+        std::size_t tail;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            notFull.wait(lock, [this] { return queued < ring.size(); });
+            tail = (head + queued) % ring.size();
+        }
+        // The writer never touches a slot until it is queued, so fill it unlocked.
+        // Slots keep their capacity, so this allocates only while the ring warms up.
+        Frame& frame = ring[tail];
+        frame.steps = position.steps;
+        frame.elapsedTime = position.elapsedTime;
+        frame.columns[0].assign(state.x.begin(), state.x.end());
+        frame.columns[1].assign(state.y.begin(), state.y.end());
+        frame.columns[2].assign(state.vx.begin(), state.vx.end());
+        frame.columns[3].assign(state.vy.begin(), state.vy.end());
+        frame.columns[4].assign(state.z.begin(), state.z.end());
+        frame.columns[5].assign(state.vz.begin(), state.vz.end());
+        frame.dimensions = state.dimensions;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++queued;
+        }
+        notEmpty.notify_one();
+    }
+
+    void TrajectoryRecorder::flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return queued == 0; });
+        out.flush();
+    }
+
+    std::uint64_t TrajectoryRecorder::framesWritten() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return written;
+    }
+
+    void TrajectoryRecorder::writerLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            notEmpty.wait(lock, [this] { return queued > 0 || stopping; });
+            if (queued == 0) {
+                return;
+            }
+            const Frame& frame = ring[head];
+            lock.unlock();
+            write(frame);
+            lock.lock();
+            head = (head + 1) % ring.size();
+            --queued;
+            ++written;
+            notFull.notify_all();
+        }
+    }
+
+    void TrajectoryRecorder::write(const Frame& frame) {
+        NB_PROFILE_SCOPE(Trajectory);
+        const std::size_t n = frame.columns[0].size();
+        const int columns = 2 * frame.dimensions;
+        FrameHeader header;
+        header.steps = frame.steps;
+        header.elapsedTime = frame.elapsedTime;
+        header.count = n;
+        header.keyframe = previous[0].size() != n || previousDimensions != frame.dimensions
+                          || written == 0;
+        header.dimensions = frame.dimensions;
+        writeRaw(out, &header, 1);
+        previousDimensions = frame.dimensions;
+
+        if (encoding == TrajectoryEncoding::Double) {
+            for (int c = 0; c < columns; ++c) {
+                writeRaw(out, frame.columns[c].data(), n);
+            }
+            return;
+        }
+
+        quantized.resize(n);
+        for (int c = 0; c < columns; ++c) {
+            const std::vector<double>& column = frame.columns[c];
+            std::vector<double>& reconstructed = previous[c];
+            if (header.keyframe) {
+                reconstructed.assign(n, 0.0);
+            }
+            double largest = 0;
+            for (std::size_t i = 0; i < n; ++i) {
+                largest = std::max(largest, std::abs(column[i] - reconstructed[i]));
+            }
+            const double quantum = largest / kQuantumSteps;
+            for (std::size_t i = 0; i < n; ++i) {
+                const double steps = quantum > 0
+                                   ? std::nearbyint((column[i] - reconstructed[i]) / quantum) : 0;
+                quantized[i] = static_cast<float>(steps);
+                reconstructed[i] += quantum * quantized[i];
+            }
+            writeRaw(out, &quantum, 1);
+            writeRaw(out, quantized.data(), n);
+        }
+    }
+
+    TrajectoryReader::TrajectoryReader(std::istream& in)
+    : in(in) {
+        StreamHeader header;
+        if (!readRaw(in, &header, 1) || std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+            throw std::runtime_error("Not a trajectory stream");
+        }
+        if (header.version < 1 || header.version > kTrajectoryVersion
+            || header.byteOrder != kByteOrderMark
+            || header.encoding > static_cast<std::uint32_t>(TrajectoryEncoding::DeltaFloat)) {
+            throw std::runtime_error("Unsupported trajectory version, byte order or encoding");
+        }
+        mEncoding = static_cast<TrajectoryEncoding>(header.encoding);
+        mInterval = header.interval;
+    }
+
+    TrajectoryEncoding TrajectoryReader::encoding() const {
+        return mEncoding;
+    }
+
+    std::uint64_t TrajectoryReader::interval() const {
+        return mInterval;
+    }
+
+    bool TrajectoryReader::next(TrajectoryFrame& frame) {
+        FrameHeader header;
+        in.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (in.gcount() == 0) {
+            return false;
+        }
+        if (in.gcount() != sizeof(header)) {
+            throw std::runtime_error("Truncated trajectory frame");
+        }
+        const std::size_t n = header.count;
+        if (header.dimensions == 0) {
+            header.dimensions = 2;
+        }
+        if (header.dimensions != 2 && header.dimensions != 3) {
+            throw std::runtime_error("Unsupported trajectory frame dimensions");
+        }
+        frame.steps = header.steps;
+        frame.elapsedTime = header.elapsedTime;
+        frame.dimensions = header.dimensions;
+        frame.z.clear();
+        frame.vz.clear();
+        std::vector<double>* columns[6] = {&frame.x, &frame.y, &frame.vx, &frame.vy,
+                                           &frame.z, &frame.vz};
+        const int count = 2 * header.dimensions;
+
+        bool complete = true;
+        if (mEncoding == TrajectoryEncoding::Double) {
+            for (int c = 0; c < count; ++c) {
+                columns[c]->resize(n);
+                complete = complete && readRaw(in, columns[c]->data(), n);
+            }
+        } else {
+            quantized.resize(n);
+            for (int c = 0; c < count; ++c) {
+                std::vector<double>& reconstructed = previous[c];
+                if (header.keyframe || reconstructed.size() != n) {
+                    reconstructed.assign(n, 0.0);
+                }
+                double quantum;
+                complete = complete && readRaw(in, &quantum, 1) && readRaw(in, quantized.data(), n);
+                for (std::size_t i = 0; complete && i < n; ++i) {
+                    reconstructed[i] += quantum * quantized[i];
+                }
+                columns[c]->assign(reconstructed.begin(), reconstructed.end());
+            }
+        }
+        if (!complete) {
+            throw std::runtime_error("Truncated trajectory frame");
+        }
+        return true;
+    }
+}  //  namespace NB
@@ -0,0 +1,112 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef TRAJECTORY_HPP
+#define TRAJECTORY_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BodyState.hpp"
+#include "Checkpoint.hpp"
+
+namespace NB {
+
+// How frames are stored in a trajectory stream.
+//   Double      x, y, vx, vy (then z, vz in 3D) columns as raw doubles; exact.
+//   DeltaFloat  each column as the change since the previous frame, in units of
+//               a per-frame quantum (the largest change / 2^23) stored as float32.
+//               The encoder tracks what the decoder will reconstruct, so errors
+//               stay within half a quantum instead of accumulating.
+enum class TrajectoryEncoding { Double, DeltaFloat };
+
+// Accepts "double" and "delta"; throws std::invalid_argument otherwise.
+TrajectoryEncoding trajectoryEncodingFromString(const std::string& name);
+std::string toString(TrajectoryEncoding encoding);
+
+// Stream layout (host byte order): header with magic "NBODYTRJ", version,
+// byte-order mark, encoding and recording interval, then one record per frame:
+// steps, elapsed time, body count, keyframe flag, dimensions and the four (or six)
+// columns. Version 1 streams, which are all 2D, still read.
+constexpr std::uint32_t kTrajectoryVersion = 2;
+
+// Records every `interval`th step to `out`. The stepping thread only copies the
+// state into a slot of a bounded ring buffer; encoding and writing happen on a
+// background thread. The stepping thread waits only if the writer falls a whole
+// ring behind.
+class TrajectoryRecorder {
+ public:
+    TrajectoryRecorder(std::ostream& out, std::uint64_t interval, TrajectoryEncoding encoding,
+                       std::size_t capacity = 16);
+    // Writes everything still queued, then stops the writer.
+    ~TrajectoryRecorder();
+    TrajectoryRecorder(const TrajectoryRecorder&) = delete;
+    TrajectoryRecorder& operator=(const TrajectoryRecorder&) = delete;
+
+    // Queues the state if `position.steps` is a multiple of the interval.
+    void record(const BodyState& state, const RunPosition& position);
+    // Blocks until every queued frame has been written and flushed.
+    void flush();
+    std::uint64_t framesWritten() const;
+
+ private:
+    struct Frame {
+        std::uint64_t steps = 0;
+        double elapsedTime = 0;
+        std::vector<double> columns[6];  // x, y, vx, vy, and z, vz in 3D
+        unsigned dimensions = 2;
+    };
+
+    void writerLoop();
+    void write(const Frame& frame);
+
+    std::ostream& out;
+    std::uint64_t interval;
+    TrajectoryEncoding encoding;
+    std::vector<Frame> ring;
+    std::size_t head;    // Oldest queued frame, owned by the writer while count > 0
+    std::size_t queued;  // Frames waiting to be written
+    std::uint64_t written;
+    bool stopping;
+    mutable std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::vector<double> previous[6];  // Writer side: what a decoder has reconstructed
+    unsigned previousDimensions;
+    std::vector<float> quantized;
+    std::thread writer;
+};
+
+// One decoded frame.
+struct TrajectoryFrame {
+    std::uint64_t steps = 0;
+    double elapsedTime = 0;
+    std::vector<double> x, y, vx, vy;
+    std::vector<double> z, vz;  // Empty unless dimensions == 3
+    unsigned dimensions = 2;
+};
+
+// Decodes a stream written by TrajectoryRecorder.
+class TrajectoryReader {
+ public:
+    // Reads the header; throws std::runtime_error if it is not a trajectory.
+    explicit TrajectoryReader(std::istream& in);
+    TrajectoryEncoding encoding() const;
+    std::uint64_t interval() const;
+    // False at the end of the stream; throws std::runtime_error on a truncated frame.
+    bool next(TrajectoryFrame& frame);
+
+ private:
+    std::istream& in;
+    TrajectoryEncoding mEncoding;
+    std::uint64_t mInterval;
+    std::vector<double> previous[6];
+    std::vector<float> quantized;
+};
+
+}  //  namespace NB
+
+#endif  //  TRAJECTORY_HPP
@@ -0,0 +1,55 @@
+//  Copyright 2024 Vy Tran
+
+#ifndef TRIPLEBUFFER_HPP
+#define TRIPLEBUFFER_HPP
+
+#include <atomic>
+
+namespace NB {
+
+// Lock-free single-producer/single-consumer triple buffer. The writer fills
+// back() and publishes it; the reader picks up the newest published slot with
+// update() and reads front(). Neither side ever waits for the other, and a
+// slot is never read and written at the same time.
+template <typename T>
+class TripleBuffer {
+ public:
+    TripleBuffer() : backIndex(0), frontIndex(1), middle(2) {}
+
+    // Writer side
+    T& back() {
+        return slots[backIndex];
+    }
+
+    void publish() {
+        unsigned previous = middle.exchange(backIndex | kFresh, std::memory_order_acq_rel);
+        backIndex = previous & kIndexMask;
+    }
+
+    // Reader side. Returns true if a newer slot was swapped in.
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & kFresh)) {
+            return false;
+        }
+        unsigned previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+        frontIndex = previous & kIndexMask;
+        return true;
+    }
+
+    const T& front() const {
+        return slots[frontIndex];
+    }
+
+ private:
+    static constexpr unsigned kIndexMask = 3;
+    static constexpr unsigned kFresh = 4;  // Set while the middle slot is unread
+
+    T slots[3];
+    unsigned backIndex;   // Owned by the writer
+    unsigned frontIndex;  // Owned by the reader
+    std::atomic<unsigned> middle;  // Slot in transit, plus the fresh flag
+};
+
+}  //  namespace NB
+
+#endif  //  TRIPLEBUFFER_HPP
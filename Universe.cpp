@@ -1,137 +1,327 @@
 //  Copyright 2024 Vy Tran
 
 #include "Universe.hpp"
+#include <algorithm>
 #include <cmath>
-#include <fstream>
 #include <iostream>
+#include <map>
+#include <stdexcept>
+#include <utility>
 #include <vector>
 #include <SFML/Graphics.hpp>
 #include <SFML/Graphics/Text.hpp>
 #include <SFML/Graphics/Font.hpp>
+#include "Loader.hpp"
+#include "Profiler.hpp"
+#include "TextureCache.hpp"
 
 namespace NB {
-    const double G = 6.67e-11;  // Gravitational constant
-
-    Universe::Universe() : mRadius(0) {
+    Universe::Universe()
+    : mCameraX(0), mCameraY(0), mZoom(1), mDetailLimit(8), texturesLayout(~std::uint64_t(0)) {
         if (!backgroundTexture.loadFromFile("assets/starfield.jpg")) {
             std::cerr << "Failed to load background image" << std::endl;
         }
     }
 
     Universe::Universe(const std::string& filename) : Universe() {
-        std::ifstream file(filename);
-        if (!file) {
-            std::cerr << "Failed to open file: " << filename << std::endl;
-            return;
+        try {
+            loadUniverse(filename, *this);
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
         }
-        file >> *this;
-        file.close();
     }
 
     void Universe::draw(sf::RenderTarget& target, sf::RenderStates states) const {
-        sf::Sprite backgroundSprite;
-        backgroundSprite.setTexture(backgroundTexture);
+        NB_PROFILE_SCOPE(Draw);
+        refreshTextures();
+        drawBackground(target, states);
+
+        // Then draw all celestial bodies on top of the background
+        drawBodies(target, states, state.x.data(), state.y.data(), state.size());
+    }
+
+    void Universe::drawSnapshot(sf::RenderTarget& target, const Snapshot& snapshot) const {
+        NB_PROFILE_SCOPE(Draw);
+        sf::RenderStates states;
+        drawBackground(target, states);
+
+        if (snapshot.layout != texturesLayout) {
+            loadTextures(snapshot.names, snapshot.layout);
+        }
+        drawBodies(target, states, snapshot.x.data(), snapshot.y.data(),
+                   std::min(snapshot.x.size(), snapshot.y.size()));
+    }
+
+    void Universe::drawBodies(sf::RenderTarget& target, sf::RenderStates states,
+                              const double* x, const double* y, std::size_t n) const {
+        NB_PROFILE_SCOPE(DrawBodies);
+        // Every body becomes a textured quad (two triangles) in its texture's vertex
+        // array, so a frame costs one draw call per distinct texture instead of per body
+        batches.resize(textures.size());
+        for (auto& batch : batches) {
+            batch.setPrimitiveType(sf::Triangles);
+            batch.clear();
+        }
+        splats.setPrimitiveType(sf::Triangles);
+        splats.clear();
+        stats = DrawStats();
+        n = std::min(n, textureIndex.size());
+        const sf::Vector2u targetSize = target.getSize();
+        const float width = static_cast<float>(targetSize.x);
+        const float height = static_cast<float>(targetSize.y);
+        const std::uint32_t columns = (targetSize.x + kCellPixels - 1) / kCellPixels;
+        const std::uint32_t rows = (targetSize.y + kCellPixels - 1) / kCellPixels;
+        cellCount.assign(static_cast<std::size_t>(columns) * rows, 0);
+        cellSum.assign(cellCount.size(), sf::Vector2f());
+        projected.resize(n);
+        cellOf.resize(n);
+
+        // Project, cull and count the bodies of each cell
+        for (std::size_t i = 0; i < n; ++i) {
+            cellOf[i] = kCulled;
+            const std::size_t t = textureIndex[i];
+            if (!textures[t] || columns == 0 || rows == 0) {
+                continue;
+            }
+            const sf::Vector2u size = textures[t]->getSize();
+            const sf::Vector2f center = toScreen(x[i], y[i], targetSize);
+            const float halfW = size.x / 2.0f;
+            const float halfH = size.y / 2.0f;
+            if (!(center.x + halfW >= 0 && center.x - halfW <= width
+                  && center.y + halfH >= 0 && center.y - halfH <= height)) {
+                ++stats.culled;
+                continue;
+            }
+            // A sprite hanging over the edge counts toward the edge cell
+            const float column = std::clamp(center.x / kCellPixels, 0.0f, columns - 1.0f);
+            const float row = std::clamp(center.y / kCellPixels, 0.0f, rows - 1.0f);
+            const std::uint32_t cell = static_cast<std::uint32_t>(row) * columns
+                                     + static_cast<std::uint32_t>(column);
+            projected[i] = center;
+            cellOf[i] = cell;
+            ++cellCount[cell];
+            cellSum[cell] += center;
+        }
+
+        for (std::size_t i = 0; i < n; ++i) {
+            const std::uint32_t cell = cellOf[i];
+            if (cell == kCulled) {
+                continue;
+            }
+            if (mDetailLimit > 0 && cellCount[cell] > mDetailLimit) {
+                ++stats.merged;
+                continue;
+            }
+            const std::size_t t = textureIndex[i];
+            const sf::Vector2u size = textures[t]->getSize();
+            const float w = static_cast<float>(size.x);
+            const float h = static_cast<float>(size.y);
+            const sf::Vector2f topLeft(projected[i].x - w / 2, projected[i].y - h / 2);
+            const sf::Vertex corners[4] = {
+                sf::Vertex(topLeft, sf::Vector2f(0, 0)),
+                sf::Vertex(sf::Vector2f(topLeft.x + w, topLeft.y), sf::Vector2f(w, 0)),
+                sf::Vertex(sf::Vector2f(topLeft.x + w, topLeft.y + h), sf::Vector2f(w, h)),
+                sf::Vertex(sf::Vector2f(topLeft.x, topLeft.y + h), sf::Vector2f(0, h))
+            };
+            sf::VertexArray& batch = batches[t];
+            for (int corner : {0, 1, 2, 0, 2, 3}) {
+                batch.append(corners[corner]);
+            }
+            ++stats.sprites;
+        }
 
+        // One splat per dense cell, a cell wide at the centroid of its bodies, with
+        // brightness growing with the log of the count
+        if (mDetailLimit > 0) {
+            for (std::size_t cell = 0; cell < cellCount.size(); ++cell) {
+                const std::uint32_t count = cellCount[cell];
+                if (count <= mDetailLimit) {
+                    continue;
+                }
+                const sf::Vector2f center = cellSum[cell] * (1.0f / count);
+                const float half = kCellPixels / 2.0f;
+                const float level = std::min(1.0f, 0.25f * std::log2(static_cast<float>(count)));
+                const sf::Color color(255, 244, 214, static_cast<std::uint8_t>(255 * level));
+                const sf::Vertex corners[4] = {
+                    sf::Vertex(sf::Vector2f(center.x - half, center.y - half), color),
+                    sf::Vertex(sf::Vector2f(center.x + half, center.y - half), color),
+                    sf::Vertex(sf::Vector2f(center.x + half, center.y + half), color),
+                    sf::Vertex(sf::Vector2f(center.x - half, center.y + half), color)
+                };
+                for (int corner : {0, 1, 2, 0, 2, 3}) {
+                    splats.append(corners[corner]);
+                }
+                ++stats.splats;
+            }
+        }
+
+        for (std::size_t t = 0; t < batches.size(); ++t) {
+            if (textures[t] && batches[t].getVertexCount() > 0) {
+                states.texture = textures[t].get();
+                target.draw(batches[t], states);
+            }
+        }
+        if (splats.getVertexCount() > 0) {
+            states.texture = nullptr;
+            states.blendMode = sf::BlendAdd;
+            target.draw(splats, states);
+        }
+    }
+
+    void Universe::drawBackground(sf::RenderTarget& target, sf::RenderStates states) const {
+        NB_PROFILE_SCOPE(DrawBackground);
         // Get the size of the target window and the texture
         sf::Vector2u windowSize = target.getSize();
         sf::Vector2u textureSize = backgroundTexture.getSize();
+        if (!background || backgroundSize.x != windowSize.x
+            || backgroundSize.y != windowSize.y) {
+            // Render the scaled starfield once per target size rather than every frame
+            background = std::make_unique<sf::RenderTexture>();
+            if (background->create(windowSize.x, windowSize.y)) {
+                backgroundSize = windowSize;
+                sf::Sprite backgroundSprite;
+                backgroundSprite.setTexture(backgroundTexture);
 
-        // Calculate the scale factors for the sprite to cover the whole window
-        float scaleX = static_cast<float>(windowSize.x) / textureSize.x;
-        float scaleY = static_cast<float>(windowSize.y) / textureSize.y;
-
-        // Use the larger scale factor to ensure full coverage
-        float scale = std::max(scaleX, scaleY);
+                // Calculate the scale factors for the sprite to cover the whole window
+                float scaleX = static_cast<float>(windowSize.x) / textureSize.x;
+                float scaleY = static_cast<float>(windowSize.y) / textureSize.y;
 
-        // Set the scale of the sprite
-        backgroundSprite.setScale(scale, scale);
+                // Use the larger scale factor to ensure full coverage
+                float scale = std::max(scaleX, scaleY);
+                backgroundSprite.setScale(scale, scale);
+                background->clear();
+                background->draw(backgroundSprite);
+                background->display();
+            } else {
+                background.reset();
+                backgroundSize = sf::Vector2u();
+                std::cerr << "Failed to create background render texture" << std::endl;
+                return;
+            }
+        }
 
-        // Draw the scaled sprite as the background
+        // Draw the cached background unscaled
+        sf::Sprite backgroundSprite(background->getTexture());
         target.draw(backgroundSprite, states);
+    }
 
-        // Then draw all celestial bodies on top of the background
-        for (const auto& body : bodies) {
-            target.draw(body, states);
+    void Universe::setCamera(double x, double y, double zoom) {
+        if (!(zoom > 0)) {
+            throw std::invalid_argument("Universe: zoom must be positive");
         }
+        mCameraX = x;
+        mCameraY = y;
+        mZoom = zoom;
     }
 
-    double Universe::radius() const {
-        return mRadius;
+    double Universe::cameraX() const {
+        return mCameraX;
     }
 
-    int Universe::numPlanets() const {
-        return bodies.size();
+    double Universe::cameraY() const {
+        return mCameraY;
     }
 
-    CelestialBody& Universe::operator[](int index) {
-        return bodies.at(index);  // Use .at() for bounds checking
+    double Universe::zoom() const {
+        return mZoom;
     }
 
-    const CelestialBody& Universe::operator[](int index) const {
-        return bodies.at(index);  // Use .at() for bounds checking
+    sf::Vector2f Universe::toScreen(double x, double y, const sf::Vector2u& size) const {
+        // The original mapping, with the view's center and a smaller universe radius
+        return CelestialBody::toScreen(x - mCameraX, y - mCameraY, size, mRadius / mZoom);
     }
 
-    std::ostream& operator<<(std::ostream& out, const Universe& universe) {
-        out << universe.bodies.size() << std::endl << universe.mRadius << std::endl;
-        for (const auto& body : universe.bodies) {
-            out << body << std::endl;
-        }
-        return out;
+    void Universe::pan(float dx, float dy, const sf::Vector2u& size) {
+        const double metersPerPixel = 2.0 * mRadius / mZoom / std::min(size.x, size.y);
+        mCameraX -= dx * metersPerPixel;
+        mCameraY += dy * metersPerPixel;  // Y is going up.
     }
 
-    std::istream& operator>>(std::istream& in, Universe& universe) {
-        int numberOfBodies;
-        in >> numberOfBodies >> universe.mRadius;
+    void Universe::zoomAt(double factor, const sf::Vector2i& pixel, const sf::Vector2u& size) {
+        // Offset of the pixel from the center in meters, before and after; the camera
+        // moves by the difference so the universe point under the pixel stays put
+        const double offsetX = pixel.x - size.x / 2.0;
+        const double offsetY = size.y / 2.0 - pixel.y;
+        const double before = 2.0 * mRadius / mZoom / std::min(size.x, size.y);
+        setCamera(mCameraX, mCameraY, mZoom * factor);
+        const double after = 2.0 * mRadius / mZoom / std::min(size.x, size.y);
+        mCameraX += offsetX * (before - after);
+        mCameraY += offsetY * (before - after);
+    }
 
-        universe.bodies.clear();
-        universe.bodies.reserve(numberOfBodies);
-        for (int i = 0; i < numberOfBodies; ++i) {
-            CelestialBody body = CelestialBody(universe.radius());
-            in >> body;
-            universe.bodies.push_back(body);
-        }
-        return in;
+    void Universe::setDetailLimit(std::size_t limit) {
+        mDetailLimit = limit;
     }
 
-    void Universe::step(double seconds) {
-        for (auto& body : bodies) {
-            double netFx = 0.0;
-            double netFy = 0.0;
+    std::size_t Universe::detailLimit() const {
+        return mDetailLimit;
+    }
 
-            // Calculate the net force on this body
-            for (const auto& otherBody : bodies) {
-                //  Make sure we're not calculating a body's force on itself
-                if (&body != &otherBody) {
-                    auto force = calculateGravitationalForce(body, otherBody);
-                    netFx += force.first;
-                    netFy += force.second;
-                }
-            }
+    const DrawStats& Universe::drawStats() const {
+        return stats;
+    }
 
-            // Apply the net force to the body
-            body.applyForce(netFx, netFy, seconds);
+    CelestialBody Universe::operator[](int index) {
+        if (index < 0 || index >= numPlanets()) {
+            throw std::out_of_range("Universe: body index out of range");
         }
+        return CelestialBody(&state, index, texture(index), mRadius);
     }
 
-    // Function to calculate gravitational force between two celestial bodies
-    std::pair<double, double> Universe::calculateGravitationalForce
-    (const CelestialBody& body, const CelestialBody& otherBody) {
-        double dx = otherBody.position().x - body.position().x;  // Difference in x positions
-        double dy = otherBody.position().y - body.position().y;  // Difference in y positions
-        double distanceSquared = dx * dx + dy * dy;  // Square of the distance between the bodies
-        double distance = std::sqrt(distanceSquared);  // Distance between the bodies
+    const CelestialBody Universe::operator[](int index) const {
+        if (index < 0 || index >= numPlanets()) {
+            throw std::out_of_range("Universe: body index out of range");
+        }
+        //  The returned view is const, so the cast never leads to a write.
+        return CelestialBody(const_cast<BodyState*>(&state), index, texture(index), mRadius);
+    }
 
-        if (distance == 0) {
-            return {0, 0};  // Avoid division by zero
+    std::size_t Universe::textureCount() const {
+        refreshTextures();
+        return textures.size();
+    }
+
+    std::shared_ptr<sf::Texture> Universe::texture(int index) const {
+        refreshTextures();
+        if (static_cast<std::size_t>(index) >= textureIndex.size()) {
+            return nullptr;
         }
+        return textures[textureIndex[index]];
+    }
 
-        // Magnitude of the gravitational force
-        double forceMagnitude = G * body.mass() * otherBody.mass() / distanceSquared;
-        double fx = forceMagnitude * dx / distance;  // x component of the gravitational force
-        double fy = forceMagnitude * dy / distance;  // y component of the gravitational force
+    std::istream& operator>>(std::istream& in, Universe& universe) {
+        in >> static_cast<Simulation&>(universe);
+        TextureCache::shared().prefetch(universe.state.names);
+        return in;
+    }
 
-        return {fx, fy};
+    void Universe::load(BodyState bodies, double radius) {
+        Simulation::load(std::move(bodies), radius);
+        TextureCache::shared().prefetch(state.names);
     }
 
-}  //  namespace NB
+    void Universe::refreshTextures() const {
+        if (texturesLayout != layoutVersion()) {
+            loadTextures(state.names, layoutVersion());
+        }
+    }
 
+    void Universe::loadTextures(const std::vector<std::string>& names,
+                                std::uint64_t layout) const {
+        // Bodies sharing a filename share one texture, in order of first appearance
+        texturesLayout = layout;
+        textures.clear();
+        textureIndex.clear();
+        textureIndex.reserve(names.size());
+        std::map<std::string, std::size_t> indexOf;
+        for (const std::string& name : names) {
+            auto found = indexOf.find(name);
+            if (found == indexOf.end()) {
+                found = indexOf.emplace(name, textures.size()).first;
+                textures.push_back(TextureCache::shared().get(name));
+            }
+            textureIndex.push_back(found->second);
+        }
+    }
+
+}  //  namespace NB
@@ -4,30 +4,99 @@
 #define UNIVERSE_HPP
 
 #include <iostream>
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 #include <SFML/Graphics.hpp>
 #include "CelestialBody.hpp"
+#include "PhysicsThread.hpp"
+#include "Simulation.hpp"
 
 namespace NB {
 
-class Universe : public sf::Drawable {
+//  What the latest draw did with the bodies.
+struct DrawStats {
+    std::size_t sprites = 0;  //  Bodies drawn as their own sprite
+    std::size_t merged = 0;   //  Bodies drawn as part of a density splat
+    std::size_t splats = 0;   //  Splats drawn
+    std::size_t culled = 0;   //  Bodies whose sprite lay entirely off the target
+};
+
+//  A Simulation that can be drawn: adds body textures and the background.
+//
+//  Bodies are binned into a grid of kCellPixels screen cells as they are projected.
+//  A cell holding more than detailLimit() bodies is drawn as one additive splat at
+//  their centroid, brighter the more bodies it holds, instead of a pile of
+//  overlapping sprites, and bodies whose sprite would land off the target are
+//  skipped. The scaled starfield is rendered once into a texture the size of the
+//  target and redrawn only when that size changes.
+class Universe : public Simulation, public sf::Drawable {
  public:
+    static constexpr unsigned kCellPixels = 16;
+
     Universe();
     explicit Universe(const std::string& filename);
+    //  Reads the state like Simulation does and starts decoding the body textures, which
+    //  are uploaded on first use.
     friend std::istream& operator>>(std::istream& in, Universe& universe);
-    friend std::ostream& operator<<(std::ostream& out, const Universe& universe);
+    void load(BodyState bodies, double radius) override;
     void draw(sf::RenderTarget& target, sf::RenderStates states) const override;
-    double radius() const;
-    int numPlanets() const;
-    void step(double seconds);
-    CelestialBody& operator[](int index);
-    const CelestialBody& operator[](int index) const;
+    //  Draws published positions instead of the live state, which the physics thread owns.
+    void drawSnapshot(sf::RenderTarget& target, const Snapshot& snapshot) const;
+    //  Distinct textures used by the bodies; one draw call is issued per texture.
+    std::size_t textureCount() const;
+    //  Pan and zoom. The view is centered on universe point (x, y) and the smaller side
+    //  of the target spans radius() / zoom on either side of it; (0, 0) at zoom 1 is
+    //  the whole universe, as before.
+    void setCamera(double x, double y, double zoom);
+    double cameraX() const;
+    double cameraY() const;
+    double zoom() const;
+    //  Moves the view along with a drag of (dx, dy) pixels on a target of `size`.
+    void pan(float dx, float dy, const sf::Vector2u& size);
+    //  Zooms in by `factor`, or out below 1, keeping the point under `pixel` in place.
+    void zoomAt(double factor, const sf::Vector2i& pixel, const sf::Vector2u& size);
+    //  Where universe point (x, y) lands on a target of `size` through the camera.
+    sf::Vector2f toScreen(double x, double y, const sf::Vector2u& size) const;
+    //  Most bodies a screen cell draws as sprites before it becomes a splat; 0 draws
+    //  every body as a sprite.
+    void setDetailLimit(std::size_t limit);
+    std::size_t detailLimit() const;
+    const DrawStats& drawStats() const;
+    //  Bodies are handed out as views into the universe's state arrays.
+    CelestialBody operator[](int index);
+    const CelestialBody operator[](int index) const;
  private:
     sf::Texture backgroundTexture;
-    std::vector<CelestialBody> bodies;  //  Container for all celestial bodies in the universe
-    double mRadius;  //  Radius of the universe, used for scaling
-    std::pair<double, double> calculateGravitationalForce
-    (const CelestialBody& body, const CelestialBody& otherBody);
+    //  Starfield scaled to the target, null until the first draw or if it can't be made
+    mutable std::unique_ptr<sf::RenderTexture> background;
+    mutable sf::Vector2u backgroundSize;  //  Target size `background` was rendered for
+    double mCameraX;
+    double mCameraY;
+    double mZoom;
+    std::size_t mDetailLimit;
+    mutable DrawStats stats;
+    //  Built lazily for the body layout being drawn, which with a physics thread is the
+    //  published snapshot's rather than the live state's
+    mutable std::vector<std::shared_ptr<sf::Texture>> textures;  //  Null if unloadable
+    mutable std::vector<std::size_t> textureIndex;  //  Per body, index into `textures`
+    mutable std::uint64_t texturesLayout;  //  Layout version the two above were built for
+    mutable std::vector<sf::VertexArray> batches;  //  One vertex array per texture, reused
+    mutable sf::VertexArray splats;  //  Dense cells, drawn after the sprites
+    //  Per-frame scratch of the screen grid, kept to avoid reallocating
+    mutable std::vector<sf::Vector2f> projected;  //  Screen position of each body
+    mutable std::vector<std::uint32_t> cellOf;    //  Cell of each body, kCulled if off target
+    mutable std::vector<std::uint32_t> cellCount;
+    mutable std::vector<sf::Vector2f> cellSum;    //  Sum of the positions in each cell
+    static constexpr std::uint32_t kCulled = ~std::uint32_t(0);
+    std::shared_ptr<sf::Texture> texture(int index) const;
+    void loadTextures(const std::vector<std::string>& names, std::uint64_t layout) const;
+    //  Rebuilds the texture table if bodies merged since it was built.
+    void refreshTextures() const;
+    void drawBackground(sf::RenderTarget& target, sf::RenderStates states) const;
+    void drawBodies(sf::RenderTarget& target, sf::RenderStates states,
+                    const double* x, const double* y, std::size_t n) const;
 };
 
 }  //  namespace NB
@@ -0,0 +1,230 @@
+//  Copyright 2024 Vy Tran
+
+// NBodyBench: times Simulation::step per backend on synthetic and bundled
+// universes and prints the results as JSON, for regression tracking and for
+// choosing a backend per workload. Progress goes to stderr.
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Simulation.hpp"
+
+// Every heap allocation in the process goes through here so the bench can
+// report allocations per step.
+static std::atomic<unsigned long> allocations(0);
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+namespace {
+
+struct Settings {
+    std::size_t maxBodies = 1000000;
+    std::size_t maxDirectBodies = 20000;  // Larger N takes minutes per direct-sum step
+    unsigned threads = 1;
+    double minSeconds = 0.5;  // Keep stepping a case at least this long...
+    unsigned maxSteps = 200;  // ...but no more than this many steps
+};
+
+struct Workload {
+    std::string name;
+    NB::BodyState bodies;
+    double radius;
+    double deltaT;
+};
+
+const double kSolarMass = 1.989e30;
+
+// N equal-mass bodies spread uniformly over a disk, each on the circular orbit
+// set by the mass inside its radius.
+Workload uniformDisk(std::size_t n) {
+    Workload workload{"uniform-disk", NB::BodyState(), 2.5e11, 25000.0};
+    std::mt19937_64 random(n);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    const double totalMass = kSolarMass;
+    workload.bodies.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        const double r = workload.radius * std::sqrt(unit(random));
+        const double angle = 2 * M_PI * unit(random);
+        const double enclosed = totalMass * (r / workload.radius) * (r / workload.radius);
+        const double speed = r > 0 ? std::sqrt(NB::G * enclosed / r) : 0;
+        workload.bodies.x[i] = r * std::cos(angle);
+        workload.bodies.y[i] = r * std::sin(angle);
+        workload.bodies.vx[i] = -speed * std::sin(angle);
+        workload.bodies.vy[i] = speed * std::cos(angle);
+        workload.bodies.mass[i] = totalMass / n;
+        workload.bodies.names[i] = "earth.gif";
+    }
+    return workload;
+}
+
+// Plummer sphere seen face-on: radii drawn from the Plummer mass profile, so
+// the core is much denser than the halo, on circular orbits.
+Workload plummer(std::size_t n) {
+    Workload workload{"plummer", NB::BodyState(), 2.5e11, 25000.0};
+    std::mt19937_64 random(n + 1);
+    std::uniform_real_distribution<double> unit(1e-6, 1.0);
+    const double totalMass = kSolarMass;
+    const double scale = workload.radius / 10;
+    workload.bodies.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        const double r = std::min(workload.radius,
+                                  scale / std::sqrt(std::pow(unit(random), -2.0 / 3.0) - 1));
+        const double angle = 2 * M_PI * unit(random);
+        const double enclosed = totalMass * std::pow(r * r / (r * r + scale * scale), 1.5);
+        const double speed = std::sqrt(NB::G * enclosed / r);
+        workload.bodies.x[i] = r * std::cos(angle);
+        workload.bodies.y[i] = r * std::sin(angle);
+        workload.bodies.vx[i] = -speed * std::sin(angle);
+        workload.bodies.vy[i] = speed * std::cos(angle);
+        workload.bodies.mass[i] = totalMass / n;
+        workload.bodies.names[i] = "earth.gif";
+    }
+    return workload;
+}
+
+Workload asset(const std::string& name, double deltaT) {
+    NB::Simulation simulation;
+    std::ifstream file("assets/" + name);
+    if (!(file >> simulation)) {
+        throw std::runtime_error("Failed to read assets/" + name);
+    }
+    return Workload{name, simulation.bodies(), simulation.radius(), deltaT};
+}
+
+// Times one workload on one backend and prints its JSON object.
+void run(const Workload& workload, NB::ForceBackend backend, NB::Precision precision,
+         const Settings& settings, bool first) {
+    using Clock = std::chrono::steady_clock;
+    NB::Simulation simulation;
+    simulation.load(workload.bodies, workload.radius);
+    simulation.setForceBackend(backend);
+    simulation.setPrecision(precision);
+    simulation.setThreads(settings.threads);
+
+    // One untimed step sizes the scratch buffers and starts the thread pool
+    simulation.step(workload.deltaT);
+    const std::size_t evaluationsBefore = simulation.forceEvaluations();
+    const unsigned long allocationsBefore = allocations.load();
+    const auto start = Clock::now();
+    unsigned steps = 0;
+    double seconds = 0;
+    do {
+        simulation.step(workload.deltaT);
+        ++steps;
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (seconds < settings.minSeconds && steps < settings.maxSteps);
+    const unsigned long allocated = allocations.load() - allocationsBefore;
+    const double evaluations = simulation.forceEvaluations() - evaluationsBefore;
+
+    const double n = workload.bodies.size();
+    std::cout << (first ? "" : ",\n") << std::setprecision(6)
+              << "    {\"workload\": \"" << workload.name << "\""
+              << ", \"bodies\": " << workload.bodies.size()
+              << ", \"backend\": \"" << NB::toString(backend) << "\""
+              << ", \"precision\": \"" << NB::toString(precision) << "\""
+              << ", \"threads\": " << settings.threads
+              << ", \"steps\": " << steps
+              << ", \"seconds\": " << seconds
+              << ", \"stepsPerSecond\": " << steps / seconds
+              // Direct-sum equivalent, so backends compare on the same scale
+              << ", \"pairInteractionsPerSecond\": " << evaluations * n * (n - 1) / seconds
+              << ", \"nsPerBody\": " << seconds / steps / n * 1e9
+              << ", \"allocationsPerStep\": " << static_cast<double>(allocated) / steps << "}";
+    std::cerr << workload.name << " N=" << workload.bodies.size() << " "
+              << NB::toString(backend) << " " << NB::toString(precision) << ": "
+              << steps / seconds << " steps/s" << std::endl;
+}
+
+Settings parseSettings(int argc, char* argv[]) {
+    Settings settings;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--max-bodies" && i + 1 < argc) {
+            settings.maxBodies = std::stoul(argv[++i]);
+        } else if (arg == "--max-direct" && i + 1 < argc) {
+            settings.maxDirectBodies = std::stoul(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            settings.threads = std::stoul(argv[++i]);
+        } else if (arg == "--min-seconds" && i + 1 < argc) {
+            settings.minSeconds = std::stod(argv[++i]);
+        } else if (arg == "--max-steps" && i + 1 < argc) {
+            settings.maxSteps = std::stoul(argv[++i]);
+        } else {
+            throw std::invalid_argument("Unknown option: " + arg);
+        }
+    }
+    return settings;
+}
+
+}  //  namespace
+
+int main(int argc, char* argv[]) {
+    Settings settings;
+    try {
+        settings = parseSettings(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl << "Usage: " << argv[0]
+                  << " [--max-bodies N] [--max-direct N] [--threads N]"
+                     " [--min-seconds S] [--max-steps K]" << std::endl;
+        return 1;
+    }
+
+    std::vector<Workload> workloads;
+    try {
+        workloads.push_back(asset("galaxy.txt", 25000.0));
+        workloads.push_back(asset("sbh3.txt", 25000.0));
+        workloads.push_back(asset("chaosblossom.txt", 25000.0));
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    for (std::size_t n = 10; n <= settings.maxBodies; n *= 10) {
+        workloads.push_back(uniformDisk(n));
+        workloads.push_back(plummer(n));
+    }
+
+    std::cout << "{\n  \"results\": [\n";
+    bool first = true;
+    for (const Workload& workload : workloads) {
+        for (NB::ForceBackend backend : {NB::ForceBackend::Pairwise, NB::ForceBackend::Simd,
+                                         NB::ForceBackend::Symmetric,
+                                         NB::ForceBackend::BarnesHut, NB::ForceBackend::Fmm,
+                                         NB::ForceBackend::ParticleMesh}) {
+            if (backend != NB::ForceBackend::BarnesHut && backend != NB::ForceBackend::Fmm
+                && backend != NB::ForceBackend::ParticleMesh
+                && workload.bodies.size() > settings.maxDirectBodies) {
+                continue;
+            }
+            run(workload, backend, NB::Precision::Double, settings, first);
+            first = false;
+            if (backend == NB::ForceBackend::Simd) {
+                run(workload, backend, NB::Precision::Mixed, settings, first);
+            }
+        }
+    }
+    std::cout << "\n  ]\n}" << std::endl;
+    return 0;
+}
@@ -0,0 +1,19 @@
+//  Copyright 2024 Vy Tran
+
+// NBodyHeadless: the --headless mode of NBody as a binary that only links the
+// physics library, for machines without SFML.
+#include <iostream>
+#include <stdexcept>
+#include "Headless.hpp"
+#include "Options.hpp"
+
+int main(int argc, char* argv[]) {
+    NB::Options options;
+    try {
+        options = NB::parseOptions(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl << NB::usage(argv[0]) << std::endl;
+        return 1;
+    }
+    return NB::runHeadless(options, std::cin, std::cout);
+}
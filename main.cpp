@@ -1,21 +1,122 @@
 //  Copyright 2024 Vy Tran
 
+#include <algorithm>
+#include <cmath>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <sstream>
+#include <stdexcept>
+#include <string>
 #include <SFML/Graphics.hpp>
 #include <SFML/Audio.hpp>
+#include "Checkpoint.hpp"
+#include "Headless.hpp"
+#include "Loader.hpp"
+#include "Options.hpp"
+#include "Profiler.hpp"
+#include "PhysicsThread.hpp"
 #include "Universe.hpp"
 
-int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " T deltaT" << std::endl;
-        return 1;
+// Window title with the elapsed time in appropriate units
+static std::string titleFor(double elapsedTime) {
+    NB_PROFILE_SCOPE(Title);
+    const double secondsPerDay = 86400.0;
+    const double secondsPerYear = 31536000.0;
+    std::ostringstream titleStream;
+    if (elapsedTime < secondsPerDay) {
+        // Display in seconds if less than a day
+        titleStream << "NBody Simulation - Time: " << std::fixed << std::setprecision(2)
+                    << elapsedTime << " s";
+    } else if (elapsedTime < secondsPerYear) {
+        // Convert to days and display if more than a day but less than a year
+        double days = elapsedTime / secondsPerDay;
+        titleStream << "NBody Simulation - Time: " << std::fixed << std::setprecision(2)
+                    << days << " days";
+    } else {
+        // Convert to years and display if more than a year
+        double years = elapsedTime / secondsPerYear;
+        titleStream << "NBody Simulation - Time: " << std::fixed << std::setprecision(2)
+                    << years << " years";
+    }
+    return titleStream.str();
+}
+
+// Pan and zoom: drag with the left button, scroll to zoom at the cursor, arrow keys
+// and +/- to move and zoom about the center, R to go back to the whole universe
+struct ViewControls {
+    bool dragging = false;
+    sf::Vector2i last;  // Cursor position of the previous drag event
+};
+
+static void handleEvent(const sf::Event& event, sf::RenderWindow& window,
+                        NB::Universe& universe, ViewControls& controls) {
+    const sf::Vector2u size = window.getSize();
+    const sf::Vector2i center(size.x / 2, size.y / 2);
+    const float step = std::min(size.x, size.y) / 10.0f;  // Arrow keys move a tenth
+    switch (event.type) {
+        case sf::Event::Closed:
+            window.close();
+            break;
+        case sf::Event::MouseWheelScrolled:
+            universe.zoomAt(std::pow(1.25, event.mouseWheelScroll.delta),
+                            sf::Vector2i(event.mouseWheelScroll.x, event.mouseWheelScroll.y),
+                            size);
+            break;
+        case sf::Event::MouseButtonPressed:
+            if (event.mouseButton.button == sf::Mouse::Left) {
+                controls.dragging = true;
+                controls.last = sf::Vector2i(event.mouseButton.x, event.mouseButton.y);
+            }
+            break;
+        case sf::Event::MouseButtonReleased:
+            if (event.mouseButton.button == sf::Mouse::Left) {
+                controls.dragging = false;
+            }
+            break;
+        case sf::Event::MouseMoved:
+            if (controls.dragging) {
+                universe.pan(event.mouseMove.x - controls.last.x,
+                             event.mouseMove.y - controls.last.y, size);
+                controls.last = sf::Vector2i(event.mouseMove.x, event.mouseMove.y);
+            }
+            break;
+        case sf::Event::KeyPressed:
+            switch (event.key.code) {
+                case sf::Keyboard::Left: universe.pan(step, 0, size); break;
+                case sf::Keyboard::Right: universe.pan(-step, 0, size); break;
+                case sf::Keyboard::Up: universe.pan(0, step, size); break;
+                case sf::Keyboard::Down: universe.pan(0, -step, size); break;
+                case sf::Keyboard::Add:
+                case sf::Keyboard::Equal: universe.zoomAt(1.25, center, size); break;
+                case sf::Keyboard::Subtract:
+                case sf::Keyboard::Hyphen: universe.zoomAt(0.8, center, size); break;
+                case sf::Keyboard::R: universe.setCamera(0, 0, 1); break;
+                default: break;
+            }
+            break;
+        default:
+            break;
     }
+}
 
+int main(int argc, char* argv[]) {
     // Parse command-line arguments
-    double totalTime = std::stod(argv[1]);  // Total simulation time
-    double deltaT = std::stod(argv[2]);  // Time step
+    NB::Options options;
+    try {
+        options = NB::parseOptions(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl << NB::usage(argv[0]) << std::endl;
+        return 1;
+    }
+    //  Ensembles have nothing to show, so they always run headless
+    if (options.headless || !options.ensemblePath.empty() || options.copies > 0) {
+        return NB::runHeadless(options, std::cin, std::cout);
+    }
+    NB::startProfiling(options);
+    double totalTime = options.totalTime;  // Total simulation time
+    double deltaT = options.deltaT;  // Time step
 
     // Load a sound file into a buffer
     sf::SoundBuffer buffer;
@@ -28,52 +129,114 @@ int main(int argc, char* argv[]) {
     sound.setLoop(true);
     sound.play();
 
-    // Load universe from standard input
+    // Load universe from standard input or --input, or pick up a checkpointed run
     std::unique_ptr<NB::Universe> universe = std::make_unique<NB::Universe>();
-    std::cin >> *universe;
+    NB::RunPosition start;
+    try {
+        if (!options.resumePath.empty()) {
+            start = NB::loadCheckpoint(options.resumePath, *universe);
+        } else if (!options.inputPath.empty()) {
+            NB::loadUniverse(options.inputPath, *universe, options.threads);
+        } else {
+            std::cin >> *universe;
+        }
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    NB::configure(*universe, options);
+    NB::Checkpointer checkpointer(options.checkpointPath, options.checkpointEvery);
+    std::ofstream trajectoryFile;
+    std::unique_ptr<NB::TrajectoryRecorder> recorder;
+    try {
+        checkpointer.checkWritable();
+        recorder = NB::startTrajectory(options, trajectoryFile, std::cout);
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    if (recorder) {
+        recorder->record(universe->bodies(), start);
+    }
+    NB::reportHash(*universe, start, options, std::cerr);
+    auto afterStep = [&](const NB::Simulation& simulation, const NB::RunPosition& position) {
+        checkpointer.afterStep(simulation, position);
+        if (recorder) {
+            recorder->record(simulation.bodies(), position);
+        }
+        NB::reportHash(simulation, position, options, std::cerr);
+    };
     // std::cout << "Initialized universe: " << universe << std::endl;
 
     // Create a render window with a specified size
     sf::RenderWindow window(sf::VideoMode(800, 800),
     "NBody Simulation", sf::Style::Titlebar | sf::Style::Close);
+    ViewControls controls;
+    universe->setDetailLimit(options.detailLimit);
 
-    const double secondsPerDay = 86400.0;
-    const double secondsPerYear = 31536000.0;
-    double elapsedTime = 0;
-    while (window.isOpen() && elapsedTime < totalTime) {
-        sf::Event event;
-        while (window.pollEvent(event)) {
-            if (event.type == sf::Event::Closed)
-                window.close();
+    if (options.physicsThread) {
+        // Physics steps on its own thread; the window just shows the newest snapshot
+        window.setFramerateLimit(60);
+        NB::PhysicsThread physics(*universe, deltaT, totalTime, options.substeps, start,
+                                  afterStep);
+        physics.start();
+        while (window.isOpen() && !physics.finished()) {
+            sf::Event event;
+            while (window.pollEvent(event)) {
+                handleEvent(event, window, *universe, controls);
+            }
+
+            const NB::Snapshot& snapshot = physics.latest();
+            window.clear();
+            universe->drawSnapshot(window, snapshot);
+            {
+                NB_PROFILE_SCOPE(Present);
+                window.display();
+            }
+            window.setTitle(titleFor(snapshot.elapsedTime));
         }
+        physics.stop();
+        try {
+            physics.rethrowFailure();
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    } else {
+        double elapsedTime = start.elapsedTime;
+        std::uint64_t steps = start.steps;
+        while (window.isOpen() && elapsedTime < totalTime) {
+            sf::Event event;
+            while (window.pollEvent(event)) {
+                handleEvent(event, window, *universe, controls);
+            }
 
-        window.clear();
-        // Draw the universe
-        window.draw(*universe);
-        window.display();
-        universe->step(deltaT);
+            window.clear();
+            // Draw the universe
+            window.draw(*universe);
+            {
+                NB_PROFILE_SCOPE(Present);
+                window.display();
+            }
+            try {
+                universe->step(deltaT);
+                afterStep(*universe, {++steps, elapsedTime + deltaT});
+            } catch (const std::runtime_error& e) {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
 
-        // Update window title with elapsed time
-        std::ostringstream titleStream;
-        if (elapsedTime < secondsPerDay) {
-            // Display in seconds if less than a day
-            titleStream << "NBody Simulation - Time: " << std::fixed << std::setprecision(2)
-                        << elapsedTime << " s";
-        } else if (elapsedTime < secondsPerYear) {
-            // Convert to days and display if more than a day but less than a year
-            double days = elapsedTime / secondsPerDay;
-            titleStream << "NBody Simulation - Time: " << std::fixed << std::setprecision(2)
-                        << days << " days";
-        } else {
-            // Convert to years and display if more than a year
-            double years = elapsedTime / secondsPerYear;
-            titleStream << "NBody Simulation - Time: " << std::fixed << std::setprecision(2)
-                        << years << " years";
+            // Update window title with elapsed time
+            window.setTitle(titleFor(elapsedTime));
+            elapsedTime += deltaT;
         }
-        window.setTitle(titleStream.str());
-        elapsedTime += deltaT;
     }
 
-    std::cout << *universe << std::endl;
+    recorder.reset();
+    NB::reportForceError(*universe, options, std::cerr);
+    if (options.trajectoryPath != "-") {
+        std::cout << *universe << std::endl;
+    }
+    NB::reportProfile(options, std::cerr);
     return 0;
 }
@@ -2,11 +2,30 @@
 
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE Main
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <sstream>
+#include <stdexcept>
 #include <boost/test/unit_test.hpp>
+#include "BarnesHut.hpp"
 #include "CelestialBody.hpp"
+#include "Checkpoint.hpp"
+#include "Ensemble.hpp"
+#include "FastMultipole.hpp"
+#include "ForceKernels.hpp"
+#include "Headless.hpp"
+#include "Loader.hpp"
+#include "ParticleMesh.hpp"
+#include "PhysicsThread.hpp"
+#include "Profiler.hpp"
+#include "SymmetricForces.hpp"
+#include "TextureCache.hpp"
+#include "Trajectory.hpp"
+#include "TripleBuffer.hpp"
 #include "Universe.hpp"
 
 namespace NB {
@@ -101,6 +120,26 @@ BOOST_AUTO_TEST_CASE(testUniverseOutputOperator) {
     BOOST_CHECK_EQUAL(output.str(), expectedOutput);
 }
 
+BOOST_AUTO_TEST_CASE(testUniverseBodyViews) {
+    std::cout << "testUniverseBodyViews" << std::endl;
+    Universe universe;
+    std::istringstream input("2\n"
+                             "10.0\n"
+                             "1.0 2.0 3.0 4.0 5.0 body1.png\n"
+                             "2.0 3.0 4.0 5.0 6.0 body2.png\n");
+    input >> universe;
+
+    // Bodies handed out by the universe are views, so writes go to the universe's state
+    CelestialBody body = universe[1];
+    body.applyForce(0, 0, 1.0);
+    BOOST_CHECK_EQUAL(universe[1].position().x, 6.0f);
+    BOOST_CHECK_EQUAL(universe[1].position().y, 8.0f);
+    BOOST_CHECK_EQUAL(universe[0].position().x, 1.0f);
+
+    BOOST_CHECK_THROW(universe[2], std::out_of_range);
+    BOOST_CHECK_THROW(universe[-1], std::out_of_range);
+}
+
 BOOST_AUTO_TEST_CASE(testCelestialBodyConstructor) {
     std::cout << "testCelestialBodyConstructor" << std::endl;
     CelestialBody body;
@@ -299,5 +338,1384 @@ BOOST_AUTO_TEST_CASE(testLeapfrogIntegration) {
     BOOST_CHECK_CLOSE(orbitingBody.velocity().y, orbitalVelocity, 1.0);
 }
 
+BOOST_AUTO_TEST_CASE(testSimdKernelMatchesScalar) {
+    std::cout << "testSimdKernelMatchesScalar" << std::endl;
+
+    // Odd body count so every vector width leaves a scalar tail
+    BodyState state;
+    state.resize(37);
+    for (std::size_t i = 0; i < state.size(); ++i) {
+        state.x[i] = 1e10 * std::cos(0.7 * i) * (1 + i % 5);
+        state.y[i] = 1e10 * std::sin(1.3 * i) * (1 + i % 3);
+        state.mass[i] = 1e24 * (1 + i % 7);
+    }
+    state.x[5] = state.x[4];  // Coincident pair must not produce NaNs
+    state.y[5] = state.y[4];
+
+    std::vector<double> refX(state.size()), refY(state.size());
+    computeAccelerations(state, 0, state.size(), refX.data(), refY.data(), SimdLevel::Scalar);
+
+    for (SimdLevel level : {SimdLevel::Avx2, SimdLevel::Avx512}) {
+        if (level > detectSimdLevel()) continue;
+        std::vector<double> ax(state.size()), ay(state.size());
+        computeAccelerations(state, 0, state.size(), ax.data(), ay.data(), level);
+        for (std::size_t i = 0; i < state.size(); ++i) {
+            BOOST_CHECK_CLOSE(ax[i], refX[i], 1e-8);
+            BOOST_CHECK_CLOSE(ay[i], refY[i], 1e-8);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(testSimdBackendStep) {
+    std::cout << "testSimdBackendStep" << std::endl;
+
+    Universe universe;
+    std::istringstream input("3\n"
+                             "1.25e11\n"
+                             "0.00e00  0.00e00  0.05e04  0.00e00  5.974e24  earth.gif\n"
+                             "0.00e00  4.50e10  3.00e04  0.00e00  1.989e30  sun.gif\n"
+                             "0.00e00 -4.50e10 -3.00e04  0.00e00  1.989e30  sun.gif\n");
+    input >> universe;
+    universe.setForceBackend(ForceBackend::Simd);
+    universe.step(250.0);
+
+    BOOST_CHECK_CLOSE(universe[0].position().x, 125000, 0.01);
+    BOOST_CHECK_CLOSE(universe[1].position().x, 7.5e+06, 0.01);
+    BOOST_CHECK_CLOSE(universe[1].velocity().y, -4.09468842, 0.01);
+    BOOST_CHECK_CLOSE(universe[2].velocity().y, 4.09468842, 0.01);
+}
+BOOST_AUTO_TEST_CASE(testThreadedStepMatchesSerial) {
+    std::cout << "testThreadedStepMatchesSerial" << std::endl;
+
+    std::ifstream file("assets/galaxy.txt");
+    std::stringstream contents;
+    contents << file.rdbuf();
+
+    Universe serial;
+    Universe threaded;
+    std::istringstream(contents.str()) >> serial;
+    std::istringstream(contents.str()) >> threaded;
+    serial.setForceBackend(ForceBackend::Simd);
+    threaded.setForceBackend(ForceBackend::Simd);
+    threaded.setThreads(4);
+    BOOST_CHECK_EQUAL(threaded.threads(), 4u);
+
+    for (int i = 0; i < 5; ++i) {
+        serial.step(25000.0);
+        threaded.step(25000.0);
+    }
+
+    // Each body's acceleration is computed by the same kernel whichever thread runs it
+    BOOST_REQUIRE_EQUAL(serial.numPlanets(), threaded.numPlanets());
+    for (int i = 0; i < serial.numPlanets(); ++i) {
+        BOOST_CHECK_EQUAL(serial[i].position().x, threaded[i].position().x);
+        BOOST_CHECK_EQUAL(serial[i].position().y, threaded[i].position().y);
+    }
+}
+BOOST_AUTO_TEST_CASE(testBarnesHutAccuracy) {
+    std::cout << "testBarnesHutAccuracy" << std::endl;
+
+    // Roughly uniform disk of equal masses, the hard case for a tree code
+    BodyState state;
+    state.resize(2000);
+    for (std::size_t i = 0; i < state.size(); ++i) {
+        double r = 1e11 * std::sqrt((i + 0.5) / state.size());
+        double angle = 2.399963 * i;  // Golden angle spiral
+        state.x[i] = r * std::cos(angle);
+        state.y[i] = r * std::sin(angle);
+        state.mass[i] = 1e24;
+    }
+
+    BarnesHut exact(0.0);
+    exact.build(state);
+    BOOST_CHECK_SMALL(exact.maxRelativeError(state, 50), 1e-12);
+
+    BarnesHut coarse(0.5);
+    coarse.build(state);
+    BarnesHut fine(0.2);
+    fine.build(state);
+    double coarseError = coarse.maxRelativeError(state, 200);
+    double fineError = fine.maxRelativeError(state, 200);
+    BOOST_CHECK_LT(coarseError, 0.05);
+    BOOST_CHECK_LT(fineError, coarseError);
+
+    // At theta 2 the root's center of mass, halfway to a heavy cluster, is far enough
+    // from body 0 to pass the opening test, but the root holds body 0 itself
+    BodyState cluster;
+    cluster.resize(9);
+    cluster.mass[0] = 1e20;
+    for (std::size_t i = 1; i < cluster.size(); ++i) {
+        cluster.x[i] = 100.0 + (i % 3) * 0.5;
+        cluster.y[i] = 100.0 + (i / 3) * 0.5;
+        cluster.mass[i] = 1.25e19;
+    }
+    BarnesHut loose(2.0);
+    loose.build(cluster);
+    BOOST_CHECK_SMALL(loose.maxRelativeError(cluster, 1), 1e-3);
+}
+BOOST_AUTO_TEST_CASE(testHeadlessRun) {
+    std::cout << "testHeadlessRun" << std::endl;
+    const std::string input = "3\n"
+                              "1.25e11\n"
+                              "0.00e00  0.00e00  0.05e04  0.00e00  5.974e24  earth.gif\n"
+                              "0.00e00  4.50e10  3.00e04  0.00e00  1.989e30  sun.gif\n"
+                              "0.00e00 -4.50e10 -3.00e04  0.00e00  1.989e30  sun.gif\n";
+
+    // T / deltaT = 4 steps, printed exactly like the windowed run prints a universe
+    Universe universe;
+    std::istringstream(input) >> universe;
+    for (int i = 0; i < 4; ++i) {
+        universe.step(250.0);
+    }
+    std::ostringstream expected;
+    expected << universe << std::endl;
+
+    Options options;
+    options.totalTime = 1000.0;
+    options.deltaT = 250.0;
+    options.headless = true;
+    std::istringstream in(input);
+    std::ostringstream out;
+    BOOST_CHECK_EQUAL(runHeadless(options, in, out), 0);
+    BOOST_CHECK_EQUAL(out.str(), expected.str());
+}
+BOOST_AUTO_TEST_CASE(testCountOptions) {
+    std::cout << "testCountOptions" << std::endl;
+    auto parse = [](std::string option, std::string value) {
+        std::string program = "NBody", total = "10", step = "1";
+        char* argv[] = {&program[0], &total[0], &step[0], &option[0], &value[0]};
+        return parseOptions(5, argv);
+    };
+    BOOST_CHECK_EQUAL(parse("--threads", "2").threads, 2u);
+    BOOST_CHECK_EQUAL(parse("--threads", "0").threads, 0u);
+    BOOST_CHECK_EQUAL(parse("--seed", "18446744073709551615").seed, ~std::uint64_t(0));
+    // A sign would wrap around to about 4e9 threads
+    BOOST_CHECK_THROW(parse("--threads", "-1"), std::invalid_argument);
+    BOOST_CHECK_THROW(parse("--threads", "+1"), std::invalid_argument);
+    BOOST_CHECK_THROW(parse("--threads", "1000000"), std::invalid_argument);
+    BOOST_CHECK_THROW(parse("--copies", "4294967297"), std::invalid_argument);
+    BOOST_CHECK_THROW(parse("--block-levels", "31"), std::invalid_argument);
+    BOOST_CHECK_THROW(parse("--trajectory-every", "0"), std::invalid_argument);
+    BOOST_CHECK_THROW(parse("--diagnostics", "5x"), std::invalid_argument);
+    BOOST_CHECK_THROW(parse("--hash", "99999999999999999999999"), std::invalid_argument);
+}
+BOOST_AUTO_TEST_CASE(testTripleBuffer) {
+    std::cout << "testTripleBuffer" << std::endl;
+    TripleBuffer<int> buffer;
+    BOOST_CHECK(!buffer.update());  // Nothing published yet
+
+    buffer.back() = 1;
+    buffer.publish();
+    buffer.back() = 2;
+    buffer.publish();
+    BOOST_CHECK(buffer.update());
+    BOOST_CHECK_EQUAL(buffer.front(), 2);  // Reader skips straight to the newest
+    BOOST_CHECK(!buffer.update());
+    BOOST_CHECK_EQUAL(buffer.front(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(testPhysicsThreadMatchesDirectStepping) {
+    std::cout << "testPhysicsThreadMatchesDirectStepping" << std::endl;
+    const std::string input = "2\n"
+                              "1e11\n"
+                              "0 0 0 0 1e10 1.gif\n"
+                              "100000 0 0 2.58263 1e5 2.gif\n";
+    Simulation direct;
+    std::istringstream(input) >> direct;
+    for (int i = 0; i < 10; ++i) {
+        direct.step(100.0);
+    }
+
+    Simulation threaded;
+    std::istringstream(input) >> threaded;
+    PhysicsThread physics(threaded, 100.0, 1000.0, 3);
+    BOOST_CHECK_EQUAL(physics.latest().steps, 0u);
+    physics.start();
+    while (!physics.finished()) {
+        physics.latest();  // Keep consuming frames so lockstep mode can proceed
+    }
+    physics.stop();
+    const Snapshot& last = physics.latest();
+    BOOST_CHECK_EQUAL(last.steps, 10u);
+    BOOST_CHECK_CLOSE(last.elapsedTime, 1000.0, 1e-9);
+    BOOST_CHECK_EQUAL(last.x[1], direct.bodies().x[1]);
+    BOOST_CHECK_EQUAL(threaded.bodies().y[1], direct.bodies().y[1]);
+}
+BOOST_AUTO_TEST_CASE(testSharedTextures) {
+    std::cout << "testSharedTextures" << std::endl;
+    Universe universe("assets/galaxy.txt");
+    BOOST_CHECK_EQUAL(universe.numPlanets(), 1000);
+    // One black hole and 999 stars: two textures, decoded once each
+    BOOST_CHECK_EQUAL(universe.textureCount(), 2u);
+    BOOST_CHECK(TextureCache::shared().get("star.gif") == TextureCache::shared().get("star.gif"));
+
+    // Many distinct names share a few decoder threads; get() finds each one whether it
+    // was decoded, is being decoded or is still queued
+    TextureCache cache;
+    std::vector<std::string> names = {"star.gif"};
+    for (unsigned i = 0; i < 4 * TextureCache::kMaxDecoders; ++i) {
+        names.push_back("missing" + std::to_string(i) + ".gif");
+    }
+    cache.prefetch(names);
+    for (auto name = names.rbegin(); name != names.rend(); ++name) {
+        BOOST_CHECK_EQUAL(cache.get(*name) != nullptr, *name == "star.gif");
+    }
+    BOOST_CHECK_EQUAL(cache.size(), names.size());
+}
+BOOST_AUTO_TEST_CASE(testLevelOfDetail) {
+    std::cout << "testLevelOfDetail" << std::endl;
+    // A dense core, a sparse ring and a few bodies far outside the universe radius
+    const std::size_t n = 20000;
+    BodyState state;
+    state.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        double r = i < 15000 ? 1e8 * (i % 100) : i < n - 50 ? 8e10 : 5e11;
+        state.x[i] = r * std::cos(0.1 * i);
+        state.y[i] = r * std::sin(0.1 * i);
+        state.mass[i] = 1e24;
+        state.names[i] = "star.gif";
+    }
+    Universe universe;
+    universe.load(state, 1e11);
+    sf::RenderTexture target;
+    target.create(800, 800);
+
+    target.draw(universe);
+    DrawStats stats = universe.drawStats();
+    BOOST_CHECK_EQUAL(stats.culled, 50u);
+    BOOST_CHECK_EQUAL(stats.sprites + stats.merged + stats.culled, n);
+    BOOST_CHECK_GT(stats.splats, 0u);
+    BOOST_CHECK_GE(stats.merged, 15000u);  // The whole core fits in a few cells
+    BOOST_CHECK_LT(stats.splats + stats.sprites, n / 10);
+
+    universe.setDetailLimit(0);
+    target.draw(universe);
+    BOOST_CHECK_EQUAL(universe.drawStats().sprites, n - 50);
+    BOOST_CHECK_EQUAL(universe.drawStats().splats, 0u);
+
+    // Zooming keeps the point under the cursor in place and panning follows the drag
+    const sf::Vector2u size = target.getSize();
+    const sf::Vector2f ring = universe.toScreen(state.x[n - 100], state.y[n - 100], size);
+    universe.zoomAt(4.0, sf::Vector2i(ring.x, ring.y), size);
+    sf::Vector2f zoomed = universe.toScreen(state.x[n - 100], state.y[n - 100], size);
+    BOOST_CHECK_SMALL(zoomed.x - std::floor(ring.x), 4.0f);
+    BOOST_CHECK_SMALL(zoomed.y - std::floor(ring.y), 4.0f);
+    BOOST_CHECK_CLOSE(universe.zoom(), 4.0, 1e-12);
+    universe.pan(30, -20, size);
+    sf::Vector2f panned = universe.toScreen(state.x[n - 100], state.y[n - 100], size);
+    BOOST_CHECK_CLOSE(panned.x, zoomed.x + 30, 1e-3);
+    BOOST_CHECK_CLOSE(panned.y, zoomed.y - 20, 1e-3);
+    // Zoomed in on the ring, the core and most of the ring are off the target
+    universe.setDetailLimit(8);
+    target.draw(universe);
+    BOOST_CHECK_GT(universe.drawStats().culled, n / 2);
+    BOOST_CHECK_THROW(universe.setCamera(0, 0, 0), std::invalid_argument);
+    universe.setCamera(0, 0, 1);
+    BOOST_CHECK_CLOSE(universe.toScreen(1e11, 0, size).x, 800.0f, 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE(testIntegratorOrder) {
+    std::cout << "testIntegratorOrder" << std::endl;
+
+    // Test mass on a circular orbit around a sun it cannot move: after one period
+    // it is back where it started, so the distance to the start is the error
+    const double sunMass = 2e30;
+    const double orbitRadius = 1.5e11;
+    const double speed = std::sqrt(G * sunMass / orbitRadius);
+    const double period = 2 * M_PI * orbitRadius / speed;
+    const int steps = 200;
+    std::ostringstream input;
+    input.precision(17);
+    input << "2\n2e11\n0 0 0 0 " << sunMass << " sun.gif\n"
+          << orbitRadius << " 0 0 " << speed << " 1 earth.gif\n";
+
+    auto orbitError = [&](IntegratorKind kind) {
+        Simulation simulation;
+        std::istringstream(input.str()) >> simulation;
+        simulation.setForceBackend(ForceBackend::Simd);
+        simulation.setIntegrator(kind);
+        simulation.setTolerance(1e-10);
+        for (int i = 0; i < steps; ++i) {
+            simulation.step(period / steps);
+        }
+        const BodyState& state = simulation.bodies();
+        return std::hypot(state.x[1] - orbitRadius, state.y[1]) / orbitRadius;
+    };
+
+    double euler = orbitError(IntegratorKind::Euler);
+    double leapfrog = orbitError(IntegratorKind::Leapfrog);
+    double yoshida = orbitError(IntegratorKind::Yoshida4);
+    double rk4 = orbitError(IntegratorKind::RK4);
+    double adaptive = orbitError(IntegratorKind::Adaptive);
+    BOOST_CHECK_LT(leapfrog, euler);
+    BOOST_CHECK_LT(yoshida, leapfrog);
+    BOOST_CHECK_LT(rk4, leapfrog);
+    BOOST_CHECK_LT(yoshida, 1e-5);
+    BOOST_CHECK_LT(rk4, 1e-5);
+    BOOST_CHECK_LT(adaptive, 1e-7);
+
+    // Two suns 1e-150 m apart overflow 1/r^3 with no softening; the adaptive step gives
+    // up with an error instead of growing a substep that can never be accepted
+    Simulation overflow;
+    std::istringstream("2\n2e11\n0 0 0 0 2e30 sun.gif\n1e-150 0 0 0 2e30 sun.gif\n") >> overflow;
+    overflow.setIntegrator(IntegratorKind::Adaptive);
+    BOOST_CHECK_THROW(overflow.step(period / steps), std::runtime_error);
+
+    // On the physics thread the error stops the thread and reaches the render side
+    Simulation threaded;
+    std::istringstream("2\n2e11\n0 0 0 0 2e30 sun.gif\n1e-150 0 0 0 2e30 sun.gif\n") >> threaded;
+    threaded.setIntegrator(IntegratorKind::Adaptive);
+    PhysicsThread physics(threaded, period / steps, period, 0);
+    physics.start();
+    while (!physics.finished()) {
+        physics.latest();
+    }
+    physics.stop();
+    BOOST_CHECK_THROW(physics.rethrowFailure(), std::runtime_error);
+}
+BOOST_AUTO_TEST_CASE(testMixedPrecision) {
+    std::cout << "testMixedPrecision" << std::endl;
+
+    // Float keeps about 7 digits, so at 1e11 m the exact accessors must be used
+    std::stringstream input("149597870700.125 0 29780.25 0 5.9722e24 earth.gif\n");
+    CelestialBody body(1e12);
+    input >> body;
+    BOOST_CHECK_EQUAL(body.exactPosition().x, 149597870700.125);
+    BOOST_CHECK_EQUAL(body.exactVelocity().x, 29780.25);
+    BOOST_CHECK_EQUAL(body.exactMass(), 5.9722e24);
+    BOOST_CHECK_NE(static_cast<double>(body.position().x), body.exactPosition().x);
+
+    Simulation simulation;
+    std::ifstream("assets/galaxy.txt") >> simulation;
+    const BodyState& state = simulation.bodies();
+    const std::size_t n = state.size();
+    std::vector<double> refX(n), refY(n), refPotential(n);
+    computeAccelerations(state, 0, n, refX.data(), refY.data(), SimdLevel::Scalar, 1e9,
+                         refPotential.data());
+    std::vector<double> scale(n), potentialScale(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        for (std::size_t j = 0; j < n; ++j) {
+            double r2 = std::pow(state.x[j] - state.x[i], 2) + std::pow(state.y[j] - state.y[i], 2)
+                      + 1e18;
+            scale[i] += G * state.mass[j] / r2;
+            potentialScale[i] += G * state.mass[j] / std::sqrt(r2);
+        }
+    }
+    FloatBodies bodies;
+    bodies.assign(state);
+    for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::Avx2, SimdLevel::Avx512}) {
+        if (level > detectSimdLevel()) continue;
+        std::vector<double> ax(n), ay(n), potential(n);
+        computeAccelerations(bodies, 0, n, ax.data(), ay.data(), level, 1e9, potential.data());
+        // Errors are relative to the size of the pair terms: the black hole's net force
+        // cancels almost exactly, which no float kernel can resolve
+        double largest = 0.0;
+        double largestPotential = 0.0;
+        for (std::size_t i = 0; i < n; ++i) {
+            largest = std::max(largest, std::hypot(ax[i] - refX[i], ay[i] - refY[i])
+                                        / scale[i]);
+            largestPotential = std::max(largestPotential,
+                                        std::abs(potential[i] - refPotential[i])
+                                        / std::abs(potentialScale[i]));
+        }
+        BOOST_CHECK_LT(largest, 1e-6);
+        BOOST_CHECK_LT(largestPotential, 1e-6);
+    }
+}
+BOOST_AUTO_TEST_CASE(testBlockTimeSteps) {
+    std::cout << "testBlockTimeSteps" << std::endl;
+    const double deltaT = 1e5;
+    const int steps = 20;
+    auto run = [&](IntegratorKind kind, int substeps, unsigned levels, Simulation& simulation) {
+        std::ifstream("assets/sbh3.txt") >> simulation;
+        simulation.setForceBackend(ForceBackend::Simd);
+        simulation.setThreads(0);
+        simulation.setIntegrator(kind);
+        simulation.setBlockLevels(levels);
+        for (int i = 0; i < steps * substeps; ++i) {
+            simulation.step(deltaT / substeps);
+        }
+    };
+
+    // A single level is plain leapfrog, bit for bit
+    Simulation leapfrog, singleLevel;
+    run(IntegratorKind::Leapfrog, 1, 0, leapfrog);
+    run(IntegratorKind::Block, 1, 0, singleLevel);
+    BOOST_CHECK(leapfrog.bodies().x == singleLevel.bodies().x);
+    BOOST_CHECK(leapfrog.bodies().vy == singleLevel.bodies().vy);
+
+    // The stars close to the black holes take small steps and the rest do not, so
+    // the block integrator beats a uniformly refined leapfrog at a fraction of the forces
+    Simulation reference, fine, block;
+    run(IntegratorKind::Leapfrog, 128, 0, reference);
+    run(IntegratorKind::Leapfrog, 64, 0, fine);
+    run(IntegratorKind::Block, 1, 10, block);
+    auto error = [&](const Simulation& simulation) {
+        double largest = 0.0;
+        const BodyState& exact = reference.bodies();
+        for (int i = 0; i < reference.numPlanets(); ++i) {
+            double dx = simulation.bodies().x[i] - exact.x[i];
+            double dy = simulation.bodies().y[i] - exact.y[i];
+            largest = std::max(largest, std::hypot(dx, dy));
+        }
+        return largest / reference.radius();
+    };
+    BOOST_CHECK_LT(error(block), error(fine));
+    BOOST_CHECK_LT(10 * block.forceEvaluations(), fine.forceEvaluations());
+
+    // The first levels come from the jerk of the softened kernel: it matches a central
+    // difference of the softened accelerations along the velocities
+    const double eps = 1e9;
+    const BodyState& start = reference.bodies();
+    const std::size_t n = start.size();
+    std::vector<double> jx(n), jy(n), plusX(n), plusY(n), minusX(n), minusY(n);
+    computeJerks(start, 0, n, jx.data(), jy.data(), nullptr, eps);
+    const double dt = 1.0;
+    BodyState plus = start, minus = start;
+    for (std::size_t i = 0; i < n; ++i) {
+        plus.x[i] += start.vx[i] * dt;
+        plus.y[i] += start.vy[i] * dt;
+        minus.x[i] -= start.vx[i] * dt;
+        minus.y[i] -= start.vy[i] * dt;
+    }
+    computeAccelerations(plus, 0, n, plusX.data(), plusY.data(), SimdLevel::Scalar, eps);
+    computeAccelerations(minus, 0, n, minusX.data(), minusY.data(), SimdLevel::Scalar, eps);
+    for (std::size_t i = 0; i < n; ++i) {
+        const double differenceX = (plusX[i] - minusX[i]) / (2 * dt);
+        const double differenceY = (plusY[i] - minusY[i]) / (2 * dt);
+        BOOST_CHECK_SMALL(std::hypot(jx[i] - differenceX, jy[i] - differenceY),
+                          1e-4 * std::hypot(jx[i], jy[i]) + 1e-25);
+    }
+}
+BOOST_AUTO_TEST_CASE(testSynchronousUpdateIgnoresBodyOrder) {
+    std::cout << "testSynchronousUpdateIgnoresBodyOrder" << std::endl;
+    const std::string forward = "3\n1e11\n"
+                                "0 0 0 0 1e30 a.gif\n"
+                                "1e10 0 0 3e4 1e29 b.gif\n"
+                                "0 2e10 -2e4 0 1e28 c.gif\n";
+    const std::string reversed = "3\n1e11\n"
+                                 "0 2e10 -2e4 0 1e28 c.gif\n"
+                                 "1e10 0 0 3e4 1e29 b.gif\n"
+                                 "0 0 0 0 1e30 a.gif\n";
+
+    auto run = [](const std::string& input, bool sequential) {
+        Simulation simulation;
+        std::istringstream(input) >> simulation;
+        simulation.setSequentialUpdate(sequential);
+        for (int i = 0; i < 20; ++i) {
+            simulation.step(3600.0);
+        }
+        return simulation.bodies();
+    };
+
+    // Frozen-snapshot forces: the same bodies end up in the same places either way
+    BodyState a = run(forward, false);
+    BodyState b = run(reversed, false);
+    for (int i = 0; i < 3; ++i) {
+        BOOST_CHECK_CLOSE(a.x[i], b.x[2 - i], 1e-9);
+        BOOST_CHECK_CLOSE(a.y[i], b.y[2 - i], 1e-9);
+    }
+
+    // The original update lets later bodies see earlier ones already moved
+    BodyState c = run(forward, true);
+    BodyState d = run(reversed, true);
+    BOOST_CHECK(c.x[0] != d.x[2]);
+}
+
+BOOST_AUTO_TEST_CASE(testLoaderMatchesStream) {
+    std::cout << "testLoaderMatchesStream" << std::endl;
+
+    // Bundled file with trailing description text
+    Simulation streamed, mapped;
+    std::ifstream("assets/sbh3.txt") >> streamed;
+    loadUniverse("assets/sbh3.txt", mapped);
+    BOOST_CHECK_EQUAL(mapped.radius(), streamed.radius());
+    BOOST_CHECK(mapped.bodies().x == streamed.bodies().x);
+    BOOST_CHECK(mapped.bodies().vy == streamed.bodies().vy);
+    BOOST_CHECK(mapped.bodies().mass == streamed.bodies().mass);
+    BOOST_CHECK(mapped.bodies().names == streamed.bodies().names);
+
+    // Over a megabyte so it is split across threads, with the layout quirks
+    // operator>> tolerates: tabs, '+' signs, blank lines and CRLF endings
+    const std::size_t n = 20000;
+    std::ostringstream text;
+    text << std::setprecision(17) << "  " << n << "\n+2.5e11\r\n";
+    for (std::size_t i = 0; i < n; ++i) {
+        if (i % 997 == 0) {
+            text << "\n \t\n";
+        }
+        text << 1e7 * std::sin(0.1 * i) * i << "\t+" << 1e-3 * i << " " << -29780.25 / (i + 1)
+             << " 0 " << 1e20 * (i % 13 + 1) << (i % 2 ? " star.gif\r\n" : "  earth.gif \n");
+    }
+    text << "Generated for testLoaderMatchesStream.\n";
+    const std::string file = text.str();
+    BOOST_CHECK_GT(file.size(), 1u << 20);
+    std::istringstream(file) >> streamed;
+    BodyState parsed;
+    double radius = parseUniverse(file.data(), file.data() + file.size(), parsed, 4);
+    BOOST_CHECK_EQUAL(radius, streamed.radius());
+    BOOST_CHECK(parsed.x == streamed.bodies().x);
+    BOOST_CHECK(parsed.y == streamed.bodies().y);
+    BOOST_CHECK(parsed.vx == streamed.bodies().vx);
+    BOOST_CHECK(parsed.mass == streamed.bodies().mass);
+    BOOST_CHECK(parsed.names == streamed.bodies().names);
+
+    auto parse = [](const std::string& text) {
+        BodyState state;
+        parseUniverse(text.data(), text.data() + text.size(), state, 1);
+    };
+    BOOST_CHECK_THROW(parse("2\n1e11\n1 2 3 4 5 a.gif\n"), std::runtime_error);
+    BOOST_CHECK_THROW(parse("1\n1e11\n1 2 x 4 5 a.gif\n"), std::runtime_error);
+    BOOST_CHECK_THROW(parse("1\n1e11\n1 2 3 4 5\n"), std::runtime_error);
+    BOOST_CHECK_THROW(loadUniverse("assets/missing.txt", mapped), std::runtime_error);
+}
+BOOST_AUTO_TEST_CASE(testEnsembleMatchesSerialRuns) {
+    std::cout << "testEnsembleMatchesSerialRuns" << std::endl;
+    const std::string list = "test-ensemble.list";
+    std::ofstream(list) << "assets/3body.txt\n# Comment line\nassets/figure8.txt\n"
+                           "assets/planets.txt  # Trailing comment\n";
+    Options options;
+    options.totalTime = 1e5;
+    options.deltaT = 1000;
+    options.integrator = IntegratorKind::Leapfrog;
+    options.ensemblePath = list;
+    options.copies = 5;
+    options.perturbPosition = 1e-4;
+    options.perturbVelocity = 1e-4;
+    options.threads = 4;
+    std::vector<EnsembleMember> members = ensembleMembers(options);
+    BOOST_REQUIRE_EQUAL(members.size(), 15u);
+    BOOST_CHECK_EQUAL(members[5].name, "figure8-0");
+    Simulation original;
+    std::ifstream("assets/3body.txt") >> original;
+    BOOST_CHECK(members[0].bodies.x == original.bodies().x);
+    BOOST_CHECK(members[1].bodies.x != members[0].bodies.x);
+    BOOST_CHECK(ensembleMembers(options)[2].bodies.vx == members[2].bodies.vx);
+
+    std::vector<EnsembleResult> results = runEnsemble(members, options);
+    BOOST_REQUIRE_EQUAL(results.size(), members.size());
+    for (std::size_t k = 0; k < members.size(); ++k) {
+        Simulation alone;
+        alone.load(members[k].bodies, members[k].radius);
+        configure(alone, options);
+        alone.setThreads(1);
+        for (int step = 0; step < 100; ++step) {
+            alone.step(options.deltaT);
+        }
+        BOOST_CHECK(results[k].error.empty());
+        BOOST_CHECK_EQUAL(results[k].name, members[k].name);
+        BOOST_CHECK_EQUAL(results[k].position.steps, 100u);
+        BOOST_CHECK(results[k].bodies.x == alone.bodies().x);
+        BOOST_CHECK(results[k].bodies.vy == alone.bodies().vy);
+    }
+
+    const std::string summary = writeEnsemble(results, "test-ensemble");
+    BOOST_CHECK_EQUAL(std::count(summary.begin(), summary.end(), '\n'), 16);
+    BOOST_CHECK(summary.find("momentumZ") == std::string::npos);
+    Simulation written;
+    BOOST_CHECK(std::ifstream("test-ensemble/0007-figure8-2.txt") >> written);
+    BOOST_CHECK_EQUAL(written.numPlanets(), 3);
+    std::filesystem::remove_all("test-ensemble");
+    std::remove(list.c_str());
+}
+BOOST_AUTO_TEST_CASE(testCheckpointResumeIsExact) {
+    std::cout << "testCheckpointResumeIsExact" << std::endl;
+    const std::string path = "test_checkpoint.snp";
+    // The adaptive integrator carries its substep size from step to step, and the block
+    // integrator its levels
+    struct Run {
+        IntegratorKind kind;
+        const char* universe;
+        double deltaT;
+    };
+    for (const Run& run : {Run{IntegratorKind::Leapfrog, "assets/galaxy.txt", 25000.0},
+                           Run{IntegratorKind::Adaptive, "assets/planets.txt", 250000.0},
+                           Run{IntegratorKind::Block, "assets/sbh3.txt", 1e5}}) {
+        Simulation uninterrupted;
+        std::ifstream(run.universe) >> uninterrupted;
+        uninterrupted.setIntegrator(run.kind);
+
+        Simulation first;
+        std::ifstream(run.universe) >> first;
+        first.setIntegrator(run.kind);
+        Checkpointer checkpointer(path, 5);
+        RunPosition position;
+        for (int i = 0; i < 10; ++i) {
+            uninterrupted.step(run.deltaT);
+            first.step(run.deltaT);
+            position.elapsedTime += run.deltaT;
+            ++position.steps;
+            checkpointer.afterStep(first, position);
+        }
+
+        // Configured after loading, as a resumed run is
+        Simulation resumed;
+        RunPosition loaded = loadCheckpoint(path, resumed);
+        resumed.setIntegrator(run.kind);
+        std::remove(path.c_str());
+        BOOST_REQUIRE_EQUAL(loaded.steps, 10u);
+        BOOST_REQUIRE_EQUAL(loaded.elapsedTime, position.elapsedTime);
+        BOOST_REQUIRE_EQUAL(resumed.numPlanets(), uninterrupted.numPlanets());
+        BOOST_REQUIRE_EQUAL(resumed.radius(), uninterrupted.radius());
+        BOOST_CHECK(resumed.bodies().names == uninterrupted.bodies().names);
+
+        for (int i = 0; i < 10; ++i) {
+            uninterrupted.step(run.deltaT);
+            resumed.step(run.deltaT);
+        }
+        // Doubles are stored bit for bit, so continuing from the checkpoint changes nothing
+        BOOST_CHECK_EQUAL(stateHash(resumed.bodies()), stateHash(uninterrupted.bodies()));
+    }
+
+    Simulation garbage;
+    std::ofstream("test_checkpoint.snp") << "not a checkpoint";
+    BOOST_CHECK_THROW(loadCheckpoint(path, garbage), std::runtime_error);
+
+    // 2^62 bodies in 3D wrap the expected size of the arrays around to 0
+    std::istringstream("1\n1e11\n0 0 0 0 1e10 1.gif\n") >> garbage;
+    saveCheckpoint(path, garbage, RunPosition());
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        const std::uint64_t bodyCount = std::uint64_t(1) << 62, dimensions = 3;
+        file.seekp(16);
+        file.write(reinterpret_cast<const char*>(&bodyCount), sizeof(bodyCount));
+        file.seekp(64);
+        file.write(reinterpret_cast<const char*>(&dimensions), sizeof(dimensions));
+    }
+    BOOST_CHECK_THROW(loadCheckpoint(path, garbage), std::runtime_error);
+    std::remove(path.c_str());
+
+    // An unwritable checkpoint path fails the run before its first step
+    const std::string unwritable = "nonexistent-dir/test_checkpoint.snp";
+    BOOST_CHECK_THROW(Checkpointer(unwritable, 5).checkWritable(), std::runtime_error);
+    BOOST_CHECK_NO_THROW(Checkpointer(unwritable, 0).checkWritable());
+    BOOST_CHECK_THROW(saveCheckpoint(unwritable, garbage, RunPosition()), std::runtime_error);
+    Options options;
+    options.totalTime = 1000.0;
+    options.deltaT = 250.0;
+    options.headless = true;
+    options.checkpointPath = unwritable;
+    options.checkpointEvery = 1;
+    std::istringstream in("1\n1e11\n0 0 0 0 1e10 1.gif\n");
+    std::ostringstream out;
+    BOOST_CHECK_EQUAL(runHeadless(options, in, out), 1);
+}
+
+BOOST_AUTO_TEST_CASE(testTrajectoryRoundTrip) {
+    std::cout << "testTrajectoryRoundTrip" << std::endl;
+    Simulation simulation;
+    std::ifstream("assets/galaxy.txt") >> simulation;
+    std::stringstream exact, delta;
+    std::vector<BodyState> recorded;
+    {
+        // A tiny ring makes the stepping side wait on the writer now and then
+        TrajectoryRecorder exactRecorder(exact, 2, TrajectoryEncoding::Double, 2);
+        TrajectoryRecorder deltaRecorder(delta, 2, TrajectoryEncoding::DeltaFloat, 2);
+        RunPosition position;
+        for (int i = 0; i <= 10; ++i) {
+            if (i > 0) {
+                simulation.step(25000.0);
+                position.elapsedTime += 25000.0;
+                ++position.steps;
+            }
+            exactRecorder.record(simulation.bodies(), position);
+            deltaRecorder.record(simulation.bodies(), position);
+            if (i % 2 == 0) {
+                recorded.push_back(simulation.bodies());
+            }
+        }
+        exactRecorder.flush();
+        BOOST_CHECK_EQUAL(exactRecorder.framesWritten(), 6u);
+    }
+
+    TrajectoryReader exactReader(exact);
+    TrajectoryReader deltaReader(delta);
+    BOOST_CHECK(exactReader.encoding() == TrajectoryEncoding::Double);
+    BOOST_CHECK_EQUAL(deltaReader.interval(), 2u);
+    TrajectoryFrame a, b;
+    for (const BodyState& state : recorded) {
+        BOOST_REQUIRE(exactReader.next(a));
+        BOOST_REQUIRE(deltaReader.next(b));
+        BOOST_CHECK_EQUAL(a.steps, b.steps);
+        BOOST_REQUIRE_EQUAL(a.x.size(), state.size());
+        double largestSpeed = 0;
+        for (double v : state.vy) {
+            largestSpeed = std::max(largestSpeed, std::abs(v));
+        }
+        for (std::size_t i = 0; i < state.size(); ++i) {
+            BOOST_REQUIRE_EQUAL(a.x[i], state.x[i]);
+            BOOST_REQUIRE_EQUAL(a.vy[i], state.vy[i]);
+            // Quantized deltas stay within one part in 2^23 of the frame's largest change
+            BOOST_REQUIRE_SMALL(b.x[i] - state.x[i], 1e-6 * simulation.radius());
+            BOOST_REQUIRE_SMALL(b.vy[i] - state.vy[i], 1e-6 * largestSpeed);
+        }
+    }
+    BOOST_CHECK(!exactReader.next(a));
+    BOOST_CHECK(!deltaReader.next(b));
+
+    std::istringstream garbage("not a trajectory");
+    BOOST_CHECK_THROW(TrajectoryReader reader(garbage), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(testDiagnostics) {
+    std::cout << "testDiagnostics" << std::endl;
+    // Earth on a circular orbit around the Sun: E = -G M m / 2r, L = m v r
+    const double M = 1.989e30, m = 5.974e24, r = 1.496e11;
+    const double v = std::sqrt(G * M / r);
+    std::ostringstream input;
+    input << std::setprecision(17) << "2\n2.5e11\n0 0 0 0 " << M << " sun.gif\n"
+          << r << " 0 0 " << v << " " << m << " earth.gif\n";
+    for (ForceBackend backend : {ForceBackend::Pairwise, ForceBackend::Simd,
+                                 ForceBackend::BarnesHut}) {
+        Simulation simulation;
+        std::istringstream(input.str()) >> simulation;
+        simulation.setForceBackend(backend);
+        simulation.setIntegrator(IntegratorKind::Leapfrog);
+        Diagnostics start = simulation.diagnostics();
+        BOOST_CHECK_CLOSE(start.potentialEnergy, -G * M * m / r, 1e-9);
+        BOOST_CHECK_CLOSE(start.angularMomentum, m * v * r, 1e-9);
+        BOOST_CHECK_CLOSE(start.centerOfMassX, m * r / (M + m), 1e-9);
+
+        simulation.setTrackPotential(true);
+        simulation.requestDiagnostics();
+        Diagnostics late;
+        BOOST_CHECK(!simulation.takeDiagnostics(late));
+        // The first force pass is at the requested positions and completes the request
+        simulation.step(3600.0);
+        BOOST_REQUIRE(simulation.takeDiagnostics(late));
+        BOOST_CHECK_CLOSE(late.potentialEnergy, start.potentialEnergy, 1e-9);
+        BOOST_CHECK_EQUAL(late.kineticEnergy, start.kineticEnergy);
+
+        for (int i = 0; i < 24 * 365; ++i) {
+            simulation.step(3600.0);
+        }
+        // Leapfrog's closing force pass is at the final positions, so no extra sweep is needed
+        simulation.requestDiagnostics();
+        Diagnostics end;
+        BOOST_REQUIRE(simulation.takeDiagnostics(end));
+        Diagnostics direct = simulation.diagnostics();
+        BOOST_CHECK_CLOSE(end.potentialEnergy, direct.potentialEnergy, 1e-9);
+        BOOST_CHECK_CLOSE(end.totalEnergy(), start.totalEnergy(), 1e-4);
+        BOOST_CHECK_CLOSE(end.angularMomentum, start.angularMomentum, 1e-9);
+        BOOST_CHECK_SMALL(end.momentumX, 1e-6 * m * v);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(testDiagnosticsMonitor) {
+    std::cout << "testDiagnosticsMonitor" << std::endl;
+    // Every integrator gets a report for each interval, whether or not its force passes
+    // ever land on the requested positions
+    for (IntegratorKind kind : {IntegratorKind::Euler, IntegratorKind::Leapfrog,
+                                IntegratorKind::Yoshida4, IntegratorKind::RK4,
+                                IntegratorKind::Adaptive, IntegratorKind::Block}) {
+        Simulation simulation;
+        std::ifstream("assets/planets.txt") >> simulation;
+        simulation.setIntegrator(kind);
+        simulation.setTrackPotential(true);
+        std::ostringstream log;
+        DiagnosticsMonitor monitor(300, log);
+        RunPosition position;
+        monitor.afterStep(simulation, position);
+        while (position.steps < 1200) {
+            simulation.step(250000.0);
+            position.elapsedTime += 250000.0;
+            ++position.steps;
+            monitor.afterStep(simulation, position);
+        }
+        monitor.finish(simulation);
+        if (kind == IntegratorKind::Block) {
+            // Its closing pass evaluates every body with the potential tracked, so a
+            // request after a step needs no sweep
+            simulation.requestDiagnostics();
+            Diagnostics ready;
+            BOOST_CHECK(simulation.takeDiagnostics(ready));
+        }
+        std::istringstream lines(log.str());
+        std::vector<std::string> steps;
+        for (std::string line; std::getline(lines, line);) {
+            steps.push_back(line.substr(0, line.find(" t=")));
+        }
+        const std::vector<std::string> expected = {"step 0", "step 300", "step 600",
+                                                   "step 900", "step 1200"};
+        BOOST_CHECK(steps == expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(testSofteningAndMerging) {
+    std::cout << "testSofteningAndMerging" << std::endl;
+    // Two close pairs and a loner; with a merge radius of 1e7 each pair becomes one body
+    const std::string input = "5\n1e11\n"
+                              "0 0 0 1000 2e30 sun.gif\n"
+                              "1e10 0 0 0 1e24 earth.gif\n"
+                              "5e6 0 0 -1000 1e30 venus.gif\n"
+                              "-3e10 0 500 0 1e24 mars.gif\n"
+                              "1e10 4e6 0 3000 3e24 jupiter.gif\n";
+    Simulation simulation;
+    std::istringstream(input) >> simulation;
+    const Diagnostics before = simulation.diagnostics();
+
+    // Softening bounds the pull of the close pair; the kernels agree on it
+    const double eps = 1e8;
+    std::vector<double> hardX(5), hardY(5), softX(5), softY(5), simdX(5), simdY(5);
+    computeAccelerations(simulation.bodies(), 0, 5, hardX.data(), hardY.data(),
+                         SimdLevel::Scalar);
+    computeAccelerations(simulation.bodies(), 0, 5, softX.data(), softY.data(),
+                         SimdLevel::Scalar, eps);
+    computeAccelerations(simulation.bodies(), 0, 5, simdX.data(), simdY.data(),
+                         detectSimdLevel(), eps);
+    BOOST_CHECK(std::abs(softX[0]) < std::abs(hardX[0]) / 100);
+    BOOST_CHECK_CLOSE(softX[0], G * 1e30 * 5e6 / std::pow(5e6 * 5e6 + eps * eps, 1.5)
+                                + G * 1e24 * 1e10 / std::pow(1e20 + eps * eps, 1.5)
+                                + G * 3e24 * 1e10 / std::pow(1e20 + 16e12 + eps * eps, 1.5)
+                                - G * 1e24 * 3e10 / std::pow(9e20 + eps * eps, 1.5), 1e-6);
+    for (int i = 0; i < 5; ++i) {
+        BOOST_CHECK_CLOSE(simdX[i], softX[i], 1e-9);
+    }
+
+    simulation.setSoftening(eps);
+    simulation.setMergeRadius(1e7);
+    const std::uint64_t layout = simulation.layoutVersion();
+    simulation.step(1.0);
+    BOOST_REQUIRE_EQUAL(simulation.numPlanets(), 3);
+    BOOST_CHECK_EQUAL(simulation.mergedBodies(), 2u);
+    BOOST_CHECK(simulation.layoutVersion() != layout);
+    // Merged bodies keep the first member's slot and the heaviest member's name
+    const BodyState& bodies = simulation.bodies();
+    BOOST_CHECK_EQUAL(bodies.names[0], "sun.gif");
+    BOOST_CHECK_EQUAL(bodies.names[1], "jupiter.gif");
+    BOOST_CHECK_EQUAL(bodies.names[2], "mars.gif");
+    BOOST_CHECK_EQUAL(bodies.mass[0], 2e30 + 1e30);
+    BOOST_CHECK_EQUAL(bodies.mass[1], 1e24 + 3e24);
+
+    const Diagnostics after = simulation.diagnostics();
+    BOOST_CHECK_CLOSE(after.totalMass, before.totalMass, 1e-12);
+    BOOST_CHECK_CLOSE(after.momentumX, before.momentumX, 1e-6);
+    BOOST_CHECK_CLOSE(after.momentumY, before.momentumY, 1e-6);
+
+    // Steps after a merge run on the compacted arrays
+    simulation.setIntegrator(IntegratorKind::Leapfrog);
+    simulation.step(3600.0);
+    BOOST_CHECK_EQUAL(simulation.numPlanets(), 3);
+}
+
+BOOST_AUTO_TEST_CASE(testThreeDimensions) {
+    std::cout << "testThreeDimensions" << std::endl;
+    // Earth on a circular orbit inclined 30 degrees to the xy plane
+    const double M = 1.989e30, m = 5.974e24, r = 1.496e11;
+    const double v = std::sqrt(G * M / r);
+    const double inclination = M_PI / 6;
+    std::ostringstream input;
+    input << std::setprecision(17) << "2\n2.5e11\n0 0 0 0 0 0 " << M << " sun.gif\n"
+          << r << " 0 0 0 " << v * std::cos(inclination) << " " << v * std::sin(inclination)
+          << " " << m << " earth.gif\n";
+    Simulation streamed;
+    std::istringstream(input.str()) >> streamed;
+    BOOST_REQUIRE_EQUAL(streamed.bodies().dimensions, 3u);
+    BOOST_CHECK_EQUAL(streamed.bodies().vz[1], v * std::sin(inclination));
+    BOOST_CHECK_EQUAL(streamed.bodies().names[1], "earth.gif");
+    BodyState parsed;
+    const std::string text = input.str();
+    parseUniverse(text.data(), text.data() + text.size(), parsed, 1);
+    BOOST_CHECK_EQUAL(parsed.dimensions, 3u);
+    BOOST_CHECK(parsed.vz == streamed.bodies().vz);
+    BOOST_CHECK(parsed.mass == streamed.bodies().mass);
+    std::stringstream written;
+    written << std::setprecision(17) << streamed;
+    Simulation reread;
+    written >> reread;
+    BOOST_CHECK(reread.bodies().vy == streamed.bodies().vy);
+    BOOST_CHECK(reread.bodies().vz == streamed.bodies().vz);
+    Simulation flat;
+    std::ifstream("assets/galaxy.txt") >> flat;
+    BOOST_CHECK_EQUAL(flat.bodies().dimensions, 2u);
+    BOOST_CHECK(flat.bodies().z.empty());
+
+    // A ball of bodies: every kernel agrees, and with z = 0 matches the 2D kernels exactly
+    BodyState ball;
+    ball.setDimensions(3);
+    ball.resize(37);
+    for (std::size_t i = 0; i < ball.size(); ++i) {
+        ball.x[i] = 1e10 * std::cos(0.7 * i) * (1 + i % 5);
+        ball.y[i] = 1e10 * std::sin(1.3 * i) * (1 + i % 3);
+        ball.z[i] = 1e10 * std::sin(2.9 * i) * (1 + i % 4);
+        ball.mass[i] = 1e24 * (1 + i % 7);
+    }
+    const std::size_t n = ball.size();
+    std::vector<double> refX(n), refY(n), refZ(n);
+    computeAccelerations(ball, 0, n, refX.data(), refY.data(), refZ.data(), SimdLevel::Scalar);
+    for (std::size_t i = 0; i < n; ++i) {
+        double direct[3] = {};
+        for (std::size_t j = 0; j < n; ++j) {
+            double d[3] = {ball.x[j] - ball.x[i], ball.y[j] - ball.y[i], ball.z[j] - ball.z[i]};
+            double r2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+            for (int axis = 0; axis < 3 && j != i; ++axis) {
+                direct[axis] += G * ball.mass[j] * d[axis] / (r2 * std::sqrt(r2));
+            }
+        }
+        BOOST_CHECK_CLOSE(refX[i], direct[0], 1e-9);
+        BOOST_CHECK_CLOSE(refZ[i], direct[2], 1e-9);
+    }
+    FloatBodies floats;
+    floats.assign(ball);
+    for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::Avx2, SimdLevel::Avx512}) {
+        if (level > detectSimdLevel()) continue;
+        std::vector<double> ax(n), ay(n), az(n), fx(n), fy(n), fz(n);
+        computeAccelerations(ball, 0, n, ax.data(), ay.data(), az.data(), level);
+        computeAccelerations(floats, 0, n, fx.data(), fy.data(), fz.data(), level);
+        for (std::size_t i = 0; i < n; ++i) {
+            BOOST_CHECK_CLOSE(ax[i], refX[i], 1e-8);
+            BOOST_CHECK_CLOSE(az[i], refZ[i], 1e-8);
+            BOOST_CHECK_SMALL(std::hypot(fx[i] - refX[i], fy[i] - refY[i], fz[i] - refZ[i])
+                              / std::hypot(refX[i], refY[i], refZ[i]), 1e-3);
+        }
+
+        BodyState planar = ball;
+        std::fill(planar.z.begin(), planar.z.end(), 0.0);
+        BodyState plane = planar;
+        plane.setDimensions(2);
+        std::vector<double> px(n), py(n), pz(n), qx(n), qy(n);
+        computeAccelerations(planar, 0, n, px.data(), py.data(), pz.data(), level);
+        computeAccelerations(plane, 0, n, qx.data(), qy.data(), level);
+        BOOST_CHECK(px == qx);
+        BOOST_CHECK(py == qy);
+        BOOST_CHECK(std::all_of(pz.begin(), pz.end(), [](double a) { return a == 0.0; }));
+    }
+    BOOST_CHECK_THROW(computeAccelerations(ball, 0, n, refX.data(), refY.data(),
+                                           SimdLevel::Scalar), std::invalid_argument);
+
+    // The octree converges to the direct sum like the quadtree does
+    BodyState sphere;
+    sphere.setDimensions(3);
+    sphere.resize(2000);
+    for (std::size_t i = 0; i < sphere.size(); ++i) {
+        double height = 1 - 2 * (i + 0.5) / sphere.size();  // Fibonacci sphere shells
+        double radius = 1e11 * std::cbrt((i % 97 + 0.5) / 97);
+        double ring = std::sqrt(1 - height * height);
+        sphere.x[i] = radius * ring * std::cos(2.399963 * i);
+        sphere.y[i] = radius * ring * std::sin(2.399963 * i);
+        sphere.z[i] = radius * height;
+        sphere.mass[i] = 1e24;
+    }
+    BarnesHut exact(0.0);
+    exact.build(sphere);
+    BOOST_CHECK_SMALL(exact.maxRelativeError(sphere, 50), 1e-12);
+    BarnesHut coarse(0.5);
+    coarse.build(sphere);
+    BarnesHut fine(0.2);
+    fine.build(sphere);
+    double coarseError = coarse.maxRelativeError(sphere, 200);
+    BOOST_CHECK_LT(coarseError, 0.05);
+    BOOST_CHECK_LT(fine.maxRelativeError(sphere, 200), coarseError);
+
+    // The inclined orbit keeps its energy and its (tilted) angular momentum on every backend
+    for (ForceBackend backend : {ForceBackend::Pairwise, ForceBackend::Simd,
+                                 ForceBackend::BarnesHut}) {
+        Simulation simulation;
+        std::istringstream(input.str()) >> simulation;
+        simulation.setForceBackend(backend);
+        simulation.setIntegrator(IntegratorKind::Leapfrog);
+        Diagnostics start = simulation.diagnostics();
+        BOOST_CHECK_CLOSE(start.potentialEnergy, -G * M * m / r, 1e-9);
+        BOOST_CHECK_CLOSE(start.angularMomentum, m * v * r * std::cos(inclination), 1e-9);
+        BOOST_CHECK_CLOSE(-start.angularMomentumY, m * v * r * std::sin(inclination), 1e-9);
+        double highest = 0;
+        for (int i = 0; i < 24 * 365; ++i) {
+            simulation.step(3600.0);
+            highest = std::max(highest, simulation.bodies().z[1]);
+        }
+        BOOST_CHECK_CLOSE(highest, r * std::sin(inclination), 0.1);
+        Diagnostics end = simulation.diagnostics();
+        BOOST_CHECK_CLOSE(end.totalEnergy(), start.totalEnergy(), 1e-4);
+        BOOST_CHECK_CLOSE(end.angularMomentum, start.angularMomentum, 1e-9);
+        BOOST_CHECK_CLOSE(end.angularMomentumY, start.angularMomentumY, 1e-9);
+        BOOST_CHECK_SMALL(end.angularMomentumX, 1e-9 * m * v * r);
+        BOOST_CHECK_SMALL(end.momentumZ - start.momentumZ, 1e-6 * m * v);
+    }
+
+    // Checkpoints and trajectories carry the z columns bit for bit
+    const std::string path = "test_checkpoint_3d.snp";
+    RunPosition position;
+    position.steps = 1;
+    saveCheckpoint(path, streamed, position);
+    Simulation resumed;
+    loadCheckpoint(path, resumed);
+    std::remove(path.c_str());
+    BOOST_CHECK_EQUAL(resumed.bodies().dimensions, 3u);
+    BOOST_CHECK(resumed.bodies().z == streamed.bodies().z);
+    BOOST_CHECK(resumed.bodies().vz == streamed.bodies().vz);
+    std::stringstream trajectory;
+    {
+        TrajectoryRecorder recorder(trajectory, 1, TrajectoryEncoding::Double);
+        recorder.record(flat.bodies(), position);
+        recorder.record(streamed.bodies(), position);
+    }
+    TrajectoryReader reader(trajectory);
+    TrajectoryFrame frame;
+    BOOST_REQUIRE(reader.next(frame));
+    BOOST_CHECK_EQUAL(frame.dimensions, 2u);
+    BOOST_REQUIRE(reader.next(frame));
+    BOOST_CHECK_EQUAL(frame.dimensions, 3u);
+    BOOST_CHECK(frame.vz == streamed.bodies().vz);
+    BOOST_CHECK(!reader.next(frame));
+
+    // An ensemble with a 3D member summarises every component of the momenta
+    EnsembleResult tilted;
+    tilted.name = "tilted";
+    tilted.bodies = streamed.bodies();
+    tilted.radius = streamed.radius();
+    tilted.before = tilted.after = streamed.diagnostics();
+    tilted.after.momentumZ = 12.5;
+    tilted.after.angularMomentumX = 7.25;
+    const std::string summary = writeEnsemble({tilted}, "test-ensemble-3d");
+    std::filesystem::remove_all("test-ensemble-3d");
+    std::istringstream table(summary);
+    std::string header, row;
+    std::getline(table, header);
+    std::getline(table, row);
+    BOOST_CHECK(header.find("\tmomentumY\tmomentumZ\tangularMomentumX\tangularMomentumY"
+                            "\tangularMomentumZ\tmerged") != std::string::npos);
+    BOOST_CHECK(row.find("\t12.5\t7.25\t") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(testSymmetricKernel) {
+    std::cout << "testSymmetricKernel" << std::endl;
+    BOOST_CHECK(forceBackendFromString("symmetric") == ForceBackend::Symmetric);
+    // One block, odd and even block counts, and short last blocks
+    for (std::size_t n : {1u, 2u, 37u, 64u, 200u, 1029u, 1600u}) {
+        for (unsigned dimensions : {2u, 3u}) {
+            BodyState state;
+            state.setDimensions(dimensions);
+            state.resize(n);
+            for (std::size_t i = 0; i < n; ++i) {
+                state.x[i] = 1e10 * std::cos(0.7 * i) * (1 + i % 5);
+                state.y[i] = 1e10 * std::sin(1.3 * i) * (1 + i % 3);
+                if (dimensions == 3) {
+                    state.z[i] = 1e10 * std::sin(2.9 * i);
+                }
+                state.mass[i] = 1e24 * (1 + i % 7);
+            }
+            if (n > 5) {
+                state.x[5] = state.x[4];  // Coincident pair must not produce NaNs
+                state.y[5] = state.y[4];
+            }
+            std::vector<double> refX(n), refY(n), refZ(n), refPotential(n);
+            computeAccelerations(state, 0, n, refX.data(), refY.data(), refZ.data(),
+                                 SimdLevel::Scalar, 1e6, refPotential.data());
+            SymmetricForces symmetric;
+            symmetric.plan(n);
+            for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::Avx2, SimdLevel::Avx512}) {
+                if (level > detectSimdLevel()) continue;
+                std::vector<double> ax(n), ay(n), az(n), potential(n);
+                for (std::size_t round = 0; round < symmetric.rounds(); ++round) {
+                    symmetric.accumulate(state, round, 0, symmetric.tiles(round), ax.data(),
+                                         ay.data(), az.data(), level, 1e6, potential.data());
+                }
+                SymmetricForces::finish(state, 0, n, ax.data(), ay.data(), az.data(),
+                                        potential.data());
+                for (std::size_t i = 0; i < n; ++i) {
+                    double scale = std::hypot(refX[i], refY[i], refZ[i]);
+                    BOOST_REQUIRE_LE(std::hypot(ax[i] - refX[i], ay[i] - refY[i],
+                                                az[i] - refZ[i]), 1e-9 * scale);
+                    BOOST_REQUIRE_CLOSE(potential[i], refPotential[i], 1e-9);
+                }
+            }
+        }
+    }
+
+    // Rounds keep every sum in the same order, so thread count changes no bits
+    Simulation serial, threaded;
+    std::ifstream("assets/galaxy.txt") >> serial;
+    std::ifstream("assets/galaxy.txt") >> threaded;
+    serial.setForceBackend(ForceBackend::Symmetric);
+    threaded.setForceBackend(ForceBackend::Symmetric);
+    threaded.setThreads(4);
+    Simulation direct;
+    std::ifstream("assets/galaxy.txt") >> direct;
+    direct.setForceBackend(ForceBackend::Simd);
+    for (int i = 0; i < 5; ++i) {
+        serial.step(25000.0);
+        threaded.step(25000.0);
+        direct.step(25000.0);
+    }
+    for (int i = 0; i < serial.numPlanets(); ++i) {
+        BOOST_REQUIRE_EQUAL(serial.bodies().x[i], threaded.bodies().x[i]);
+        BOOST_REQUIRE_EQUAL(serial.bodies().vy[i], threaded.bodies().vy[i]);
+        BOOST_CHECK_SMALL(serial.bodies().x[i] - direct.bodies().x[i], 1e-9 * serial.radius());
+    }
+    BOOST_CHECK_CLOSE(serial.diagnostics().potentialEnergy,
+                      direct.diagnostics().potentialEnergy, 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(testFastMultipole) {
+    std::cout << "testFastMultipole" << std::endl;
+    BOOST_CHECK(forceBackendFromString("fmm") == ForceBackend::Fmm);
+    // A dense core with a sparse halo, so the tree is several levels deep and uneven
+    const std::size_t n = 3000;
+    BodyState state;
+    state.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        double r = 1e11 * std::pow((i + 0.5) / n, 2.0);
+        state.x[i] = r * std::cos(2.39996 * i);
+        state.y[i] = r * std::sin(2.39996 * i);
+        state.mass[i] = 1e24 * (1 + i % 7);
+    }
+    std::vector<double> refX(n), refY(n), refPotential(n);
+    computeAccelerations(state, 0, n, refX.data(), refY.data(), nullptr, SimdLevel::Scalar,
+                         1e6, refPotential.data());
+    auto maxError = [&](FastMultipole& fmm, double& potentialError) {
+        std::vector<double> ax(n), ay(n), potential(n);
+        fmm.computeAccelerations(state, ax.data(), ay.data(), potential.data());
+        double error = 0;
+        potentialError = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            error = std::max(error, std::hypot(ax[i] - refX[i], ay[i] - refY[i])
+                                    / std::hypot(refX[i], refY[i]));
+            potentialError = std::max(potentialError,
+                                      std::abs(potential[i] / refPotential[i] - 1));
+        }
+        return error;
+    };
+    // The error is set by the order and falls below 1e-8 well before kMaxOrder
+    FastMultipole fmm(4, 0.3);
+    fmm.setSoftening(1e6);
+    double potentialError;
+    double previous = maxError(fmm, potentialError);
+    BOOST_CHECK_LT(previous, 1e-2);
+    for (unsigned order : {8u, 12u, 16u}) {
+        fmm.setOrder(order);
+        double error = maxError(fmm, potentialError);
+        BOOST_CHECK_LT(error, previous);
+        BOOST_CHECK_LT(potentialError, error);
+        previous = error;
+    }
+    BOOST_CHECK_LT(previous, 1e-8);
+    BOOST_CHECK_GT(fmm.cellCount(), 1u);
+
+    // Cells of a level write only their own expansions, so thread count changes no bits
+    ThreadPool pool(4);
+    std::vector<double> serialX(n), serialY(n), threadedX(n), threadedY(n);
+    fmm.computeAccelerations(state, serialX.data(), serialY.data());
+    fmm.computeAccelerations(state, threadedX.data(), threadedY.data(), nullptr, &pool);
+    BOOST_CHECK(serialX == threadedX);
+    BOOST_CHECK(serialY == threadedY);
+
+    BOOST_CHECK_THROW(fmm.setOrder(0), std::invalid_argument);
+    BOOST_CHECK_THROW(fmm.setOrder(FastMultipole::kMaxOrder + 1), std::invalid_argument);
+    BodyState solid;
+    solid.setDimensions(3);
+    solid.resize(2);
+    BOOST_CHECK_THROW(fmm.computeAccelerations(solid, serialX.data(), serialY.data()),
+                      std::invalid_argument);
+
+    // As a simulation backend it follows direct summation closely
+    Simulation multipole, direct;
+    std::ifstream("assets/galaxy.txt") >> multipole;
+    std::ifstream("assets/galaxy.txt") >> direct;
+    multipole.setForceBackend(ForceBackend::Fmm);
+    multipole.setFmmOrder(14);
+    multipole.setTheta(0.3);
+    multipole.setThreads(2);
+    direct.setForceBackend(ForceBackend::Simd);
+    for (int i = 0; i < 5; ++i) {
+        multipole.step(25000.0);
+        direct.step(25000.0);
+    }
+    for (int i = 0; i < multipole.numPlanets(); ++i) {
+        BOOST_CHECK_SMALL(multipole.bodies().x[i] - direct.bodies().x[i],
+                          1e-9 * multipole.radius());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(testParticleMesh) {
+    std::cout << "testParticleMesh" << std::endl;
+    BOOST_CHECK(forceBackendFromString("pm") == ForceBackend::ParticleMesh);
+    // Light test bodies around one heavy body, so each force is a single pair's
+    for (unsigned dimensions : {2u, 3u}) {
+        const std::size_t n = 1001;
+        BodyState state;
+        state.setDimensions(dimensions);
+        state.resize(n);
+        state.x[0] = 1.234e9;
+        state.y[0] = -3.1e9;
+        state.mass[0] = 1e30;
+        for (std::size_t i = 1; i < n; ++i) {
+            state.x[i] = 1e11 * std::sin(1.7 * i) * std::cos(0.31 * i);
+            state.y[i] = 1e11 * std::cos(2.3 * i);
+            if (dimensions == 3) {
+                state.z[i] = 1e11 * std::sin(0.9 * i);
+            }
+            state.mass[i] = 1e-10;
+        }
+        std::vector<double> refX(n), refY(n), refZ(n), refPotential(n);
+        computeAccelerations(state, 0, n, refX.data(), refY.data(), refZ.data(),
+                             SimdLevel::Scalar, 0, refPotential.data());
+        for (bool shortRange : {false, true}) {
+            ParticleMesh mesh(dimensions == 3 ? 32 : 64, shortRange);
+            std::vector<double> ax(n), ay(n), az(n), potential(n);
+            mesh.computeAccelerations(state, ax.data(), ay.data(), az.data(), potential.data());
+            for (std::size_t i = 1; i < n; ++i) {
+                double dz = dimensions == 3 ? state.z[i] - state.z[0] : 0.0;
+                double cells = std::hypot(state.x[i] - state.x[0], state.y[i] - state.y[0], dz)
+                             / mesh.cellSize();
+                double error = std::hypot(ax[i] - refX[i], ay[i] - refY[i], az[i] - refZ[i])
+                             / std::hypot(refX[i], refY[i], refZ[i]);
+                // The grid alone is accurate far out; the pairs fix the near field
+                if (shortRange) {
+                    BOOST_CHECK_LT(error, 5e-2);
+                    BOOST_CHECK_CLOSE(potential[i], refPotential[i], 2.0);
+                } else if (cells > 16) {
+                    BOOST_CHECK_LT(error, 5e-3);
+                }
+            }
+        }
+    }
+
+    // A uniform cloud, with every output written by one thread
+    const std::size_t n = 4000;
+    BodyState cloud;
+    cloud.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        cloud.x[i] = 1e11 * std::sin(12.9898 * i);
+        cloud.y[i] = 1e11 * std::sin(78.233 * i);
+        cloud.mass[i] = 1e24;
+    }
+    ParticleMesh mesh(128, true);
+    ThreadPool pool(4);
+    std::vector<double> serialX(n), serialY(n), threadedX(n), threadedY(n);
+    mesh.computeAccelerations(cloud, serialX.data(), serialY.data(), nullptr);
+    mesh.computeAccelerations(cloud, threadedX.data(), threadedY.data(), nullptr, nullptr, &pool);
+    BOOST_CHECK(serialX == threadedX);
+    BOOST_CHECK(serialY == threadedY);
+    BOOST_CHECK_THROW(mesh.setGrid(100), std::invalid_argument);
+    BOOST_CHECK_THROW(mesh.setGrid(8), std::invalid_argument);
+
+    // As a simulation backend P3M gives the kicks of direct summation to within the
+    // mesh error; the black hole at the center feels almost no net force, so it is
+    // left out
+    Simulation initial, particleMesh, direct;
+    std::ifstream("assets/galaxy.txt") >> initial;
+    std::ifstream("assets/galaxy.txt") >> particleMesh;
+    std::ifstream("assets/galaxy.txt") >> direct;
+    particleMesh.setForceBackend(ForceBackend::ParticleMesh);
+    particleMesh.setMeshGrid(128);
+    particleMesh.setMeshShortRange(true);
+    particleMesh.setThreads(2);
+    direct.setForceBackend(ForceBackend::Simd);
+    particleMesh.step(25000.0);
+    direct.step(25000.0);
+    const BodyState& before = initial.bodies();
+    for (int i = 1; i < particleMesh.numPlanets(); ++i) {
+        double kickX = direct.bodies().vx[i] - before.vx[i];
+        double kickY = direct.bodies().vy[i] - before.vy[i];
+        BOOST_CHECK_LT(std::hypot(particleMesh.bodies().vx[i] - before.vx[i] - kickX,
+                                  particleMesh.bodies().vy[i] - before.vy[i] - kickY),
+                       5e-2 * std::hypot(kickX, kickY));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(testDeterministicThreads) {
+    std::cout << "testDeterministicThreads" << std::endl;
+    // The block integrator evaluates scattered subsets, and mixed precision has the
+    // widest vector blocks, so these are where a chunk boundary could move a body
+    // between a kernel's blocks and its scalar tail
+    struct Setup {
+        ForceBackend backend;
+        Precision precision;
+        IntegratorKind integrator;
+    };
+    const Setup setups[] = {
+        {ForceBackend::Simd, Precision::Double, IntegratorKind::Block},
+        {ForceBackend::Simd, Precision::Mixed, IntegratorKind::Block},
+        {ForceBackend::Simd, Precision::Mixed, IntegratorKind::Leapfrog},
+        {ForceBackend::Symmetric, Precision::Double, IntegratorKind::Block},
+        {ForceBackend::BarnesHut, Precision::Double, IntegratorKind::Euler},
+    };
+    for (const Setup& setup : setups) {
+        Simulation serial, threaded;
+        std::ifstream("assets/galaxy.txt") >> serial;
+        std::ifstream("assets/galaxy.txt") >> threaded;
+        for (Simulation* simulation : {&serial, &threaded}) {
+            simulation->setForceBackend(setup.backend);
+            simulation->setPrecision(setup.precision);
+            simulation->setIntegrator(setup.integrator);
+        }
+        threaded.setThreads(5);
+        for (int i = 0; i < 5; ++i) {
+            serial.step(25000.0);
+            threaded.step(25000.0);
+            BOOST_REQUIRE_EQUAL(stateHash(serial.bodies()), stateHash(threaded.bodies()));
+        }
+        BOOST_CHECK(serial.bodies().x == threaded.bodies().x);
+        BOOST_CHECK(serial.bodies().y == threaded.bodies().y);
+        BOOST_CHECK(serial.bodies().vx == threaded.bodies().vx);
+        BOOST_CHECK(serial.bodies().vy == threaded.bodies().vy);
+    }
+
+    // Deterministic mode runs the kernels scalar whatever instruction set was detected
+    Simulation deterministic, scalar;
+    std::ifstream("assets/galaxy.txt") >> deterministic;
+    std::ifstream("assets/galaxy.txt") >> scalar;
+    deterministic.setForceBackend(ForceBackend::Simd);
+    deterministic.setDeterministic(true);
+    deterministic.setThreads(3);
+    scalar.setForceBackend(ForceBackend::Simd);
+    scalar.setSimdLevel(SimdLevel::Scalar);
+    for (int i = 0; i < 3; ++i) {
+        deterministic.step(25000.0);
+        scalar.step(25000.0);
+    }
+    BOOST_CHECK(deterministic.simdLevel() == detectSimdLevel());
+    BOOST_CHECK_EQUAL(stateHash(deterministic.bodies()), stateHash(scalar.bodies()));
+
+    // One bit anywhere changes the hash
+    BodyState nudged = scalar.bodies();
+    BOOST_CHECK_EQUAL(stateHash(nudged), stateHash(scalar.bodies()));
+    nudged.vy.back() = std::nextafter(nudged.vy.back(), 0.0);
+    BOOST_CHECK_NE(stateHash(nudged), stateHash(scalar.bodies()));
+    nudged = scalar.bodies();
+    nudged.setDimensions(3);
+    BOOST_CHECK_NE(stateHash(nudged), stateHash(scalar.bodies()));
+
+    // --hash K prints every Kth step
+    char program[] = "NBody", total[] = "10", step[] = "1", flag[] = "--hash", every[] = "2";
+    char* argv[] = {program, total, step, flag, every};
+    Options options = parseOptions(5, argv);
+    BOOST_CHECK_EQUAL(options.hashEvery, 2u);
+    std::ostringstream log;
+    reportHash(scalar, {3, 3.0}, options, log);
+    BOOST_CHECK(log.str().empty());
+    reportHash(scalar, {4, 4.0}, options, log);
+    std::ostringstream expected;
+    expected << "step 4 hash " << std::hex << std::setw(16) << std::setfill('0')
+             << stateHash(scalar.bodies()) << std::endl;
+    BOOST_CHECK_EQUAL(log.str(), expected.str());
+}
+
+BOOST_AUTO_TEST_CASE(testProfilerCountsPhases) {
+    std::cout << "testProfilerCountsPhases" << std::endl;
+    Simulation simulation;
+    std::ifstream("assets/3body.txt") >> simulation;
+    Profiler::reset();
+    Profiler::enable(true);
+    for (int i = 0; i < 3; ++i) {
+        simulation.step(1000.0);
+    }
+    Profiler::disable();
+    simulation.step(1000.0);
+
+    std::ostringstream summary, trace;
+    Profiler::summary(summary);
+    Profiler::writeTrace(trace);
+    Profiler::reset();
+    BOOST_CHECK(summary.str().find("step                       3") != std::string::npos);
+    BOOST_CHECK(summary.str().find("forces                     3") != std::string::npos);
+    BOOST_CHECK(summary.str().find("parse") == std::string::npos);
+    std::size_t events = 0;
+    for (std::size_t at = trace.str().find("\"ph\": \"X\""); at != std::string::npos;
+         at = trace.str().find("\"ph\": \"X\"", at + 1)) {
+        ++events;
+    }
+    BOOST_CHECK_EQUAL(events, 6u);
+}
 
 }  //  namespace NB